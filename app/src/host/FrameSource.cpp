@@ -0,0 +1,207 @@
+#include "FrameSource.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+static void setupPlanarFrame(SourceFrame *frame, uint8_t *data, int width, int height) {
+
+    int chromaWidth = (width + 1) / 2;
+    int chromaHeight = (height + 1) / 2;
+
+    frame->dataY = data;
+    frame->dataU = data + width * height;
+    frame->dataV = frame->dataU + chromaWidth * chromaHeight;
+    frame->strideY = width;
+    frame->strideU = chromaWidth;
+    frame->strideV = chromaWidth;
+    frame->pixelStrideUV = 1;
+}
+
+static void setupSemiPlanarFrame(SourceFrame *frame, uint8_t *dataY, uint8_t *dataUV, int width) {
+
+    int chromaWidth = (width + 1) / 2;
+
+    frame->dataY = dataY;
+    frame->dataU = dataUV;
+    frame->dataV = dataUV + 1;
+    frame->strideY = width;
+    frame->strideU = chromaWidth * 2;
+    frame->strideV = chromaWidth * 2;
+    frame->pixelStrideUV = 2;
+}
+
+static size_t getFrameSize(int width, int height) {
+
+    return (size_t) width * height + (size_t) 2 * ((width + 1) / 2) * ((height + 1) / 2);
+}
+
+// raw
+
+RawFrameSource::RawFrameSource(const char *filePath, int width, int height, bool isNV12) :
+    width(width), height(height), isNV12(isNV12), buffer(getFrameSize(width, height)) {
+
+    file = fopen(filePath, "rb");
+    if (file == NULL)
+        throw std::runtime_error(std::string("Couldn't open ") + filePath);
+}
+
+RawFrameSource::~RawFrameSource(void) {
+
+    fclose(file);
+}
+
+bool RawFrameSource::nextFrame(SourceFrame *frame) {
+
+    if (fread(buffer.data(), 1, buffer.size(), file) != buffer.size())
+        return false;
+
+    if (isNV12)
+        setupSemiPlanarFrame(frame, buffer.data(), buffer.data() + width * height, width);
+    else
+        setupPlanarFrame(frame, buffer.data(), width, height);
+
+    return true;
+}
+
+// y4m
+
+Y4MFrameSource::Y4MFrameSource(const char *filePath) : width(0), height(0) {
+
+    file = fopen(filePath, "rb");
+    if (file == NULL)
+        throw std::runtime_error(std::string("Couldn't open ") + filePath);
+
+    char header[256];
+    if (fgets(header, sizeof(header), file) == NULL || strncmp(header, "YUV4MPEG2", 9) != 0) {
+        fclose(file);
+        throw std::runtime_error("Not a YUV4MPEG2 file");
+    }
+
+    for (char *token = strtok(header + 9, " \n"); token != NULL; token = strtok(NULL, " \n")) {
+
+        if (token[0] == 'W')
+            width = atoi(token + 1);
+        else if (token[0] == 'H')
+            height = atoi(token + 1);
+        else if (token[0] == 'C' && strncmp(token, "C420", 4) != 0) {
+            fclose(file);
+            throw std::runtime_error(std::string("Unsupported Y4M colorspace ") + token);
+        }
+    }
+
+    if (width <= 0 || height <= 0) {
+        fclose(file);
+        throw std::runtime_error("Y4M header has no frame size");
+    }
+
+    buffer.resize(getFrameSize(width, height));
+}
+
+Y4MFrameSource::~Y4MFrameSource(void) {
+
+    fclose(file);
+}
+
+bool Y4MFrameSource::nextFrame(SourceFrame *frame) {
+
+    // FRAME marker may carry parameters, skip the whole line
+    char marker[256];
+    if (fgets(marker, sizeof(marker), file) == NULL || strncmp(marker, "FRAME", 5) != 0)
+        return false;
+
+    if (fread(buffer.data(), 1, buffer.size(), file) != buffer.size())
+        return false;
+
+    setupPlanarFrame(frame, buffer.data(), width, height);
+
+    return true;
+}
+
+// synthetic
+
+#define SYNTHETIC_BACKGROUND 150
+#define SYNTHETIC_OBJECT_SIZE 64
+#define SYNTHETIC_EVENT_PERIOD 200 // frames, object is visible for the first half
+
+SyntheticFrameSource::SyntheticFrameSource(int width, int height, int framesCount) :
+    width(width), height(height), framesLeft(framesCount), frameNum(0), seed(1),
+    background((size_t) width * height), buffer(getFrameSize(width, height)) {
+
+    for (int y = 0; y < height; y++)
+        for (int x = 0; x < width; x++)
+            background[y * width + x] = (uint8_t) (SYNTHETIC_BACKGROUND + ((x / 32 + y / 32) % 2) * 20);
+}
+
+bool SyntheticFrameSource::nextFrame(SourceFrame *frame) {
+
+    if (framesLeft-- <= 0)
+        return false;
+
+    uint8_t *dataY = buffer.data();
+
+    // sensor noise
+    for (int i = 0; i < width * height; i++) {
+        seed = seed * 1103515245 + 12345;
+        dataY[i] = (uint8_t) (background[i] + (int) ((seed >> 16) & 3) - 1);
+    }
+
+    int eventFrame = frameNum % SYNTHETIC_EVENT_PERIOD;
+    if (eventFrame < SYNTHETIC_EVENT_PERIOD / 2) {
+
+        int objectX = eventFrame * (width - SYNTHETIC_OBJECT_SIZE) / (SYNTHETIC_EVENT_PERIOD / 2);
+        int objectY = height - height / 4 - SYNTHETIC_OBJECT_SIZE / 2;
+
+        for (int y = objectY; y < objectY + SYNTHETIC_OBJECT_SIZE; y++)
+            memset(dataY + y * width + objectX, 240, SYNTHETIC_OBJECT_SIZE);
+    }
+
+    memset(dataY + width * height, 128, buffer.size() - (size_t) width * height);
+
+    setupPlanarFrame(frame, dataY, width, height);
+
+    frameNum++;
+
+    return true;
+}
+
+// semi planar repacking
+
+SemiPlanarFrameSource::SemiPlanarFrameSource(FrameSource *source) : source(source) {
+}
+
+SemiPlanarFrameSource::~SemiPlanarFrameSource(void) {
+
+    delete source;
+}
+
+bool SemiPlanarFrameSource::nextFrame(SourceFrame *frame) {
+
+    if (!source->nextFrame(frame))
+        return false;
+
+    if (frame->pixelStrideUV == 2)
+        return true;
+
+    int chromaWidth = (getWidth() + 1) / 2;
+    int chromaHeight = (getHeight() + 1) / 2;
+
+    chroma.resize((size_t) chromaWidth * 2 * chromaHeight);
+
+    for (int y = 0; y < chromaHeight; y++) {
+
+        uint8_t *srcU = frame->dataU + y * frame->strideU;
+        uint8_t *srcV = frame->dataV + y * frame->strideV;
+        uint8_t *dstUV = chroma.data() + y * chromaWidth * 2;
+
+        for (int x = 0; x < chromaWidth; x++) {
+            dstUV[x * 2 + 0] = srcU[x];
+            dstUV[x * 2 + 1] = srcV[x];
+        }
+    }
+
+    setupSemiPlanarFrame(frame, frame->dataY, chroma.data(), getWidth());
+
+    return true;
+}
@@ -0,0 +1,90 @@
+#ifndef PEOPLEWATCHER_FRAMESOURCE_H
+#define PEOPLEWATCHER_FRAMESOURCE_H
+
+#include <cstdio>
+#include <inttypes.h>
+#include <vector>
+
+// frame in camera's YUV_420_888 terms, so it can be passed to Engine::sendFrame as is
+struct SourceFrame {
+    uint8_t *dataY, *dataU, *dataV;
+    int strideY, strideU, strideV;
+    int pixelStrideUV;
+};
+
+class FrameSource {
+public:
+    virtual ~FrameSource(void) { }
+
+    virtual int getWidth(void) = 0;
+    virtual int getHeight(void) = 0;
+
+    // returns false when there are no more frames
+    virtual bool nextFrame(SourceFrame *frame) = 0;
+};
+
+// I420 or NV12 frames stored back to back without any header
+class RawFrameSource : public FrameSource {
+private:
+    FILE *file;
+    int width, height;
+    bool isNV12;
+    std::vector<uint8_t> buffer;
+public:
+    RawFrameSource(const char *filePath, int width, int height, bool isNV12);
+    ~RawFrameSource(void);
+
+    int getWidth(void) { return width; }
+    int getHeight(void) { return height; }
+
+    bool nextFrame(SourceFrame *frame);
+};
+
+// YUV4MPEG2 with 4:2:0 chroma
+class Y4MFrameSource : public FrameSource {
+private:
+    FILE *file;
+    int width, height;
+    std::vector<uint8_t> buffer;
+public:
+    Y4MFrameSource(const char *filePath);
+    ~Y4MFrameSource(void);
+
+    int getWidth(void) { return width; }
+    int getHeight(void) { return height; }
+
+    bool nextFrame(SourceFrame *frame);
+};
+
+// noisy static background with a square that crosses the frame from time to time
+class SyntheticFrameSource : public FrameSource {
+private:
+    int width, height;
+    int framesLeft, frameNum;
+    unsigned int seed;
+    std::vector<uint8_t> background, buffer;
+public:
+    SyntheticFrameSource(int width, int height, int framesCount);
+
+    int getWidth(void) { return width; }
+    int getHeight(void) { return height; }
+
+    bool nextFrame(SourceFrame *frame);
+};
+
+// repacks planar chroma of another source into interleaved UV buffer, like most cameras deliver it
+class SemiPlanarFrameSource : public FrameSource {
+private:
+    FrameSource *source;
+    std::vector<uint8_t> chroma;
+public:
+    SemiPlanarFrameSource(FrameSource *source);
+    ~SemiPlanarFrameSource(void);
+
+    int getWidth(void) { return source->getWidth(); }
+    int getHeight(void) { return source->getHeight(); }
+
+    bool nextFrame(SourceFrame *frame);
+};
+
+#endif //PEOPLEWATCHER_FRAMESOURCE_H
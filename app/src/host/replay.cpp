@@ -0,0 +1,500 @@
+// Drives Engine with frames from files or generators on a Linux host and reports
+// sustained fps, drops per drop site and per stage latencies. Every input becomes a separate stream.
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <cerrno>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "Engine.h"
+#include "EngineStats.h"
+#include "FlowDetectorEngine.h"
+#include "FrameSource.h"
+#include "PersonClassifier.h"
+
+extern "C" {
+#include "generalUtils.h"
+#include "log.h"
+}
+
+#define DEFAULT_DETECTION_OFFSET_Y 200
+
+struct ReplayOptions {
+    std::vector<const char*> inputPaths;
+    const char *rawFormat;
+    int rawWidth, rawHeight;
+    int syntheticFrames;
+    int syntheticStreams;
+    int syntheticWidth, syntheticHeight;
+    int detectionOffsetY;
+    std::vector<DetectionZone> detectionZones;
+    bool coldFlow;
+    bool verifyWarmStart;
+    bool verifyFixedFlow;
+    double blurSigma;
+    int detectionBatch;
+    bool fullRate;
+    bool noTracking;
+    const char *personModel;
+    int preRollSeconds;
+    double frameMemory;
+    DetectorEngineType detectorEngine;
+    bool benchmarkBlur;
+    bool benchmarkFlow;
+    bool benchmarkClassifier;
+    bool semiPlanar;
+    double fps;
+    bool realtime;
+    bool backpressure;
+    PlacementPolicy placement;
+    const char *outputDir;
+};
+
+static void printUsage(const char *name) {
+
+    fprintf(stderr,
+            "usage: %s [options] <input.y4m | input.yuv ... | --synthetic N>\n"
+            "  --raw i420|nv12 WxH   inputs are raw frames of given layout and size\n"
+            "  --synthetic N         generate N frames with a moving object instead of reading a file\n"
+            "  --streams K           number of synthetic streams (default 1)\n"
+            "  --size WxH            size of synthetic frames (default 640x480)\n"
+            "  --offset-y N          rows at the top ignored by detector (default 200, 0 when zones are given)\n"
+            "  --include x,y,x,y,... polygon detection looks in, repeatable (default whole frame)\n"
+            "  --exclude x,y,x,y,... polygon detection ignores even inside included ones, repeatable\n"
+            "  --detector NAME       farneback, dis-ultrafast, dis-fast, fixed-flow, mog2 or cnt\n"
+            "                        (default farneback)\n"
+            "  --cold-flow           always start optical flow from zero\n"
+            "  --verify-warm-start   run cold flow next to every warm started one and count agreement\n"
+            "  --verify-fixed-flow   run Farneback next to every fixed-flow region and count agreement\n"
+            "  --blur-sigma S        blur strength before flow (default 3.5)\n"
+            "  --batch N             most frame pairs per detection task during bursts, 1 disables\n"
+            "                        batching (default 4)\n"
+            "  --full-rate           detect every frame pair instead of adapting the rate to activity\n"
+            "  --no-tracking         examine the whole frame during events instead of tracked motion first\n"
+            "  --person-model PATH   record motion only when this person classifier model sees a person\n"
+            "  --pre-roll S          keep S seconds encoded before motion and record them with it\n"
+            "  --frame-memory MB     memory all streams may hold in raw frames (default 64)\n"
+            "  --benchmark-blur      check box blur against OpenCV gaussian, time both and exit\n"
+            "  --benchmark-flow      check fixed-flow decisions against Farneback, time both and exit\n"
+            "  --benchmark-person    check SIMD int8 convolution against scalar, time both and exit\n"
+            "  --nv12                repack planar input into interleaved chroma, like the camera does\n"
+            "  --fps F               timestamps step (default 20)\n"
+            "  --realtime            send frames at --fps instead of as fast as possible\n"
+            "  --backpressure        wait for the detector instead of dropping frames\n"
+            "  --placement NAME      floating or capacity (fast cores for detection and encoding)\n"
+            "                        (default floating)\n"
+            "  --out DIR             where records are written, one subdirectory per stream (default .)\n"
+            "  --verbose             print engine debug log\n",
+            name);
+}
+
+static bool parseZone(const char *value, bool exclude, std::vector<DetectionZone> *zones) {
+
+    DetectionZone zone;
+    zone.exclude = exclude;
+
+    int x, y, length;
+
+    while (sscanf(value, "%d,%d%n", &x, &y, &length) == 2) {
+
+        zone.polygon.push_back(Point(x, y));
+
+        value += length;
+        if (*value == ',')
+            value++;
+    }
+
+    if (*value != '\0' || zone.polygon.size() < 3)
+        return false;
+
+    zones->push_back(zone);
+
+    return true;
+}
+
+static bool parseOptions(int argc, char **argv, ReplayOptions *options) {
+
+    *options = { };
+    options->fps = 20.0;
+    options->outputDir = ".";
+    options->syntheticStreams = 1;
+    options->syntheticWidth = 640;
+    options->syntheticHeight = 480;
+    options->detectionOffsetY = -1;
+    options->blurSigma = MotionDetectorConfig().blurSigma;
+    options->detectionBatch = MotionDetectorConfig().maxDetectionBatch;
+    options->detectorEngine = MotionDetectorConfig().engine;
+    options->placement = EngineConfig().placement;
+    options->frameMemory = EngineConfig().frameMemoryBudget / (1024.0 * 1024.0);
+
+    for (int i = 1; i < argc; i++) {
+
+        const char *arg = argv[i];
+        bool hasValue = i + 1 < argc;
+
+        if (strcmp(arg, "--raw") == 0 && i + 2 < argc) {
+            options->rawFormat = argv[++i];
+            if (sscanf(argv[++i], "%dx%d", &options->rawWidth, &options->rawHeight) != 2)
+                return false;
+        } else if (strcmp(arg, "--synthetic") == 0 && hasValue) {
+            options->syntheticFrames = atoi(argv[++i]);
+        } else if (strcmp(arg, "--streams") == 0 && hasValue) {
+            options->syntheticStreams = atoi(argv[++i]);
+        } else if (strcmp(arg, "--size") == 0 && hasValue) {
+            if (sscanf(argv[++i], "%dx%d", &options->syntheticWidth, &options->syntheticHeight) != 2)
+                return false;
+        } else if (strcmp(arg, "--offset-y") == 0 && hasValue) {
+            options->detectionOffsetY = atoi(argv[++i]);
+            if (options->detectionOffsetY < 0)
+                return false;
+        } else if (strcmp(arg, "--include") == 0 && hasValue) {
+            if (!parseZone(argv[++i], false, &options->detectionZones))
+                return false;
+        } else if (strcmp(arg, "--exclude") == 0 && hasValue) {
+            if (!parseZone(argv[++i], true, &options->detectionZones))
+                return false;
+        } else if (strcmp(arg, "--detector") == 0 && hasValue) {
+            options->detectorEngine = DetectorEngine::getTypeByName(argv[++i]);
+            if (options->detectorEngine == DetectorEngineTypesCount)
+                return false;
+        } else if (strcmp(arg, "--cold-flow") == 0) {
+            options->coldFlow = true;
+        } else if (strcmp(arg, "--verify-warm-start") == 0) {
+            options->verifyWarmStart = true;
+        } else if (strcmp(arg, "--verify-fixed-flow") == 0) {
+            options->verifyFixedFlow = true;
+        } else if (strcmp(arg, "--blur-sigma") == 0 && hasValue) {
+            options->blurSigma = atof(argv[++i]);
+        } else if (strcmp(arg, "--batch") == 0 && hasValue) {
+            options->detectionBatch = atoi(argv[++i]);
+        } else if (strcmp(arg, "--full-rate") == 0) {
+            options->fullRate = true;
+        } else if (strcmp(arg, "--no-tracking") == 0) {
+            options->noTracking = true;
+        } else if (strcmp(arg, "--person-model") == 0 && hasValue) {
+            options->personModel = argv[++i];
+        } else if (strcmp(arg, "--pre-roll") == 0 && hasValue) {
+            options->preRollSeconds = atoi(argv[++i]);
+            if (options->preRollSeconds < 0)
+                return false;
+        } else if (strcmp(arg, "--frame-memory") == 0 && hasValue) {
+            options->frameMemory = atof(argv[++i]);
+            if (options->frameMemory <= 0)
+                return false;
+        } else if (strcmp(arg, "--benchmark-blur") == 0) {
+            options->benchmarkBlur = true;
+        } else if (strcmp(arg, "--benchmark-flow") == 0) {
+            options->benchmarkFlow = true;
+        } else if (strcmp(arg, "--benchmark-person") == 0) {
+            options->benchmarkClassifier = true;
+        } else if (strcmp(arg, "--nv12") == 0) {
+            options->semiPlanar = true;
+        } else if (strcmp(arg, "--fps") == 0 && hasValue) {
+            options->fps = atof(argv[++i]);
+        } else if (strcmp(arg, "--realtime") == 0) {
+            options->realtime = true;
+        } else if (strcmp(arg, "--backpressure") == 0) {
+            options->backpressure = true;
+        } else if (strcmp(arg, "--placement") == 0 && hasValue) {
+            options->placement = ThreadPlacement::getPolicyByName(argv[++i]);
+            if (options->placement == PlacementPoliciesCount)
+                return false;
+        } else if (strcmp(arg, "--out") == 0 && hasValue) {
+            options->outputDir = argv[++i];
+        } else if (strcmp(arg, "--verbose") == 0) {
+            host_log_priority = ANDROID_LOG_DEBUG;
+        } else if (arg[0] != '-') {
+            options->inputPaths.push_back(arg);
+        } else
+            return false;
+    }
+
+    // default crop only applies when nothing else says where to look
+    if (options->detectionOffsetY < 0)
+        options->detectionOffsetY = options->detectionZones.empty() ? DEFAULT_DETECTION_OFFSET_Y : 0;
+
+    if (options->fps <= 0.0 || options->syntheticStreams <= 0 ||
+        options->blurSigma <= 0.0 || options->detectionBatch < 1 ||
+        options->detectionBatch > MotionDetector::MAX_DETECTION_BATCH)
+        return false;
+
+    return options->benchmarkBlur || options->benchmarkFlow || options->benchmarkClassifier ||
+           !options->inputPaths.empty() || options->syntheticFrames > 0;
+}
+
+static FrameSource* createFrameSource(const ReplayOptions &options, int index) {
+
+    FrameSource *source;
+
+    if (options.syntheticFrames > 0)
+        source = new SyntheticFrameSource(options.syntheticWidth, options.syntheticHeight,
+                                          options.syntheticFrames);
+    else if (options.rawFormat != NULL)
+        source = new RawFrameSource(options.inputPaths[index], options.rawWidth, options.rawHeight,
+                                    strcmp(options.rawFormat, "nv12") == 0);
+    else
+        source = new Y4MFrameSource(options.inputPaths[index]);
+
+    if (options.semiPlanar)
+        source = new SemiPlanarFrameSource(source);
+
+    return source;
+}
+
+static void printReport(const Engine &engine, const std::vector<FrameLimits> &frameLimits, long long framesRead,
+                        double elapsed) {
+
+    int streamsCount = (int) frameLimits.size();
+
+    EngineStats &stats = EngineStats::getInstance();
+    const ThreadPlacement &placement = engine.getPlacement();
+    const ThreadBudget &budget = engine.getThreadBudget();
+
+    printf("streams:       %d\n", streamsCount);
+    printf("frames:        %lld in %.2f s\n", framesRead, elapsed);
+    printf("sustained fps: %.2f (%.2f per stream)\n", framesRead / elapsed, framesRead / elapsed / streamsCount);
+
+    printf("\ndrops:\n");
+    for (int site = 0; site < DropSitesCount; site++)
+        printf("  %-36s %lld\n", EngineStats::getDropSiteName((DropSite) site),
+               stats.getDrops((DropSite) site));
+
+    printf("\ncounters:\n");
+    for (int counter = 0; counter < EngineCountersCount; counter++)
+        printf("  %-36s %lld\n", EngineStats::getCounterName((EngineCounter) counter),
+               stats.getCount((EngineCounter) counter));
+
+    printf("\nlatency (ms):     %10s %10s %10s %10s\n", "count", "p50", "p99", "max");
+    for (int stage = 0; stage < PipelineStagesCount; stage++) {
+
+        StageLatency latency = stats.getLatency((PipelineStage) stage);
+
+        printf("  %-14s %10lld %10.3f %10.3f %10.3f\n", EngineStats::getStageName((PipelineStage) stage),
+               latency.count, latency.p50 * 1000.0, latency.p99 * 1000.0, latency.max * 1000.0);
+    }
+
+    printf("\ndetection workers: %10s %10s %10s %10s\n", "tasks", "stolen", "busy s", "idle s");
+    for (int worker = 0; worker < EngineStats::MAX_WORKERS; worker++) {
+
+        WorkerStats workerStats = stats.getWorkerStats(worker);
+
+        if (workerStats.tasks > 0)
+            printf("  %-14d %10lld %10lld %10.2f %10.2f\n", worker, workerStats.tasks, workerStats.stolenTasks,
+                   workerStats.busy, workerStats.idle);
+    }
+
+    printf("\nplacement:        %s\n", ThreadPlacement::getPolicyName(placement.getPolicy()));
+
+    printf("  %-14s", "capacities");
+    for (int cpu = 0; cpu < placement.getCpusCount(); cpu++)
+        printf(" %d:%d", cpu, placement.getCapacity(cpu));
+    printf("%s\n", placement.areCapacitiesKnown() ? "" : " (unknown)");
+
+    for (int role = 0; role < ThreadRolesCount; role++) {
+
+        char cpus[128];
+        ThreadPlacement::formatCpus(placement.getRoleCpus((ThreadRole) role), cpus, sizeof(cpus));
+
+        printf("  %-14s %s\n", ThreadPlacement::getRoleName((ThreadRole) role), cpus);
+    }
+
+    printf("\nthread budget:    %d cores\n", budget.getCores());
+    printf("  %-14s %d of %d workers\n", "detection", budget.getDetectionThreads(), budget.getMaxDetectionThreads());
+    printf("  %-14s %d per encoder\n", "encoder", budget.getEncoderThreads());
+    printf("  %-14s %d\n", "opencv", budget.getOpenCVThreads());
+
+    const FrameBudget &frameBudget = engine.getFrameBudget();
+
+    printf("\nframe memory:     %.1f MB budget, %.1f MB reserved by streams\n",
+           frameBudget.getBytes() / (1024.0 * 1024.0), frameBudget.getPeakBytes() / (1024.0 * 1024.0));
+    printf("  %-14s %10s %10s %10s %10s %10s\n", "stream", "queued", "scheduled", "waiting", "encoder", "max MB");
+    for (int i = 0; i < streamsCount; i++) {
+
+        const FrameLimits &limits = frameLimits[i];
+
+        printf("  %-14d %10d %10d %10d %10d %10.1f\n", i, limits.queuedFrames, limits.scheduledDetections,
+               limits.waitingFrames, limits.encoderFrames, limits.getBytes() / (1024.0 * 1024.0));
+    }
+}
+
+static int replay(const ReplayOptions &options) {
+
+    int streamsCount = options.syntheticFrames > 0 ? options.syntheticStreams : (int) options.inputPaths.size();
+
+    std::vector<FrameSource*> sources;
+    for (int i = 0; i < streamsCount; i++)
+        sources.push_back(createFrameSource(options, i));
+
+    Engine engine;
+    std::vector<int> streamIds;
+    // streams are gone after finalization, their limits are reported with the rest
+    std::vector<FrameLimits> frameLimits;
+
+    EngineConfig engineConfig;
+    engineConfig.placement = options.placement;
+    engineConfig.frameMemoryBudget = (size_t) (options.frameMemory * 1024 * 1024);
+    if (options.personModel != NULL)
+        engineConfig.personModel = options.personModel;
+
+    engine.initialize(engineConfig);
+
+    for (int i = 0; i < streamsCount; i++) {
+
+        FrameSource *source = sources[i];
+
+        std::string outputDir = std::string(options.outputDir) + "/stream" + std::to_string(i);
+        if (mkdir(outputDir.c_str(), 0777) != 0 && errno != EEXIST)
+            throw std::runtime_error("couldn't create " + outputDir);
+
+        StreamConfig config;
+        config.outputDir = outputDir;
+        config.width = source->getWidth();
+        config.height = source->getHeight();
+        config.preRollSeconds = options.preRollSeconds;
+        config.frameMemory = engineConfig.frameMemoryBudget / streamsCount;
+        config.detector.zones = options.detectionZones;
+
+        // rows at the top are one more exclusion, ignored when they would cover the whole frame
+        if (options.detectionOffsetY > 0 && options.detectionOffsetY < config.height) {
+
+            DetectionZone top;
+            top.exclude = true;
+            top.polygon.push_back(Point(0, 0));
+            top.polygon.push_back(Point(config.width - 1, 0));
+            top.polygon.push_back(Point(config.width - 1, options.detectionOffsetY - 1));
+            top.polygon.push_back(Point(0, options.detectionOffsetY - 1));
+
+            config.detector.zones.push_back(top);
+        }
+
+        config.detector.warmStartFlow = !options.coldFlow;
+        config.detector.verifyWarmStart = options.verifyWarmStart;
+        config.detector.verifyFixedFlow = options.verifyFixedFlow;
+        config.detector.blurSigma = options.blurSigma;
+        config.detector.maxDetectionBatch = options.detectionBatch;
+        config.detector.adaptiveRate = !options.fullRate;
+        config.detector.trackMotion = !options.noTracking;
+        config.detector.engine = options.detectorEngine;
+
+        int streamId = engine.addStream(config);
+        frameLimits.push_back(engine.getFrameLimits(streamId));
+
+        engine.startRecord(streamId);
+        streamIds.push_back(streamId);
+    }
+
+    // camera timestamps are nanoseconds of monotonic clock, zero means "no timestamp" for the engine
+    long long frameDuration = (long long) (1000 * 1000 * 1000 / options.fps);
+    long long timestamp = frameDuration;
+
+    long long framesRead = 0;
+    long long roundsRead = 0;
+    double startTime = getTime();
+
+    std::vector<bool> finished(streamsCount, false);
+    int finishedCount = 0;
+
+    // streams are fed round robin, one frame of each per frame duration, like independent cameras would
+    while (finishedCount < streamsCount) {
+
+        if (options.realtime) {
+
+            double delay = startTime + roundsRead / options.fps - getTime();
+            if (delay > 0)
+                usleep((useconds_t) (delay * 1000 * 1000));
+        }
+
+        for (int i = 0; i < streamsCount; i++) {
+
+            if (finished[i])
+                continue;
+
+            SourceFrame frame;
+
+            if (!sources[i]->nextFrame(&frame)) {
+                finished[i] = true;
+                finishedCount++;
+                continue;
+            }
+
+            if (options.backpressure) {
+                while (!engine.canAcceptFrame(streamIds[i]))
+                    usleep(1000);
+            }
+
+            engine.sendFrame(streamIds[i], frame.dataY, frame.dataU, frame.dataV,
+                             frame.strideY, frame.strideU, frame.strideV, frame.pixelStrideUV, timestamp);
+
+            framesRead++;
+        }
+
+        timestamp += frameDuration;
+        roundsRead++;
+    }
+
+    // drain detectors and encoders so everything sent is accounted for
+    for (int i = 0; i < streamsCount; i++)
+        engine.stopRecord(streamIds[i]);
+    engine.finalize();
+
+    double elapsed = getTime() - startTime;
+
+    printReport(engine, frameLimits, framesRead, elapsed);
+
+    for (int i = 0; i < streamsCount; i++)
+        delete sources[i];
+
+    return 0;
+}
+
+int main(int argc, char **argv) {
+
+    ReplayOptions options;
+
+    host_log_priority = ANDROID_LOG_ERROR;
+
+    if (!parseOptions(argc, argv, &options)) {
+        printUsage(argv[0]);
+        return 2;
+    }
+
+    if (options.benchmarkBlur) {
+
+        host_log_priority = ANDROID_LOG_INFO;
+
+        return FlowDetectorEngine::benchmarkBlur() ? 0 : 1;
+    }
+
+    if (options.benchmarkFlow) {
+
+        host_log_priority = ANDROID_LOG_INFO;
+
+        return FlowDetectorEngine::benchmarkFlow() ? 0 : 1;
+    }
+
+    if (options.benchmarkClassifier) {
+
+        host_log_priority = ANDROID_LOG_INFO;
+
+        PersonClassifier::benchmark();
+        return 0;
+    }
+
+    // engine reports errors both as exceptions and exception pointers
+    try {
+        return replay(options);
+    } catch (const std::exception &e) {
+        fprintf(stderr, "replay failed: %s\n", e.what());
+    } catch (const std::exception *e) {
+        fprintf(stderr, "replay failed: %s\n", e->what());
+    }
+
+    return 1;
+}
@@ -9,3 +9,40 @@ double getTime(void) {
     clock_gettime(CLOCK_MONOTONIC, &time);
     return time.tv_sec + time.tv_nsec / BILLION;
 }
+
+#ifndef __ANDROID__
+
+#include <stdio.h>
+
+#include "log.h"
+
+int host_log_priority = ANDROID_LOG_INFO;
+
+int host_log_vprint(int priority, const char *tag, const char *fmt, va_list args) {
+
+    static const char priorityChars[] = "??VDIWEFS";
+
+    if (priority < host_log_priority)
+        return 0;
+
+    char priorityChar = priority >= 0 && priority <= ANDROID_LOG_SILENT ? priorityChars[priority] : '?';
+
+    fprintf(stderr, "%c/%s: ", priorityChar, tag);
+    int ret = vfprintf(stderr, fmt, args);
+    fputc('\n', stderr);
+
+    return ret;
+}
+
+int host_log_print(int priority, const char *tag, const char *fmt, ...) {
+
+    va_list args;
+
+    va_start(args, fmt);
+    int ret = host_log_vprint(priority, tag, fmt, args);
+    va_end(args);
+
+    return ret;
+}
+
+#endif
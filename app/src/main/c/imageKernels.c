@@ -0,0 +1,1344 @@
+#include "imageKernels.h"
+
+#include <math.h>
+#include <pthread.h>
+#include <stddef.h>
+
+#if defined(__ARM_NEON__) || defined(__ARM_NEON) || defined(__aarch64__)
+#define HAVE_NEON_KERNELS 1
+#include <arm_neon.h>
+#endif
+
+#if defined(__i386__) || defined(__x86_64__)
+#define HAVE_X86_KERNELS 1
+#include <immintrin.h>
+#endif
+
+#ifdef __ANDROID__
+#include <cpu-features.h>
+#endif
+
+// scalar
+
+static void split_uv_row_scalar(const uint8_t* srcUV, uint8_t* dstU, uint8_t* dstV, int width) {
+
+    for (int x = 0; x < width; x++) {
+
+        dstU[x] = srcUV[x * 2 + 0];
+        dstV[x] = srcUV[x * 2 + 1];
+    }
+}
+
+static void pick_even_row_scalar(const uint8_t* src, uint8_t* dst, int width) {
+
+    for (int x = 0; x < width; x++)
+        dst[x] = src[x * 2];
+}
+
+static uint32_t sad_row_scalar(const uint8_t* a, const uint8_t* b, int width) {
+
+    uint32_t sum = 0;
+
+    for (int x = 0; x < width; x++)
+        sum += (uint32_t) (a[x] > b[x] ? a[x] - b[x] : b[x] - a[x]);
+
+    return sum;
+}
+
+// (sum of 4 pixels / 4) * 0.75 with a single rounding
+#define DOWNSCALE_CONTRAST(sum) (((sum) * 3 + 8) >> 4)
+
+static void downscale_contrast_row_scalar(const uint8_t* src0, const uint8_t* src1, uint8_t* dst, int width) {
+
+    for (int x = 0; x < width; x++) {
+
+        int sum = src0[x * 2] + src0[x * 2 + 1] + src1[x * 2] + src1[x * 2 + 1];
+
+        dst[x] = (uint8_t) DOWNSCALE_CONTRAST(sum);
+    }
+}
+
+static void box_blur_row_scalar(uint16_t* sums, const uint8_t* add, const uint8_t* sub, uint8_t* dst, int width,
+                                uint16_t scale, uint16_t bias) {
+
+    for (int x = 0; x < width; x++) {
+
+        dst[x] = (uint8_t) (((uint32_t) (uint16_t) (sums[x] + bias) * scale) >> 16);
+        sums[x] = (uint16_t) (sums[x] + add[x] - sub[x]);
+    }
+}
+
+static void flow_gradient_range(const uint8_t* prev0, const uint8_t* cur0, const uint8_t* next0,
+                                const uint8_t* prev1, const uint8_t* cur1, const uint8_t* next1,
+                                int16_t* grad, int from, int to, int width) {
+
+    for (int x = from; x < to; x++) {
+
+        int left = x > 0 ? x - 1 : 0;
+        int right = x < width - 1 ? x + 1 : width - 1;
+
+        grad[x] = (int16_t) (cur0[right] - cur0[left] + cur1[right] - cur1[left]);
+        grad[width + x] = (int16_t) (next0[x] - prev0[x] + next1[x] - prev1[x]);
+        grad[width * 2 + x] = (int16_t) ((cur1[x] - cur0[x]) * 4);
+    }
+}
+
+static void flow_gradient_row_scalar(const uint8_t* prev0, const uint8_t* cur0, const uint8_t* next0,
+                                     const uint8_t* prev1, const uint8_t* cur1, const uint8_t* next1,
+                                     int16_t* grad, int width) {
+
+    flow_gradient_range(prev0, cur0, next0, prev1, cur1, next1, grad, 0, width, width);
+}
+
+static void flow_accumulate_range(int32_t* sums, const int16_t* add, const int16_t* sub, int from, int to,
+                                  int width) {
+
+    const int16_t *addX = add, *addY = add + width, *addT = add + width * 2;
+    const int16_t *subX = sub, *subY = sub + width, *subT = sub + width * 2;
+
+    for (int x = from; x < to; x++) {
+
+        sums[x] += addX[x] * addX[x] - subX[x] * subX[x];
+        sums[width + x] += addX[x] * addY[x] - subX[x] * subY[x];
+        sums[width * 2 + x] += addY[x] * addY[x] - subY[x] * subY[x];
+        sums[width * 3 + x] += addX[x] * addT[x] - subX[x] * subT[x];
+        sums[width * 4 + x] += addY[x] * addT[x] - subY[x] * subT[x];
+        sums[width * 5 + x] += addX[x] - subX[x];
+        sums[width * 6 + x] += addY[x] - subY[x];
+        sums[width * 7 + x] += addT[x] - subT[x];
+    }
+}
+
+static void flow_accumulate_row_scalar(int32_t* sums, const int16_t* add, const int16_t* sub, int width) {
+
+    flow_accumulate_range(sums, add, sub, 0, width, width);
+}
+
+// flow is limited to what fits 16 bits in 1/256 pixel units
+#define FLOW_LIMIT 32767.0f
+
+static void flow_solve_range(const int32_t* sums, int16_t* dx, int16_t* dy, uint8_t* mask, int from, int to,
+                             int width, float regularization, float inverseCount, int32_t minLengthSq) {
+
+    for (int x = from; x < to; x++) {
+
+        float sx = (float) sums[width * 5 + x];
+        float sy = (float) sums[width * 6 + x];
+        float st = (float) sums[width * 7 + x];
+
+        float meanX = sx * inverseCount;
+        float meanY = sy * inverseCount;
+
+        // sums around window means, temporal offset (lighting change) doesn't count as motion
+        float a = ((float) sums[x] - meanX * sx) + regularization;
+        float b = (float) sums[width + x] - meanX * sy;
+        float c = ((float) sums[width * 2 + x] - meanY * sy) + regularization;
+        float xt = (float) sums[width * 3 + x] - meanX * st;
+        float yt = (float) sums[width * 4 + x] - meanY * st;
+
+        // regularization keeps determinant positive
+        float scale = 256.0f / (a * c - b * b);
+
+        float u = (b * yt - c * xt) * scale;
+        float v = (b * xt - a * yt) * scale;
+
+        u = u > FLOW_LIMIT ? FLOW_LIMIT : (u < -FLOW_LIMIT ? -FLOW_LIMIT : u);
+        v = v > FLOW_LIMIT ? FLOW_LIMIT : (v < -FLOW_LIMIT ? -FLOW_LIMIT : v);
+
+        dx[x] = (int16_t) lrintf(u);
+        dy[x] = (int16_t) lrintf(v);
+
+        mask[x] = (uint8_t) (dx[x] * dx[x] + dy[x] * dy[x] >= minLengthSq ? 255 : 0);
+    }
+}
+
+static void flow_solve_row_scalar(const int32_t* sums, int16_t* dx, int16_t* dy, uint8_t* mask, int width,
+                                  float regularization, float inverseCount, int32_t minLengthSq) {
+
+    flow_solve_range(sums, dx, dy, mask, 0, width, width, regularization, inverseCount, minLengthSq);
+}
+
+static void flow_length_mask_row_scalar(const float* flow, uint8_t* mask, int width, float minLengthSq) {
+
+    for (int x = 0; x < width; x++) {
+
+        float fx = flow[x * 2], fy = flow[x * 2 + 1];
+
+        mask[x] = (uint8_t) (fx * fx + fy * fy >= minLengthSq ? 255 : 0);
+    }
+}
+
+static int32_t dot_u8s8_row_scalar(const uint8_t* a, const int8_t* w, int length) {
+
+    int32_t sum = 0;
+
+    for (int i = 0; i < length; i++)
+        sum += (int32_t) a[i] * w[i];
+
+    return sum;
+}
+
+static const ImageKernels scalar_kernels = {
+    "scalar",
+    split_uv_row_scalar,
+    pick_even_row_scalar,
+    sad_row_scalar,
+    downscale_contrast_row_scalar,
+    box_blur_row_scalar,
+    flow_gradient_row_scalar,
+    flow_accumulate_row_scalar,
+    flow_solve_row_scalar,
+    flow_length_mask_row_scalar,
+    dot_u8s8_row_scalar
+};
+
+// NEON
+
+#ifdef HAVE_NEON_KERNELS
+
+static void split_uv_row_neon(const uint8_t* srcUV, uint8_t* dstU, uint8_t* dstV, int width) {
+
+    int x = 0;
+
+    for (; x + 16 <= width; x += 16) {
+
+        uint8x16x2_t uv = vld2q_u8(srcUV + x * 2);
+
+        vst1q_u8(dstU + x, uv.val[0]);
+        vst1q_u8(dstV + x, uv.val[1]);
+    }
+
+    split_uv_row_scalar(srcUV + x * 2, dstU + x, dstV + x, width - x);
+}
+
+static void pick_even_row_neon(const uint8_t* src, uint8_t* dst, int width) {
+
+    int x = 0;
+
+    // last source row can end right after the last even byte, don't read past it
+    for (; x + 16 < width; x += 16) {
+
+        uint8x16x2_t pairs = vld2q_u8(src + x * 2);
+
+        vst1q_u8(dst + x, pairs.val[0]);
+    }
+
+    pick_even_row_scalar(src + x * 2, dst + x, width - x);
+}
+
+static uint32_t sad_row_neon(const uint8_t* a, const uint8_t* b, int width) {
+
+    uint32x4_t sum = vdupq_n_u32(0);
+
+    int x = 0;
+
+    for (; x + 16 <= width; x += 16) {
+
+        uint8x16_t diff = vabdq_u8(vld1q_u8(a + x), vld1q_u8(b + x));
+
+        sum = vpadalq_u16(sum, vpaddlq_u8(diff));
+    }
+
+    uint32_t total = vgetq_lane_u32(sum, 0) + vgetq_lane_u32(sum, 1) +
+                     vgetq_lane_u32(sum, 2) + vgetq_lane_u32(sum, 3);
+
+    return total + sad_row_scalar(a + x, b + x, width - x);
+}
+
+static void downscale_contrast_row_neon(const uint8_t* src0, const uint8_t* src1, uint8_t* dst, int width) {
+
+    int x = 0;
+
+    for (; x + 8 <= width; x += 8) {
+
+        uint16x8_t sum = vpaddlq_u8(vld1q_u8(src0 + x * 2));
+        sum = vpadalq_u8(sum, vld1q_u8(src1 + x * 2));
+
+        uint16x8_t scaled = vaddq_u16(sum, vshlq_n_u16(sum, 1));
+
+        // rounding shift adds 8 before shifting
+        vst1_u8(dst + x, vrshrn_n_u16(scaled, 4));
+    }
+
+    downscale_contrast_row_scalar(src0 + x * 2, src1 + x * 2, dst + x, width - x);
+}
+
+static void box_blur_row_neon(uint16_t* sums, const uint8_t* add, const uint8_t* sub, uint8_t* dst, int width,
+                              uint16_t scale, uint16_t bias) {
+
+    const uint16x4_t scale4 = vdup_n_u16(scale);
+    const uint16x8_t bias8 = vdupq_n_u16(bias);
+
+    int x = 0;
+
+    for (; x + 8 <= width; x += 8) {
+
+        uint16x8_t sum = vld1q_u16(sums + x);
+        uint16x8_t biased = vaddq_u16(sum, bias8);
+
+        uint16x4_t lo = vshrn_n_u32(vmull_u16(vget_low_u16(biased), scale4), 16);
+        uint16x4_t hi = vshrn_n_u32(vmull_u16(vget_high_u16(biased), scale4), 16);
+
+        vst1_u8(dst + x, vmovn_u16(vcombine_u16(lo, hi)));
+
+        sum = vsubw_u8(vaddw_u8(sum, vld1_u8(add + x)), vld1_u8(sub + x));
+        vst1q_u16(sums + x, sum);
+    }
+
+    box_blur_row_scalar(sums + x, add + x, sub + x, dst + x, width - x, scale, bias);
+}
+
+static void flow_gradient_row_neon(const uint8_t* prev0, const uint8_t* cur0, const uint8_t* next0,
+                                   const uint8_t* prev1, const uint8_t* cur1, const uint8_t* next1,
+                                   int16_t* grad, int width) {
+
+    flow_gradient_range(prev0, cur0, next0, prev1, cur1, next1, grad, 0, 1, width);
+
+    int x = 1;
+
+    // widening subtraction wraps around, reinterpreted as signed it is the exact difference
+#define DIFF8(a, b) vreinterpretq_s16_u16(vsubl_u8(vld1_u8(a), vld1_u8(b)))
+
+    for (; x + 9 <= width; x += 8) {
+
+        int16x8_t ix = vaddq_s16(DIFF8(cur0 + x + 1, cur0 + x - 1), DIFF8(cur1 + x + 1, cur1 + x - 1));
+        int16x8_t iy = vaddq_s16(DIFF8(next0 + x, prev0 + x), DIFF8(next1 + x, prev1 + x));
+        int16x8_t it = vshlq_n_s16(DIFF8(cur1 + x, cur0 + x), 2);
+
+        vst1q_s16(grad + x, ix);
+        vst1q_s16(grad + width + x, iy);
+        vst1q_s16(grad + width * 2 + x, it);
+    }
+
+#undef DIFF8
+
+    flow_gradient_range(prev0, cur0, next0, prev1, cur1, next1, grad, x, width, width);
+}
+
+// sum += a * b - subA * subB for 8 values
+static inline void flow_accumulate_product_neon(int32_t* sum, int16x8_t a, int16x8_t b, int16x8_t subA,
+                                                int16x8_t subB) {
+
+    int32x4_t lo = vld1q_s32(sum);
+    int32x4_t hi = vld1q_s32(sum + 4);
+
+    lo = vmlsl_s16(vmlal_s16(lo, vget_low_s16(a), vget_low_s16(b)), vget_low_s16(subA), vget_low_s16(subB));
+    hi = vmlsl_s16(vmlal_s16(hi, vget_high_s16(a), vget_high_s16(b)), vget_high_s16(subA), vget_high_s16(subB));
+
+    vst1q_s32(sum, lo);
+    vst1q_s32(sum + 4, hi);
+}
+
+static void flow_accumulate_row_neon(int32_t* sums, const int16_t* add, const int16_t* sub, int width) {
+
+    const int16x8_t ones = vdupq_n_s16(1);
+
+    int x = 0;
+
+    for (; x + 8 <= width; x += 8) {
+
+        int16x8_t ax = vld1q_s16(add + x);
+        int16x8_t ay = vld1q_s16(add + width + x);
+        int16x8_t at = vld1q_s16(add + width * 2 + x);
+        int16x8_t sx = vld1q_s16(sub + x);
+        int16x8_t sy = vld1q_s16(sub + width + x);
+        int16x8_t st = vld1q_s16(sub + width * 2 + x);
+
+        flow_accumulate_product_neon(sums + x, ax, ax, sx, sx);
+        flow_accumulate_product_neon(sums + width + x, ax, ay, sx, sy);
+        flow_accumulate_product_neon(sums + width * 2 + x, ay, ay, sy, sy);
+        flow_accumulate_product_neon(sums + width * 3 + x, ax, at, sx, st);
+        flow_accumulate_product_neon(sums + width * 4 + x, ay, at, sy, st);
+        flow_accumulate_product_neon(sums + width * 5 + x, ax, ones, sx, ones);
+        flow_accumulate_product_neon(sums + width * 6 + x, ay, ones, sy, ones);
+        flow_accumulate_product_neon(sums + width * 7 + x, at, ones, st, ones);
+    }
+
+    flow_accumulate_range(sums, add, sub, x, width, width);
+}
+
+// flow of 4 pixels in 1/256 pixel units, ARMv7 has neither division nor round to nearest conversion,
+// so there reciprocal is refined by two Newton steps and halves are rounded away from zero,
+// the result may differ from scalar by one unit
+static inline void flow_solve_neon(const int32_t* sums, int x, int width, float32x4_t regularization,
+                                   float32x4_t inverseCount, int16x4_t* u, int16x4_t* v) {
+
+    const float32x4_t limit = vdupq_n_f32(FLOW_LIMIT);
+    const float32x4_t negLimit = vdupq_n_f32(-FLOW_LIMIT);
+
+#define LOADF(plane) vcvtq_f32_s32(vld1q_s32(sums + width * (plane) + x))
+
+    float32x4_t sx = LOADF(5), sy = LOADF(6), st = LOADF(7);
+
+    float32x4_t meanX = vmulq_f32(sx, inverseCount);
+    float32x4_t meanY = vmulq_f32(sy, inverseCount);
+
+    float32x4_t a = vaddq_f32(vsubq_f32(LOADF(0), vmulq_f32(meanX, sx)), regularization);
+    float32x4_t b = vsubq_f32(LOADF(1), vmulq_f32(meanX, sy));
+    float32x4_t c = vaddq_f32(vsubq_f32(LOADF(2), vmulq_f32(meanY, sy)), regularization);
+    float32x4_t xt = vsubq_f32(LOADF(3), vmulq_f32(meanX, st));
+    float32x4_t yt = vsubq_f32(LOADF(4), vmulq_f32(meanY, st));
+
+#undef LOADF
+
+    float32x4_t det = vsubq_f32(vmulq_f32(a, c), vmulq_f32(b, b));
+
+#ifdef __aarch64__
+    float32x4_t scale = vdivq_f32(vdupq_n_f32(256.0f), det);
+#else
+    float32x4_t inverse = vrecpeq_f32(det);
+    inverse = vmulq_f32(vrecpsq_f32(det, inverse), inverse);
+    inverse = vmulq_f32(vrecpsq_f32(det, inverse), inverse);
+    float32x4_t scale = vmulq_f32(inverse, vdupq_n_f32(256.0f));
+#endif
+
+    float32x4_t fu = vmulq_f32(vsubq_f32(vmulq_f32(b, yt), vmulq_f32(c, xt)), scale);
+    float32x4_t fv = vmulq_f32(vsubq_f32(vmulq_f32(b, xt), vmulq_f32(a, yt)), scale);
+
+    fu = vmaxq_f32(vminq_f32(fu, limit), negLimit);
+    fv = vmaxq_f32(vminq_f32(fv, limit), negLimit);
+
+#ifdef __aarch64__
+    *u = vmovn_s32(vcvtnq_s32_f32(fu));
+    *v = vmovn_s32(vcvtnq_s32_f32(fv));
+#else
+    const float32x4_t half = vdupq_n_f32(0.5f);
+    const uint32x4_t signMask = vdupq_n_u32(0x80000000u);
+
+    // copies sign of the value to 0.5 and truncates value + that
+    float32x4_t halfU = vreinterpretq_f32_u32(vorrq_u32(vandq_u32(vreinterpretq_u32_f32(fu), signMask),
+                                                        vreinterpretq_u32_f32(half)));
+    float32x4_t halfV = vreinterpretq_f32_u32(vorrq_u32(vandq_u32(vreinterpretq_u32_f32(fv), signMask),
+                                                        vreinterpretq_u32_f32(half)));
+
+    *u = vmovn_s32(vcvtq_s32_f32(vaddq_f32(fu, halfU)));
+    *v = vmovn_s32(vcvtq_s32_f32(vaddq_f32(fv, halfV)));
+#endif
+}
+
+static void flow_solve_row_neon(const int32_t* sums, int16_t* dx, int16_t* dy, uint8_t* mask, int width,
+                                float regularization, float inverseCount, int32_t minLengthSq) {
+
+    const float32x4_t reg = vdupq_n_f32(regularization);
+    const float32x4_t invCount = vdupq_n_f32(inverseCount);
+    const int32x4_t threshold = vdupq_n_s32(minLengthSq);
+
+    int x = 0;
+
+    for (; x + 8 <= width; x += 8) {
+
+        int16x4_t uLo, vLo, uHi, vHi;
+        flow_solve_neon(sums, x, width, reg, invCount, &uLo, &vLo);
+        flow_solve_neon(sums, x + 4, width, reg, invCount, &uHi, &vHi);
+
+        vst1q_s16(dx + x, vcombine_s16(uLo, uHi));
+        vst1q_s16(dy + x, vcombine_s16(vLo, vHi));
+
+        int32x4_t lenLo = vmlal_s16(vmull_s16(uLo, uLo), vLo, vLo);
+        int32x4_t lenHi = vmlal_s16(vmull_s16(uHi, uHi), vHi, vHi);
+
+        uint16x8_t moving = vcombine_u16(vmovn_u32(vcgeq_s32(lenLo, threshold)),
+                                         vmovn_u32(vcgeq_s32(lenHi, threshold)));
+
+        vst1_u8(mask + x, vmovn_u16(moving));
+    }
+
+    flow_solve_range(sums, dx, dy, mask, x, width, width, regularization, inverseCount, minLengthSq);
+}
+
+static void flow_length_mask_row_neon(const float* flow, uint8_t* mask, int width, float minLengthSq) {
+
+    const float32x4_t threshold = vdupq_n_f32(minLengthSq);
+
+    int x = 0;
+
+    for (; x + 8 <= width; x += 8) {
+
+        // vld2 separates x and y of 4 pixels
+        float32x4x2_t lo = vld2q_f32(flow + x * 2);
+        float32x4x2_t hi = vld2q_f32(flow + x * 2 + 8);
+
+        float32x4_t lenLo = vmlaq_f32(vmulq_f32(lo.val[0], lo.val[0]), lo.val[1], lo.val[1]);
+        float32x4_t lenHi = vmlaq_f32(vmulq_f32(hi.val[0], hi.val[0]), hi.val[1], hi.val[1]);
+
+        uint16x8_t moving = vcombine_u16(vmovn_u32(vcgeq_f32(lenLo, threshold)),
+                                         vmovn_u32(vcgeq_f32(lenHi, threshold)));
+
+        vst1_u8(mask + x, vmovn_u16(moving));
+    }
+
+    flow_length_mask_row_scalar(flow + x * 2, mask + x, width - x, minLengthSq);
+}
+
+static int32_t dot_u8s8_row_neon(const uint8_t* a, const int8_t* w, int length) {
+
+    int32x4_t sum0 = vdupq_n_s32(0), sum1 = vdupq_n_s32(0);
+
+    int i = 0;
+
+    for (; i + 16 <= length; i += 16) {
+
+        uint8x16_t va = vld1q_u8(a + i);
+        int8x16_t vw = vld1q_s8(w + i);
+
+        // activations fit in int16 after widening, products of a lane pair fit in int32
+        int16x8_t aLow = vreinterpretq_s16_u16(vmovl_u8(vget_low_u8(va)));
+        int16x8_t aHigh = vreinterpretq_s16_u16(vmovl_u8(vget_high_u8(va)));
+        int16x8_t wLow = vmovl_s8(vget_low_s8(vw));
+        int16x8_t wHigh = vmovl_s8(vget_high_s8(vw));
+
+        sum0 = vmlal_s16(sum0, vget_low_s16(aLow), vget_low_s16(wLow));
+        sum1 = vmlal_s16(sum1, vget_high_s16(aLow), vget_high_s16(wLow));
+        sum0 = vmlal_s16(sum0, vget_low_s16(aHigh), vget_low_s16(wHigh));
+        sum1 = vmlal_s16(sum1, vget_high_s16(aHigh), vget_high_s16(wHigh));
+    }
+
+    int32x4_t sum = vaddq_s32(sum0, sum1);
+
+    int32_t total = vgetq_lane_s32(sum, 0) + vgetq_lane_s32(sum, 1) +
+                    vgetq_lane_s32(sum, 2) + vgetq_lane_s32(sum, 3);
+
+    return total + dot_u8s8_row_scalar(a + i, w + i, length - i);
+}
+
+static const ImageKernels neon_kernels = {
+    "neon",
+    split_uv_row_neon,
+    pick_even_row_neon,
+    sad_row_neon,
+    downscale_contrast_row_neon,
+    box_blur_row_neon,
+    flow_gradient_row_neon,
+    flow_accumulate_row_neon,
+    flow_solve_row_neon,
+    flow_length_mask_row_neon,
+    dot_u8s8_row_neon
+};
+
+#endif
+
+// SSE2 & AVX2
+
+#ifdef HAVE_X86_KERNELS
+
+__attribute__((target("sse2")))
+static void split_uv_row_sse2(const uint8_t* srcUV, uint8_t* dstU, uint8_t* dstV, int width) {
+
+    const __m128i mask = _mm_set1_epi16(0x00FF);
+
+    int x = 0;
+
+    for (; x + 16 <= width; x += 16) {
+
+        __m128i a = _mm_loadu_si128((const __m128i*) (srcUV + x * 2));
+        __m128i b = _mm_loadu_si128((const __m128i*) (srcUV + x * 2 + 16));
+
+        __m128i u = _mm_packus_epi16(_mm_and_si128(a, mask), _mm_and_si128(b, mask));
+        __m128i v = _mm_packus_epi16(_mm_srli_epi16(a, 8), _mm_srli_epi16(b, 8));
+
+        _mm_storeu_si128((__m128i*) (dstU + x), u);
+        _mm_storeu_si128((__m128i*) (dstV + x), v);
+    }
+
+    split_uv_row_scalar(srcUV + x * 2, dstU + x, dstV + x, width - x);
+}
+
+__attribute__((target("sse2")))
+static void pick_even_row_sse2(const uint8_t* src, uint8_t* dst, int width) {
+
+    const __m128i mask = _mm_set1_epi16(0x00FF);
+
+    int x = 0;
+
+    for (; x + 16 < width; x += 16) {
+
+        __m128i a = _mm_loadu_si128((const __m128i*) (src + x * 2));
+        __m128i b = _mm_loadu_si128((const __m128i*) (src + x * 2 + 16));
+
+        _mm_storeu_si128((__m128i*) (dst + x),
+                         _mm_packus_epi16(_mm_and_si128(a, mask), _mm_and_si128(b, mask)));
+    }
+
+    pick_even_row_scalar(src + x * 2, dst + x, width - x);
+}
+
+__attribute__((target("sse2")))
+static uint32_t sad_row_sse2(const uint8_t* a, const uint8_t* b, int width) {
+
+    __m128i sum = _mm_setzero_si128();
+
+    int x = 0;
+
+    for (; x + 16 <= width; x += 16) {
+
+        __m128i va = _mm_loadu_si128((const __m128i*) (a + x));
+        __m128i vb = _mm_loadu_si128((const __m128i*) (b + x));
+
+        // two 64 bit partial sums
+        sum = _mm_add_epi64(sum, _mm_sad_epu8(va, vb));
+    }
+
+    uint32_t total = (uint32_t) (_mm_cvtsi128_si32(sum) + _mm_cvtsi128_si32(_mm_srli_si128(sum, 8)));
+
+    return total + sad_row_scalar(a + x, b + x, width - x);
+}
+
+__attribute__((target("sse2")))
+static inline __m128i downscale_contrast_sse2(__m128i row0, __m128i row1) {
+
+    const __m128i mask = _mm_set1_epi16(0x00FF);
+    const __m128i rounding = _mm_set1_epi16(8);
+
+    __m128i sum = _mm_add_epi16(_mm_add_epi16(_mm_and_si128(row0, mask), _mm_srli_epi16(row0, 8)),
+                                _mm_add_epi16(_mm_and_si128(row1, mask), _mm_srli_epi16(row1, 8)));
+
+    __m128i scaled = _mm_add_epi16(_mm_add_epi16(sum, _mm_slli_epi16(sum, 1)), rounding);
+
+    return _mm_srli_epi16(scaled, 4);
+}
+
+__attribute__((target("sse2")))
+static void downscale_contrast_row_sse2(const uint8_t* src0, const uint8_t* src1, uint8_t* dst, int width) {
+
+    int x = 0;
+
+    for (; x + 16 <= width; x += 16) {
+
+        __m128i lo = downscale_contrast_sse2(_mm_loadu_si128((const __m128i*) (src0 + x * 2)),
+                                             _mm_loadu_si128((const __m128i*) (src1 + x * 2)));
+        __m128i hi = downscale_contrast_sse2(_mm_loadu_si128((const __m128i*) (src0 + x * 2 + 16)),
+                                             _mm_loadu_si128((const __m128i*) (src1 + x * 2 + 16)));
+
+        _mm_storeu_si128((__m128i*) (dst + x), _mm_packus_epi16(lo, hi));
+    }
+
+    downscale_contrast_row_scalar(src0 + x * 2, src1 + x * 2, dst + x, width - x);
+}
+
+__attribute__((target("sse2")))
+static void box_blur_row_sse2(uint16_t* sums, const uint8_t* add, const uint8_t* sub, uint8_t* dst, int width,
+                              uint16_t scale, uint16_t bias) {
+
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i scale8 = _mm_set1_epi16((short) scale);
+    const __m128i bias8 = _mm_set1_epi16((short) bias);
+
+    int x = 0;
+
+    for (; x + 16 <= width; x += 16) {
+
+        __m128i sumLo = _mm_loadu_si128((const __m128i*) (sums + x));
+        __m128i sumHi = _mm_loadu_si128((const __m128i*) (sums + x + 8));
+
+        __m128i outLo = _mm_mulhi_epu16(_mm_add_epi16(sumLo, bias8), scale8);
+        __m128i outHi = _mm_mulhi_epu16(_mm_add_epi16(sumHi, bias8), scale8);
+
+        _mm_storeu_si128((__m128i*) (dst + x), _mm_packus_epi16(outLo, outHi));
+
+        __m128i a = _mm_loadu_si128((const __m128i*) (add + x));
+        __m128i s = _mm_loadu_si128((const __m128i*) (sub + x));
+
+        sumLo = _mm_sub_epi16(_mm_add_epi16(sumLo, _mm_unpacklo_epi8(a, zero)), _mm_unpacklo_epi8(s, zero));
+        sumHi = _mm_sub_epi16(_mm_add_epi16(sumHi, _mm_unpackhi_epi8(a, zero)), _mm_unpackhi_epi8(s, zero));
+
+        _mm_storeu_si128((__m128i*) (sums + x), sumLo);
+        _mm_storeu_si128((__m128i*) (sums + x + 8), sumHi);
+    }
+
+    box_blur_row_scalar(sums + x, add + x, sub + x, dst + x, width - x, scale, bias);
+}
+
+// 8 pixels of flow gradients starting at x, reads cur[x - 1 .. x + 8]
+__attribute__((target("sse2")))
+static void flow_gradient_sse2(const uint8_t* prev0, const uint8_t* cur0, const uint8_t* next0,
+                               const uint8_t* prev1, const uint8_t* cur1, const uint8_t* next1,
+                               int16_t* grad, int x, int width) {
+
+    const __m128i zero = _mm_setzero_si128();
+
+#define LOAD8(ptr) _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*) (ptr)), zero)
+
+    __m128i ix = _mm_add_epi16(_mm_sub_epi16(LOAD8(cur0 + x + 1), LOAD8(cur0 + x - 1)),
+                               _mm_sub_epi16(LOAD8(cur1 + x + 1), LOAD8(cur1 + x - 1)));
+    __m128i iy = _mm_add_epi16(_mm_sub_epi16(LOAD8(next0 + x), LOAD8(prev0 + x)),
+                               _mm_sub_epi16(LOAD8(next1 + x), LOAD8(prev1 + x)));
+    __m128i it = _mm_slli_epi16(_mm_sub_epi16(LOAD8(cur1 + x), LOAD8(cur0 + x)), 2);
+
+#undef LOAD8
+
+    _mm_storeu_si128((__m128i*) (grad + x), ix);
+    _mm_storeu_si128((__m128i*) (grad + width + x), iy);
+    _mm_storeu_si128((__m128i*) (grad + width * 2 + x), it);
+}
+
+__attribute__((target("sse2")))
+static void flow_gradient_row_sse2(const uint8_t* prev0, const uint8_t* cur0, const uint8_t* next0,
+                                   const uint8_t* prev1, const uint8_t* cur1, const uint8_t* next1,
+                                   int16_t* grad, int width) {
+
+    // first and last pixels replicate the border
+    flow_gradient_range(prev0, cur0, next0, prev1, cur1, next1, grad, 0, 1, width);
+
+    int x = 1;
+
+    for (; x + 9 <= width; x += 8)
+        flow_gradient_sse2(prev0, cur0, next0, prev1, cur1, next1, grad, x, width);
+
+    flow_gradient_range(prev0, cur0, next0, prev1, cur1, next1, grad, x, width, width);
+}
+
+// sum += a * b - subA * subB for 8 values, negSubB is -subB, so each madd pair gives both terms
+__attribute__((target("sse2")))
+static inline void flow_accumulate_product_sse2(int32_t* sum, __m128i a, __m128i b, __m128i subA, __m128i negSubB) {
+
+    __m128i lo = _mm_madd_epi16(_mm_unpacklo_epi16(a, subA), _mm_unpacklo_epi16(b, negSubB));
+    __m128i hi = _mm_madd_epi16(_mm_unpackhi_epi16(a, subA), _mm_unpackhi_epi16(b, negSubB));
+
+    _mm_storeu_si128((__m128i*) sum, _mm_add_epi32(_mm_loadu_si128((const __m128i*) sum), lo));
+    _mm_storeu_si128((__m128i*) (sum + 4), _mm_add_epi32(_mm_loadu_si128((const __m128i*) (sum + 4)), hi));
+}
+
+__attribute__((target("sse2")))
+static void flow_accumulate_row_sse2(int32_t* sums, const int16_t* add, const int16_t* sub, int width) {
+
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i ones = _mm_set1_epi16(1);
+    const __m128i negOnes = _mm_set1_epi16(-1);
+
+    int x = 0;
+
+    for (; x + 8 <= width; x += 8) {
+
+        __m128i ax = _mm_loadu_si128((const __m128i*) (add + x));
+        __m128i ay = _mm_loadu_si128((const __m128i*) (add + width + x));
+        __m128i at = _mm_loadu_si128((const __m128i*) (add + width * 2 + x));
+        __m128i sx = _mm_loadu_si128((const __m128i*) (sub + x));
+        __m128i sy = _mm_loadu_si128((const __m128i*) (sub + width + x));
+        __m128i st = _mm_loadu_si128((const __m128i*) (sub + width * 2 + x));
+
+        __m128i nsx = _mm_sub_epi16(zero, sx);
+        __m128i nsy = _mm_sub_epi16(zero, sy);
+        __m128i nst = _mm_sub_epi16(zero, st);
+
+        flow_accumulate_product_sse2(sums + x, ax, ax, sx, nsx);
+        flow_accumulate_product_sse2(sums + width + x, ax, ay, sx, nsy);
+        flow_accumulate_product_sse2(sums + width * 2 + x, ay, ay, sy, nsy);
+        flow_accumulate_product_sse2(sums + width * 3 + x, ax, at, sx, nst);
+        flow_accumulate_product_sse2(sums + width * 4 + x, ay, at, sy, nst);
+        flow_accumulate_product_sse2(sums + width * 5 + x, ax, ones, sx, negOnes);
+        flow_accumulate_product_sse2(sums + width * 6 + x, ay, ones, sy, negOnes);
+        flow_accumulate_product_sse2(sums + width * 7 + x, at, ones, st, negOnes);
+    }
+
+    flow_accumulate_range(sums, add, sub, x, width, width);
+}
+
+// flow of 4 pixels in 1/256 pixel units, rounded to nearest like lrintf
+__attribute__((target("sse2")))
+static inline void flow_solve_sse2(const int32_t* sums, int x, int width, __m128 regularization,
+                                   __m128 inverseCount, __m128i* u, __m128i* v) {
+
+    const __m128 limit = _mm_set1_ps(FLOW_LIMIT);
+    const __m128 negLimit = _mm_set1_ps(-FLOW_LIMIT);
+
+#define LOADF(plane) _mm_cvtepi32_ps(_mm_loadu_si128((const __m128i*) (sums + width * (plane) + x)))
+
+    __m128 sx = LOADF(5), sy = LOADF(6), st = LOADF(7);
+
+    __m128 meanX = _mm_mul_ps(sx, inverseCount);
+    __m128 meanY = _mm_mul_ps(sy, inverseCount);
+
+    __m128 a = _mm_add_ps(_mm_sub_ps(LOADF(0), _mm_mul_ps(meanX, sx)), regularization);
+    __m128 b = _mm_sub_ps(LOADF(1), _mm_mul_ps(meanX, sy));
+    __m128 c = _mm_add_ps(_mm_sub_ps(LOADF(2), _mm_mul_ps(meanY, sy)), regularization);
+    __m128 xt = _mm_sub_ps(LOADF(3), _mm_mul_ps(meanX, st));
+    __m128 yt = _mm_sub_ps(LOADF(4), _mm_mul_ps(meanY, st));
+
+#undef LOADF
+
+    __m128 scale = _mm_div_ps(_mm_set1_ps(256.0f), _mm_sub_ps(_mm_mul_ps(a, c), _mm_mul_ps(b, b)));
+
+    __m128 fu = _mm_mul_ps(_mm_sub_ps(_mm_mul_ps(b, yt), _mm_mul_ps(c, xt)), scale);
+    __m128 fv = _mm_mul_ps(_mm_sub_ps(_mm_mul_ps(b, xt), _mm_mul_ps(a, yt)), scale);
+
+    *u = _mm_cvtps_epi32(_mm_max_ps(_mm_min_ps(fu, limit), negLimit));
+    *v = _mm_cvtps_epi32(_mm_max_ps(_mm_min_ps(fv, limit), negLimit));
+}
+
+// 8 pixels of flow and mask starting at x, threshold is minLengthSq - 1
+__attribute__((target("sse2")))
+static void flow_solve8_sse2(const int32_t* sums, int16_t* dx, int16_t* dy, uint8_t* mask, int x, int width,
+                             __m128 regularization, __m128 inverseCount, __m128i threshold) {
+
+    __m128i uLo, vLo, uHi, vHi;
+    flow_solve_sse2(sums, x, width, regularization, inverseCount, &uLo, &vLo);
+    flow_solve_sse2(sums, x + 4, width, regularization, inverseCount, &uHi, &vHi);
+
+    __m128i u = _mm_packs_epi32(uLo, uHi);
+    __m128i v = _mm_packs_epi32(vLo, vHi);
+
+    _mm_storeu_si128((__m128i*) (dx + x), u);
+    _mm_storeu_si128((__m128i*) (dy + x), v);
+
+    // squared length from 16 bit flow, dx * dx + dy * dy per madd pair
+    __m128i lenLo = _mm_madd_epi16(_mm_unpacklo_epi16(u, v), _mm_unpacklo_epi16(u, v));
+    __m128i lenHi = _mm_madd_epi16(_mm_unpackhi_epi16(u, v), _mm_unpackhi_epi16(u, v));
+
+    __m128i moving = _mm_packs_epi32(_mm_cmpgt_epi32(lenLo, threshold), _mm_cmpgt_epi32(lenHi, threshold));
+
+    _mm_storel_epi64((__m128i*) (mask + x), _mm_packs_epi16(moving, moving));
+}
+
+__attribute__((target("sse2")))
+static void flow_solve_row_sse2(const int32_t* sums, int16_t* dx, int16_t* dy, uint8_t* mask, int width,
+                                float regularization, float inverseCount, int32_t minLengthSq) {
+
+    const __m128 reg = _mm_set1_ps(regularization);
+    const __m128 invCount = _mm_set1_ps(inverseCount);
+    const __m128i threshold = _mm_set1_epi32(minLengthSq - 1);
+
+    int x = 0;
+
+    for (; x + 8 <= width; x += 8)
+        flow_solve8_sse2(sums, dx, dy, mask, x, width, reg, invCount, threshold);
+
+    flow_solve_range(sums, dx, dy, mask, x, width, width, regularization, inverseCount, minLengthSq);
+}
+
+// compare result (-1 / 0) of 4 pixels starting at flow
+__attribute__((target("sse2")))
+static inline __m128i flow_length_compare_sse2(const float* flow, __m128 threshold) {
+
+    __m128 a = _mm_loadu_ps(flow);
+    __m128 b = _mm_loadu_ps(flow + 4);
+
+    __m128 fx = _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0));
+    __m128 fy = _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1));
+
+    __m128 length = _mm_add_ps(_mm_mul_ps(fx, fx), _mm_mul_ps(fy, fy));
+
+    return _mm_castps_si128(_mm_cmpge_ps(length, threshold));
+}
+
+__attribute__((target("sse2")))
+static void flow_length_mask_row_sse2(const float* flow, uint8_t* mask, int width, float minLengthSq) {
+
+    const __m128 threshold = _mm_set1_ps(minLengthSq);
+
+    int x = 0;
+
+    for (; x + 16 <= width; x += 16) {
+
+        __m128i first = _mm_packs_epi32(flow_length_compare_sse2(flow + x * 2, threshold),
+                                        flow_length_compare_sse2(flow + x * 2 + 8, threshold));
+        __m128i second = _mm_packs_epi32(flow_length_compare_sse2(flow + x * 2 + 16, threshold),
+                                         flow_length_compare_sse2(flow + x * 2 + 24, threshold));
+
+        _mm_storeu_si128((__m128i*) (mask + x), _mm_packs_epi16(first, second));
+    }
+
+    flow_length_mask_row_scalar(flow + x * 2, mask + x, width - x, minLengthSq);
+}
+
+// packus works inside of 128 bit lanes, so results are shuffled back with permute4x64
+
+__attribute__((target("avx2")))
+static void split_uv_row_avx2(const uint8_t* srcUV, uint8_t* dstU, uint8_t* dstV, int width) {
+
+    const __m256i mask = _mm256_set1_epi16(0x00FF);
+
+    int x = 0;
+
+    for (; x + 32 <= width; x += 32) {
+
+        __m256i a = _mm256_loadu_si256((const __m256i*) (srcUV + x * 2));
+        __m256i b = _mm256_loadu_si256((const __m256i*) (srcUV + x * 2 + 32));
+
+        __m256i u = _mm256_packus_epi16(_mm256_and_si256(a, mask), _mm256_and_si256(b, mask));
+        __m256i v = _mm256_packus_epi16(_mm256_srli_epi16(a, 8), _mm256_srli_epi16(b, 8));
+
+        _mm256_storeu_si256((__m256i*) (dstU + x), _mm256_permute4x64_epi64(u, 0xD8));
+        _mm256_storeu_si256((__m256i*) (dstV + x), _mm256_permute4x64_epi64(v, 0xD8));
+    }
+
+    split_uv_row_sse2(srcUV + x * 2, dstU + x, dstV + x, width - x);
+}
+
+__attribute__((target("avx2")))
+static void pick_even_row_avx2(const uint8_t* src, uint8_t* dst, int width) {
+
+    const __m256i mask = _mm256_set1_epi16(0x00FF);
+
+    int x = 0;
+
+    for (; x + 32 < width; x += 32) {
+
+        __m256i a = _mm256_loadu_si256((const __m256i*) (src + x * 2));
+        __m256i b = _mm256_loadu_si256((const __m256i*) (src + x * 2 + 32));
+
+        __m256i even = _mm256_packus_epi16(_mm256_and_si256(a, mask), _mm256_and_si256(b, mask));
+
+        _mm256_storeu_si256((__m256i*) (dst + x), _mm256_permute4x64_epi64(even, 0xD8));
+    }
+
+    pick_even_row_sse2(src + x * 2, dst + x, width - x);
+}
+
+__attribute__((target("avx2")))
+static uint32_t sad_row_avx2(const uint8_t* a, const uint8_t* b, int width) {
+
+    __m256i sum = _mm256_setzero_si256();
+
+    int x = 0;
+
+    for (; x + 32 <= width; x += 32) {
+
+        __m256i va = _mm256_loadu_si256((const __m256i*) (a + x));
+        __m256i vb = _mm256_loadu_si256((const __m256i*) (b + x));
+
+        sum = _mm256_add_epi64(sum, _mm256_sad_epu8(va, vb));
+    }
+
+    __m128i half = _mm_add_epi64(_mm256_castsi256_si128(sum), _mm256_extracti128_si256(sum, 1));
+
+    uint32_t total = (uint32_t) (_mm_cvtsi128_si32(half) + _mm_cvtsi128_si32(_mm_srli_si128(half, 8)));
+
+    return total + sad_row_sse2(a + x, b + x, width - x);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i downscale_contrast_avx2(__m256i row0, __m256i row1) {
+
+    const __m256i mask = _mm256_set1_epi16(0x00FF);
+    const __m256i rounding = _mm256_set1_epi16(8);
+
+    __m256i sum = _mm256_add_epi16(_mm256_add_epi16(_mm256_and_si256(row0, mask), _mm256_srli_epi16(row0, 8)),
+                                   _mm256_add_epi16(_mm256_and_si256(row1, mask), _mm256_srli_epi16(row1, 8)));
+
+    __m256i scaled = _mm256_add_epi16(_mm256_add_epi16(sum, _mm256_slli_epi16(sum, 1)), rounding);
+
+    return _mm256_srli_epi16(scaled, 4);
+}
+
+__attribute__((target("avx2")))
+static void downscale_contrast_row_avx2(const uint8_t* src0, const uint8_t* src1, uint8_t* dst, int width) {
+
+    int x = 0;
+
+    for (; x + 32 <= width; x += 32) {
+
+        __m256i lo = downscale_contrast_avx2(_mm256_loadu_si256((const __m256i*) (src0 + x * 2)),
+                                             _mm256_loadu_si256((const __m256i*) (src1 + x * 2)));
+        __m256i hi = downscale_contrast_avx2(_mm256_loadu_si256((const __m256i*) (src0 + x * 2 + 32)),
+                                             _mm256_loadu_si256((const __m256i*) (src1 + x * 2 + 32)));
+
+        _mm256_storeu_si256((__m256i*) (dst + x), _mm256_permute4x64_epi64(_mm256_packus_epi16(lo, hi), 0xD8));
+    }
+
+    downscale_contrast_row_sse2(src0 + x * 2, src1 + x * 2, dst + x, width - x);
+}
+
+__attribute__((target("avx2")))
+static void box_blur_row_avx2(uint16_t* sums, const uint8_t* add, const uint8_t* sub, uint8_t* dst, int width,
+                              uint16_t scale, uint16_t bias) {
+
+    const __m256i scale16 = _mm256_set1_epi16((short) scale);
+    const __m256i bias16 = _mm256_set1_epi16((short) bias);
+
+    int x = 0;
+
+    for (; x + 32 <= width; x += 32) {
+
+        __m256i sumLo = _mm256_loadu_si256((const __m256i*) (sums + x));
+        __m256i sumHi = _mm256_loadu_si256((const __m256i*) (sums + x + 16));
+
+        __m256i outLo = _mm256_mulhi_epu16(_mm256_add_epi16(sumLo, bias16), scale16);
+        __m256i outHi = _mm256_mulhi_epu16(_mm256_add_epi16(sumHi, bias16), scale16);
+
+        _mm256_storeu_si256((__m256i*) (dst + x), _mm256_permute4x64_epi64(_mm256_packus_epi16(outLo, outHi), 0xD8));
+
+        __m256i a = _mm256_loadu_si256((const __m256i*) (add + x));
+        __m256i s = _mm256_loadu_si256((const __m256i*) (sub + x));
+
+        sumLo = _mm256_sub_epi16(_mm256_add_epi16(sumLo, _mm256_cvtepu8_epi16(_mm256_castsi256_si128(a))),
+                                 _mm256_cvtepu8_epi16(_mm256_castsi256_si128(s)));
+        sumHi = _mm256_sub_epi16(_mm256_add_epi16(sumHi, _mm256_cvtepu8_epi16(_mm256_extracti128_si256(a, 1))),
+                                 _mm256_cvtepu8_epi16(_mm256_extracti128_si256(s, 1)));
+
+        _mm256_storeu_si256((__m256i*) (sums + x), sumLo);
+        _mm256_storeu_si256((__m256i*) (sums + x + 16), sumHi);
+    }
+
+    box_blur_row_sse2(sums + x, add + x, sub + x, dst + x, width - x, scale, bias);
+}
+
+__attribute__((target("avx2")))
+static void flow_gradient_row_avx2(const uint8_t* prev0, const uint8_t* cur0, const uint8_t* next0,
+                                   const uint8_t* prev1, const uint8_t* cur1, const uint8_t* next1,
+                                   int16_t* grad, int width) {
+
+    flow_gradient_range(prev0, cur0, next0, prev1, cur1, next1, grad, 0, 1, width);
+
+    int x = 1;
+
+#define LOAD16(ptr) _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*) (ptr)))
+
+    for (; x + 17 <= width; x += 16) {
+
+        __m256i ix = _mm256_add_epi16(_mm256_sub_epi16(LOAD16(cur0 + x + 1), LOAD16(cur0 + x - 1)),
+                                      _mm256_sub_epi16(LOAD16(cur1 + x + 1), LOAD16(cur1 + x - 1)));
+        __m256i iy = _mm256_add_epi16(_mm256_sub_epi16(LOAD16(next0 + x), LOAD16(prev0 + x)),
+                                      _mm256_sub_epi16(LOAD16(next1 + x), LOAD16(prev1 + x)));
+        __m256i it = _mm256_slli_epi16(_mm256_sub_epi16(LOAD16(cur1 + x), LOAD16(cur0 + x)), 2);
+
+        _mm256_storeu_si256((__m256i*) (grad + x), ix);
+        _mm256_storeu_si256((__m256i*) (grad + width + x), iy);
+        _mm256_storeu_si256((__m256i*) (grad + width * 2 + x), it);
+    }
+
+#undef LOAD16
+
+    for (; x + 9 <= width; x += 8)
+        flow_gradient_sse2(prev0, cur0, next0, prev1, cur1, next1, grad, x, width);
+
+    flow_gradient_range(prev0, cur0, next0, prev1, cur1, next1, grad, x, width, width);
+}
+
+// unpack and madd work inside of 128 bit lanes, lo holds values 0-3 and 8-11, hi holds 4-7 and 12-15
+__attribute__((target("avx2")))
+static inline void flow_accumulate_product_avx2(int32_t* sum, __m256i a, __m256i b, __m256i subA, __m256i negSubB) {
+
+    __m256i lo = _mm256_madd_epi16(_mm256_unpacklo_epi16(a, subA), _mm256_unpacklo_epi16(b, negSubB));
+    __m256i hi = _mm256_madd_epi16(_mm256_unpackhi_epi16(a, subA), _mm256_unpackhi_epi16(b, negSubB));
+
+    __m256i first = _mm256_permute2x128_si256(lo, hi, 0x20);
+    __m256i second = _mm256_permute2x128_si256(lo, hi, 0x31);
+
+    _mm256_storeu_si256((__m256i*) sum, _mm256_add_epi32(_mm256_loadu_si256((const __m256i*) sum), first));
+    _mm256_storeu_si256((__m256i*) (sum + 8),
+                        _mm256_add_epi32(_mm256_loadu_si256((const __m256i*) (sum + 8)), second));
+}
+
+__attribute__((target("avx2")))
+static void flow_accumulate_row_avx2(int32_t* sums, const int16_t* add, const int16_t* sub, int width) {
+
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i ones = _mm256_set1_epi16(1);
+    const __m256i negOnes = _mm256_set1_epi16(-1);
+
+    int x = 0;
+
+    for (; x + 16 <= width; x += 16) {
+
+        __m256i ax = _mm256_loadu_si256((const __m256i*) (add + x));
+        __m256i ay = _mm256_loadu_si256((const __m256i*) (add + width + x));
+        __m256i at = _mm256_loadu_si256((const __m256i*) (add + width * 2 + x));
+        __m256i sx = _mm256_loadu_si256((const __m256i*) (sub + x));
+        __m256i sy = _mm256_loadu_si256((const __m256i*) (sub + width + x));
+        __m256i st = _mm256_loadu_si256((const __m256i*) (sub + width * 2 + x));
+
+        __m256i nsx = _mm256_sub_epi16(zero, sx);
+        __m256i nsy = _mm256_sub_epi16(zero, sy);
+        __m256i nst = _mm256_sub_epi16(zero, st);
+
+        flow_accumulate_product_avx2(sums + x, ax, ax, sx, nsx);
+        flow_accumulate_product_avx2(sums + width + x, ax, ay, sx, nsy);
+        flow_accumulate_product_avx2(sums + width * 2 + x, ay, ay, sy, nsy);
+        flow_accumulate_product_avx2(sums + width * 3 + x, ax, at, sx, nst);
+        flow_accumulate_product_avx2(sums + width * 4 + x, ay, at, sy, nst);
+        flow_accumulate_product_avx2(sums + width * 5 + x, ax, ones, sx, negOnes);
+        flow_accumulate_product_avx2(sums + width * 6 + x, ay, ones, sy, negOnes);
+        flow_accumulate_product_avx2(sums + width * 7 + x, at, ones, st, negOnes);
+    }
+
+    flow_accumulate_range(sums, add, sub, x, width, width);
+}
+
+__attribute__((target("avx2")))
+static inline void flow_solve_avx2(const int32_t* sums, int x, int width, __m256 regularization,
+                                   __m256 inverseCount, __m256i* u, __m256i* v) {
+
+    const __m256 limit = _mm256_set1_ps(FLOW_LIMIT);
+    const __m256 negLimit = _mm256_set1_ps(-FLOW_LIMIT);
+
+#define LOADF(plane) _mm256_cvtepi32_ps(_mm256_loadu_si256((const __m256i*) (sums + width * (plane) + x)))
+
+    __m256 sx = LOADF(5), sy = LOADF(6), st = LOADF(7);
+
+    __m256 meanX = _mm256_mul_ps(sx, inverseCount);
+    __m256 meanY = _mm256_mul_ps(sy, inverseCount);
+
+    __m256 a = _mm256_add_ps(_mm256_sub_ps(LOADF(0), _mm256_mul_ps(meanX, sx)), regularization);
+    __m256 b = _mm256_sub_ps(LOADF(1), _mm256_mul_ps(meanX, sy));
+    __m256 c = _mm256_add_ps(_mm256_sub_ps(LOADF(2), _mm256_mul_ps(meanY, sy)), regularization);
+    __m256 xt = _mm256_sub_ps(LOADF(3), _mm256_mul_ps(meanX, st));
+    __m256 yt = _mm256_sub_ps(LOADF(4), _mm256_mul_ps(meanY, st));
+
+#undef LOADF
+
+    // separate multiplies and subtracts, fused ones would round differently from the scalar code
+    __m256 scale = _mm256_div_ps(_mm256_set1_ps(256.0f), _mm256_sub_ps(_mm256_mul_ps(a, c), _mm256_mul_ps(b, b)));
+
+    __m256 fu = _mm256_mul_ps(_mm256_sub_ps(_mm256_mul_ps(b, yt), _mm256_mul_ps(c, xt)), scale);
+    __m256 fv = _mm256_mul_ps(_mm256_sub_ps(_mm256_mul_ps(b, xt), _mm256_mul_ps(a, yt)), scale);
+
+    *u = _mm256_cvtps_epi32(_mm256_max_ps(_mm256_min_ps(fu, limit), negLimit));
+    *v = _mm256_cvtps_epi32(_mm256_max_ps(_mm256_min_ps(fv, limit), negLimit));
+}
+
+__attribute__((target("avx2")))
+static void flow_solve_row_avx2(const int32_t* sums, int16_t* dx, int16_t* dy, uint8_t* mask, int width,
+                                float regularization, float inverseCount, int32_t minLengthSq) {
+
+    const __m256 reg = _mm256_set1_ps(regularization);
+    const __m256 invCount = _mm256_set1_ps(inverseCount);
+    const __m256i threshold = _mm256_set1_epi32(minLengthSq - 1);
+
+    int x = 0;
+
+    for (; x + 16 <= width; x += 16) {
+
+        __m256i uLo, vLo, uHi, vHi;
+        flow_solve_avx2(sums, x, width, reg, invCount, &uLo, &vLo);
+        flow_solve_avx2(sums, x + 8, width, reg, invCount, &uHi, &vHi);
+
+        __m256i u = _mm256_permute4x64_epi64(_mm256_packs_epi32(uLo, uHi), 0xD8);
+        __m256i v = _mm256_permute4x64_epi64(_mm256_packs_epi32(vLo, vHi), 0xD8);
+
+        _mm256_storeu_si256((__m256i*) (dx + x), u);
+        _mm256_storeu_si256((__m256i*) (dy + x), v);
+
+        // lengths come out as 0-3, 8-11 and 4-7, 12-15, packs puts them back in order within lanes
+        __m256i lenLo = _mm256_madd_epi16(_mm256_unpacklo_epi16(u, v), _mm256_unpacklo_epi16(u, v));
+        __m256i lenHi = _mm256_madd_epi16(_mm256_unpackhi_epi16(u, v), _mm256_unpackhi_epi16(u, v));
+
+        __m256i moving = _mm256_packs_epi32(_mm256_cmpgt_epi32(lenLo, threshold),
+                                            _mm256_cmpgt_epi32(lenHi, threshold));
+        __m256i bytes = _mm256_permute4x64_epi64(_mm256_packs_epi16(moving, moving), 0xD8);
+
+        _mm_storeu_si128((__m128i*) (mask + x), _mm256_castsi256_si128(bytes));
+    }
+
+    const __m128 reg4 = _mm_set1_ps(regularization);
+    const __m128 invCount4 = _mm_set1_ps(inverseCount);
+    const __m128i threshold4 = _mm_set1_epi32(minLengthSq - 1);
+
+    for (; x + 8 <= width; x += 8)
+        flow_solve8_sse2(sums, dx, dy, mask, x, width, reg4, invCount4, threshold4);
+
+    flow_solve_range(sums, dx, dy, mask, x, width, width, regularization, inverseCount, minLengthSq);
+}
+
+// shuffle_ps deinterleaves inside of 128 bit lanes, so 16 pixels come out as 0 1 4 5 8 9 12 13 | 2 3 6 7 ...
+// and are put back in order with a byte shuffle
+__attribute__((target("avx2")))
+static inline __m256i flow_length_compare_avx2(const float* flow, __m256 threshold) {
+
+    __m256 a = _mm256_loadu_ps(flow);
+    __m256 b = _mm256_loadu_ps(flow + 8);
+
+    __m256 fx = _mm256_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0));
+    __m256 fy = _mm256_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1));
+
+    __m256 length = _mm256_add_ps(_mm256_mul_ps(fx, fx), _mm256_mul_ps(fy, fy));
+
+    return _mm256_castps_si256(_mm256_cmp_ps(length, threshold, _CMP_GE_OQ));
+}
+
+__attribute__((target("avx2")))
+static void flow_length_mask_row_avx2(const float* flow, uint8_t* mask, int width, float minLengthSq) {
+
+    const __m256 threshold = _mm256_set1_ps(minLengthSq);
+    const __m128i order = _mm_setr_epi8(0, 1, 8, 9, 2, 3, 10, 11, 4, 5, 12, 13, 6, 7, 14, 15);
+
+    int x = 0;
+
+    for (; x + 16 <= width; x += 16) {
+
+        __m256i words = _mm256_packs_epi32(flow_length_compare_avx2(flow + x * 2, threshold),
+                                           flow_length_compare_avx2(flow + x * 2 + 16, threshold));
+        __m256i bytes = _mm256_packs_epi16(words, words);
+
+        // low 8 bytes of each lane hold pixels 0 1 4 5 8 9 12 13 and 2 3 6 7 10 11 14 15
+        __m128i mixed = _mm_unpacklo_epi64(_mm256_castsi256_si128(bytes), _mm256_extracti128_si256(bytes, 1));
+
+        _mm_storeu_si128((__m128i*) (mask + x), _mm_shuffle_epi8(mixed, order));
+    }
+
+    flow_length_mask_row_sse2(flow + x * 2, mask + x, width - x, minLengthSq);
+}
+
+__attribute__((target("sse2")))
+static int32_t dot_u8s8_row_sse2(const uint8_t* a, const int8_t* w, int length) {
+
+    const __m128i zero = _mm_setzero_si128();
+
+    __m128i sum = _mm_setzero_si128();
+
+    int i = 0;
+
+    for (; i + 16 <= length; i += 16) {
+
+        __m128i va = _mm_loadu_si128((const __m128i*) (a + i));
+        __m128i vw = _mm_loadu_si128((const __m128i*) (w + i));
+
+        // zero extended activations, weights are sign extended by shifting them down from the high byte
+        __m128i aLow = _mm_unpacklo_epi8(va, zero);
+        __m128i aHigh = _mm_unpackhi_epi8(va, zero);
+        __m128i wLow = _mm_srai_epi16(_mm_unpacklo_epi8(vw, vw), 8);
+        __m128i wHigh = _mm_srai_epi16(_mm_unpackhi_epi8(vw, vw), 8);
+
+        sum = _mm_add_epi32(sum, _mm_madd_epi16(aLow, wLow));
+        sum = _mm_add_epi32(sum, _mm_madd_epi16(aHigh, wHigh));
+    }
+
+    sum = _mm_add_epi32(sum, _mm_srli_si128(sum, 8));
+    sum = _mm_add_epi32(sum, _mm_srli_si128(sum, 4));
+
+    return _mm_cvtsi128_si32(sum) + dot_u8s8_row_scalar(a + i, w + i, length - i);
+}
+
+__attribute__((target("avx2")))
+static int32_t dot_u8s8_row_avx2(const uint8_t* a, const int8_t* w, int length) {
+
+    __m256i sum = _mm256_setzero_si256();
+
+    int i = 0;
+
+    // widened to 16 bits first, maddubs would saturate sums of two 255 * 127 products
+    for (; i + 16 <= length; i += 16) {
+
+        __m256i va = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*) (a + i)));
+        __m256i vw = _mm256_cvtepi8_epi16(_mm_loadu_si128((const __m128i*) (w + i)));
+
+        sum = _mm256_add_epi32(sum, _mm256_madd_epi16(va, vw));
+    }
+
+    __m128i half = _mm_add_epi32(_mm256_castsi256_si128(sum), _mm256_extracti128_si256(sum, 1));
+
+    half = _mm_add_epi32(half, _mm_srli_si128(half, 8));
+    half = _mm_add_epi32(half, _mm_srli_si128(half, 4));
+
+    return _mm_cvtsi128_si32(half) + dot_u8s8_row_scalar(a + i, w + i, length - i);
+}
+
+static const ImageKernels sse2_kernels = {
+    "sse2",
+    split_uv_row_sse2,
+    pick_even_row_sse2,
+    sad_row_sse2,
+    downscale_contrast_row_sse2,
+    box_blur_row_sse2,
+    flow_gradient_row_sse2,
+    flow_accumulate_row_sse2,
+    flow_solve_row_sse2,
+    flow_length_mask_row_sse2,
+    dot_u8s8_row_sse2
+};
+
+static const ImageKernels avx2_kernels = {
+    "avx2",
+    split_uv_row_avx2,
+    pick_even_row_avx2,
+    sad_row_avx2,
+    downscale_contrast_row_avx2,
+    box_blur_row_avx2,
+    flow_gradient_row_avx2,
+    flow_accumulate_row_avx2,
+    flow_solve_row_avx2,
+    flow_length_mask_row_avx2,
+    dot_u8s8_row_avx2
+};
+
+#endif
+
+// runtime dispatch
+
+static int cpu_have_neon(void) {
+
+#if defined(HAVE_NEON_KERNELS) && defined(__ANDROID__)
+    AndroidCpuFamily family = android_getCpuFamily();
+
+    if (family == ANDROID_CPU_FAMILY_ARM64)
+        return 1;
+
+    return family == ANDROID_CPU_FAMILY_ARM &&
+           (android_getCpuFeatures() & ANDROID_CPU_ARM_FEATURE_NEON) != 0;
+#elif defined(HAVE_NEON_KERNELS)
+    return 1;
+#else
+    return 0;
+#endif
+}
+
+static int cpu_have_sse2(void) {
+
+#if defined(HAVE_X86_KERNELS) && defined(__ANDROID__)
+    // SSSE3 is mandatory for x86 android ABI
+    return 1;
+#elif defined(HAVE_X86_KERNELS)
+    return __builtin_cpu_supports("sse2");
+#else
+    return 0;
+#endif
+}
+
+static int cpu_have_avx2(void) {
+
+#if defined(HAVE_X86_KERNELS) && defined(__ANDROID__)
+    return (android_getCpuFeatures() & ANDROID_CPU_X86_FEATURE_AVX2) != 0;
+#elif defined(HAVE_X86_KERNELS)
+    return __builtin_cpu_supports("avx2");
+#else
+    return 0;
+#endif
+}
+
+#define MAX_KERNEL_SETS 4
+
+static pthread_once_t kernels_once = PTHREAD_ONCE_INIT;
+
+static const ImageKernels* available_kernels[MAX_KERNEL_SETS];
+static int available_kernels_count;
+
+static void detect_image_kernels(void) {
+
+    available_kernels[available_kernels_count++] = &scalar_kernels;
+
+#ifdef HAVE_NEON_KERNELS
+    if (cpu_have_neon())
+        available_kernels[available_kernels_count++] = &neon_kernels;
+#endif
+
+#ifdef HAVE_X86_KERNELS
+    if (cpu_have_sse2())
+        available_kernels[available_kernels_count++] = &sse2_kernels;
+    if (cpu_have_avx2())
+        available_kernels[available_kernels_count++] = &avx2_kernels;
+#endif
+
+    // silence unused warnings on platforms without some of the checks
+    (void) cpu_have_neon;
+    (void) cpu_have_sse2;
+    (void) cpu_have_avx2;
+}
+
+const ImageKernels* get_image_kernels(void) {
+
+    pthread_once(&kernels_once, detect_image_kernels);
+
+    // sets are registered from slowest to fastest
+    return available_kernels[available_kernels_count - 1];
+}
+
+int get_available_image_kernels(const ImageKernels** kernels, int maxCount) {
+
+    pthread_once(&kernels_once, detect_image_kernels);
+
+    int count = available_kernels_count < maxCount ? available_kernels_count : maxCount;
+
+    for (int i = 0; i < count; i++)
+        kernels[i] = available_kernels[i];
+
+    return count;
+}
@@ -0,0 +1,59 @@
+#ifndef PEOPLEWATCHER_IMAGEKERNELS_H
+#define PEOPLEWATCHER_IMAGEKERNELS_H
+
+#include <inttypes.h>
+
+// per-row pixel kernels with scalar and SIMD implementations,
+// the best implementation for current CPU is selected once at runtime
+
+typedef struct ImageKernels {
+    const char* name;
+
+    // srcUV holds interleaved U/V pairs (2 * width bytes), splits them into two planar rows
+    void (*split_uv_row)(const uint8_t* srcUV, uint8_t* dstU, uint8_t* dstV, int width);
+
+    // copies every second byte of src into dst (src must hold 2 * width - 1 bytes)
+    void (*pick_even_row)(const uint8_t* src, uint8_t* dst, int width);
+
+    // sum of absolute differences between two rows (width must not exceed 65536)
+    uint32_t (*sad_row)(const uint8_t* a, const uint8_t* b, int width);
+
+    // averages 2x2 blocks of two source rows (2 * width bytes each) and scales result by 0.75
+    void (*downscale_contrast_row)(const uint8_t* src0, const uint8_t* src1, uint8_t* dst, int width);
+
+    // one step of running box sum down the columns: dst = ((sums + bias) * scale) >> 16,
+    // then sums += add - sub
+    void (*box_blur_row)(uint16_t* sums, const uint8_t* add, const uint8_t* sub, uint8_t* dst, int width,
+                         uint16_t scale, uint16_t bias);
+
+    // dense flow gradients of one row from rows above, at and below it in both frames, borders are replicated;
+    // grad receives ix, iy, it planes (width values each): ix and iy are sums of central differences
+    // of both frames, it is 4 * temporal difference, so all three have the same scale
+    void (*flow_gradient_row)(const uint8_t* prev0, const uint8_t* cur0, const uint8_t* next0,
+                              const uint8_t* prev1, const uint8_t* cur1, const uint8_t* next1,
+                              int16_t* grad, int width);
+
+    // sums hold xx, xy, yy, xt, yt, x, y, t planes of column sums, adds products (and values) of gradient row add
+    // and subtracts the ones of gradient row sub (both laid out as flow_gradient_row writes them)
+    void (*flow_accumulate_row)(int32_t* sums, const int16_t* add, const int16_t* sub, int width);
+
+    // solves regularized 2x2 Lucas-Kanade system of every pixel from its window sums (planes as above)
+    // taken around window means, writes flow in 1/256 pixel units and marks pixels whose squared flow length
+    // reaches minLengthSq, inverseCount is 1 / pixels in the window
+    void (*flow_solve_row)(const int32_t* sums, int16_t* dx, int16_t* dy, uint8_t* mask, int width,
+                           float regularization, float inverseCount, int32_t minLengthSq);
+
+    // flow holds interleaved x, y float pairs, marks (255) pixels whose squared flow length reaches minLengthSq
+    void (*flow_length_mask_row)(const float* flow, uint8_t* mask, int width, float minLengthSq);
+
+    // sum of products of unsigned activations and signed weights, quantized layers of the person classifier
+    // (length must not exceed 65536)
+    int32_t (*dot_u8s8_row)(const uint8_t* a, const int8_t* w, int length);
+} ImageKernels;
+
+const ImageKernels* get_image_kernels(void);
+
+// fills kernels with every implementation supported by current CPU, scalar one goes first
+int get_available_image_kernels(const ImageKernels** kernels, int maxCount);
+
+#endif //PEOPLEWATCHER_IMAGEKERNELS_H
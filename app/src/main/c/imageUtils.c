@@ -1,11 +1,16 @@
 #include "imageUtils.h"
 
 #include "log.h"
+#include <math.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
 #include <time.h>
 
 #include "libswscale/swscale.h"
 
 #include "generalUtils.h"
+#include "imageKernels.h"
 
 int dumpBMP24(uint8_t* pixels, int width, int height, const char* filePath) {
 
@@ -97,8 +102,21 @@ int dumpYUV420(AVFrame *yuv_frame, const char* filePath) {
     return res;
 }
 
-void convert_yuv420_888_to_yuv420p(uint8_t* dataY, uint8_t* dataU, uint8_t* dataV, int strideY,
-                                   int strideU, int strideV, AVFrame *dst) {
+static void copy_chroma_row(const uint8_t* src, uint8_t* dst, int width, int pixelStride) {
+
+    if (pixelStride == 1) {
+        memcpy(dst, src, (size_t) width);
+        return;
+    }
+
+    for (int x = 0; x < width; x++)
+        dst[x] = src[x * pixelStride];
+}
+
+static void convert_yuv420_888_to_yuv420p_with_kernels(uint8_t* dataY, uint8_t* dataU, uint8_t* dataV,
+                                                       int strideY, int strideU, int strideV,
+                                                       int pixelStrideUV, AVFrame *dst,
+                                                       const ImageKernels* kernels) {
 
     uint8_t* srcY;
     uint8_t* srcU;
@@ -128,12 +146,25 @@ void convert_yuv420_888_to_yuv420p(uint8_t* dataY, uint8_t* dataU, uint8_t* data
         }
     }
 
-    for (int y = 0; y < dst->height / 2; y++) {
+    int chromaWidth = (dst->width + 1) / 2;
+    int chromaHeight = (dst->height + 1) / 2;
+
+    // semi-planar buffers, U and V share the same memory shifted by one byte (NV12 or NV21)
+    bool interleavedUV = pixelStrideUV == 2 && strideU == strideV && (dataV == dataU + 1 || dataU == dataV + 1);
 
-        for (int x = 0; x < dst->width / 2; x++) {
+    for (int y = 0; y < chromaHeight; y++) {
 
-            dstU[x] = srcU[x * 2];
-            dstV[x] = srcV[x * 2];
+        if (interleavedUV) {
+            if (dataV == dataU + 1)
+                kernels->split_uv_row(srcU, dstU, dstV, chromaWidth);
+            else
+                kernels->split_uv_row(srcV, dstV, dstU, chromaWidth);
+        } else if (pixelStrideUV == 2) {
+            kernels->pick_even_row(srcU, dstU, chromaWidth);
+            kernels->pick_even_row(srcV, dstV, chromaWidth);
+        } else {
+            copy_chroma_row(srcU, dstU, chromaWidth, pixelStrideUV);
+            copy_chroma_row(srcV, dstV, chromaWidth, pixelStrideUV);
         }
 
         srcU += strideU;
@@ -144,6 +175,640 @@ void convert_yuv420_888_to_yuv420p(uint8_t* dataY, uint8_t* dataU, uint8_t* data
     }
 }
 
+void convert_yuv420_888_to_yuv420p(uint8_t* dataY, uint8_t* dataU, uint8_t* dataV, int strideY,
+                                   int strideU, int strideV, int pixelStrideUV, AVFrame *dst) {
+
+    convert_yuv420_888_to_yuv420p_with_kernels(dataY, dataU, dataV, strideY, strideU, strideV,
+                                               pixelStrideUV, dst, get_image_kernels());
+}
+
+int is_yuv420_888_nv12(uint8_t* dataU, uint8_t* dataV, int strideU, int strideV, int pixelStrideUV) {
+
+    return pixelStrideUV == 2 && strideU == strideV && dataV == dataU + 1;
+}
+
+static void copy_plane(uint8_t* src, int srcStride, uint8_t* dst, int dstStride, int rowSize, int height) {
+
+    if (srcStride == dstStride) {
+        memcpy(dst, src, (size_t) srcStride * (height - 1) + rowSize);
+        return;
+    }
+
+    for (int y = 0; y < height; y++) {
+
+        memcpy(dst, src, (size_t) rowSize);
+
+        src += srcStride;
+        dst += dstStride;
+    }
+}
+
+void convert_yuv420_888_to_nv12(uint8_t* dataY, uint8_t* dataUV, int strideY, int strideUV, AVFrame *dst) {
+
+    int chromaWidth = (dst->width + 1) / 2;
+    int chromaHeight = (dst->height + 1) / 2;
+
+    copy_plane(dataY, strideY, dst->data[0], dst->linesize[0], dst->width, dst->height);
+
+    // last V sample sits right after the U plane, so the full UV row is readable
+    copy_plane(dataUV, strideUV, dst->data[1], dst->linesize[1], chromaWidth * 2, chromaHeight);
+}
+
+#define ZERO_ROW_SIZE 4096
+
+static const uint8_t zero_row[ZERO_ROW_SIZE];
+
+static uint64_t downscale_gray_with_contrast_with_kernels(const uint8_t* src, int srcStride,
+                                                         uint8_t* dst, int dstStride,
+                                                         int dstWidth, int dstHeight,
+                                                         const ImageKernels* kernels) {
+
+    uint64_t sum = 0;
+
+    for (int y = 0; y < dstHeight; y++) {
+
+        kernels->downscale_contrast_row(src, src + srcStride, dst, dstWidth);
+
+        // output row is still in L1 here, its distance from zero is its sum
+        for (int x = 0; x < dstWidth; x += ZERO_ROW_SIZE) {
+
+            int width = dstWidth - x < ZERO_ROW_SIZE ? dstWidth - x : ZERO_ROW_SIZE;
+
+            sum += kernels->sad_row(dst + x, zero_row, width);
+        }
+
+        src += srcStride * 2;
+        dst += dstStride;
+    }
+
+    return sum;
+}
+
+uint64_t downscale_gray_with_contrast(const uint8_t* src, int srcStride, uint8_t* dst, int dstStride,
+                                      int dstWidth, int dstHeight) {
+
+    return downscale_gray_with_contrast_with_kernels(src, srcStride, dst, dstStride, dstWidth, dstHeight,
+                                                     get_image_kernels());
+}
+
+#define BOX_BLUR_PASSES 3
+// keeps the largest box sum and its rounded average within 16 bits
+#define BOX_BLUR_MAX_RADIUS 63
+
+// box widths whose sum of variances matches gaussian, see "Fast Almost-Gaussian Filtering" by P. Kovesi
+static void box_blur_radii(double sigma, int* radii) {
+
+    double idealWidth = sqrt(12.0 * sigma * sigma / BOX_BLUR_PASSES + 1.0);
+
+    int lowerWidth = (int) floor(idealWidth);
+    if (lowerWidth % 2 == 0)
+        lowerWidth--;
+    if (lowerWidth < 1)
+        lowerWidth = 1;
+
+    int upperWidth = lowerWidth + 2;
+
+    double idealLowerCount = (12.0 * sigma * sigma - BOX_BLUR_PASSES * lowerWidth * lowerWidth -
+                              4.0 * BOX_BLUR_PASSES * lowerWidth - 3.0 * BOX_BLUR_PASSES) / (-4.0 * lowerWidth - 4.0);
+    int lowerCount = (int) lround(idealLowerCount);
+
+    for (int i = 0; i < BOX_BLUR_PASSES; i++) {
+
+        int radius = ((i < lowerCount ? lowerWidth : upperWidth) - 1) / 2;
+
+        radii[i] = radius < BOX_BLUR_MAX_RADIUS ? radius : BOX_BLUR_MAX_RADIUS;
+    }
+}
+
+int box_blur_support(double sigma) {
+
+    int radii[BOX_BLUR_PASSES];
+    box_blur_radii(sigma, radii);
+
+    int support = 0;
+
+    for (int i = 0; i < BOX_BLUR_PASSES; i++)
+        support += radii[i];
+
+    return support;
+}
+
+int box_blur_scratch_size(int width, int height) {
+
+    int maxSide = width > height ? width : height;
+
+    // column sums and two intermediate images
+    return maxSide * (int) sizeof(uint16_t) + width * height * 2;
+}
+
+static inline int clamp_index(int index, int count) {
+
+    return index < 0 ? 0 : (index >= count ? count - 1 : index);
+}
+
+// running box sum down the columns, rows outside of the image repeat the border rows
+static void box_blur_vertical(const uint8_t* src, int srcStride, uint8_t* dst, int dstStride,
+                              int width, int height, int radius, uint16_t* sums, const ImageKernels* kernels) {
+
+    // small sigmas leave a pass without a box, its fixed point scale of 1 wouldn't fit 16 bits
+    if (radius == 0) {
+
+        for (int y = 0; y < height; y++)
+            memcpy(dst + y * dstStride, src + y * srcStride, (size_t) width);
+
+        return;
+    }
+
+    int divisor = radius * 2 + 1;
+
+    uint16_t scale = (uint16_t) ((65536 + divisor - 1) / divisor);
+    uint16_t bias = (uint16_t) (divisor / 2);
+
+    for (int x = 0; x < width; x++)
+        sums[x] = (uint16_t) (src[x] * (radius + 1));
+
+    for (int y = 1; y <= radius; y++) {
+
+        const uint8_t* row = src + clamp_index(y, height) * srcStride;
+
+        for (int x = 0; x < width; x++)
+            sums[x] += row[x];
+    }
+
+    for (int y = 0; y < height; y++) {
+
+        const uint8_t* add = src + clamp_index(y + radius + 1, height) * srcStride;
+        const uint8_t* sub = src + clamp_index(y - radius, height) * srcStride;
+
+        kernels->box_blur_row(sums, add, sub, dst + y * dstStride, width, scale, bias);
+    }
+}
+
+static void transpose_gray(const uint8_t* src, int srcStride, uint8_t* dst, int dstStride, int width, int height) {
+
+    const int BLOCK = 16;
+
+    for (int by = 0; by < height; by += BLOCK) {
+        for (int bx = 0; bx < width; bx += BLOCK) {
+
+            int endY = by + BLOCK < height ? by + BLOCK : height;
+            int endX = bx + BLOCK < width ? bx + BLOCK : width;
+
+            for (int y = by; y < endY; y++)
+                for (int x = bx; x < endX; x++)
+                    dst[x * dstStride + y] = src[y * srcStride + x];
+        }
+    }
+}
+
+// vertical passes are vectorized across columns, horizontal ones run as vertical on transposed image
+static void box_blur_gray_with_kernels(uint8_t* data, int stride, int width, int height, double sigma,
+                                       uint8_t* scratch, const ImageKernels* kernels) {
+
+    int radii[BOX_BLUR_PASSES];
+    box_blur_radii(sigma, radii);
+
+    int maxSide = width > height ? width : height;
+
+    uint16_t* sums = (uint16_t*) scratch;
+    uint8_t* first = scratch + maxSide * sizeof(uint16_t);
+    uint8_t* second = first + width * height;
+
+    // data -> first -> second -> first, image is width x height
+    box_blur_vertical(data, stride, first, width, width, height, radii[0], sums, kernels);
+    box_blur_vertical(first, width, second, width, width, height, radii[1], sums, kernels);
+    box_blur_vertical(second, width, first, width, width, height, radii[2], sums, kernels);
+
+    // first -> second (height x width) -> first -> second -> first
+    transpose_gray(first, width, second, height, width, height);
+
+    box_blur_vertical(second, height, first, height, height, width, radii[0], sums, kernels);
+    box_blur_vertical(first, height, second, height, height, width, radii[1], sums, kernels);
+    box_blur_vertical(second, height, first, height, height, width, radii[2], sums, kernels);
+
+    transpose_gray(first, height, data, stride, height, width);
+}
+
+void box_blur_gray(uint8_t* data, int stride, int width, int height, double sigma, uint8_t* scratch) {
+
+    box_blur_gray_with_kernels(data, stride, width, height, sigma, scratch, get_image_kernels());
+}
+
+// gradients are 4 times the intensity derivative, regularization adds a window of this gradient
+// (in levels per pixel) to both directions, so flat areas get near zero flow instead of an ill conditioned one,
+// smaller values let sensor noise of static scenes into the 0.1 pixel mask
+#define DENSE_FLOW_MIN_GRADIENT 2.0
+#define DENSE_FLOW_PLANES 8
+
+// sums start 16 byte aligned after the gradient rows
+static int dense_flow_sums_offset(int width, int radius) {
+
+    int ringRows = radius * 2 + 2;
+
+    return (ringRows * 3 * width * (int) sizeof(int16_t) + 15) & ~15;
+}
+
+int dense_flow_scratch_size(int width, int radius) {
+
+    // gradient rows ring (3 planes of int16), column and window sums (8 planes of int32)
+    return dense_flow_sums_offset(width, radius) + 2 * DENSE_FLOW_PLANES * width * (int) sizeof(int32_t);
+}
+
+// sum of src over [x - radius, x + radius], values outside of the row repeat the border ones
+static void window_sum_row(const int32_t* src, int32_t* dst, int width, int radius) {
+
+    int32_t sum = src[0] * (radius + 1);
+
+    for (int x = 1; x <= radius; x++)
+        sum += src[clamp_index(x, width)];
+
+    for (int x = 0; x < width; x++) {
+
+        dst[x] = sum;
+        sum += src[clamp_index(x + radius + 1, width)] - src[clamp_index(x - radius, width)];
+    }
+}
+
+// gradients of row y are computed into the ring when column sums need them for the first time
+static const int16_t* dense_flow_gradient(const uint8_t* img, int imgStride, const uint8_t* nextImg, int nextStride,
+                                          int width, int height, int y, int16_t* ring, int ringRows,
+                                          int* computedRows, const ImageKernels* kernels) {
+
+    int16_t* grad = ring + (y % ringRows) * 3 * width;
+
+    for (; *computedRows <= y; (*computedRows)++) {
+
+        int row = *computedRows;
+        int prevY = clamp_index(row - 1, height);
+        int nextY = clamp_index(row + 1, height);
+
+        kernels->flow_gradient_row(img + prevY * imgStride, img + row * imgStride, img + nextY * imgStride,
+                                   nextImg + prevY * nextStride, nextImg + row * nextStride,
+                                   nextImg + nextY * nextStride, ring + (row % ringRows) * 3 * width, width);
+    }
+
+    return grad;
+}
+
+static void dense_flow_mask_with_kernels(const uint8_t* img, int imgStride, const uint8_t* nextImg, int nextStride,
+                                         int width, int height, int radius, double minLength,
+                                         int16_t* dx, int16_t* dy, int flowStride, uint8_t* mask, int maskStride,
+                                         uint8_t* scratch, const ImageKernels* kernels) {
+
+    // rows y - radius - 1 and y + radius + 1 are both in the ring when sums move from row y to y + 1
+    int ringRows = radius * 2 + 2;
+    int computedRows = 0;
+
+    int16_t* ring = (int16_t*) scratch;
+    int32_t* columnSums = (int32_t*) (scratch + dense_flow_sums_offset(width, radius));
+    int32_t* windowSums = columnSums + DENSE_FLOW_PLANES * width;
+
+    memset(columnSums, 0, DENSE_FLOW_PLANES * width * sizeof(int32_t));
+
+    double window = radius * 2 + 1;
+    float regularization = (float) (window * window * 16.0 * DENSE_FLOW_MIN_GRADIENT * DENSE_FLOW_MIN_GRADIENT);
+    float inverseCount = (float) (1.0 / (window * window));
+
+    // flow is kept in 1/256 pixels
+    double minLengthFixed = minLength * 256.0;
+    int32_t minLengthSq = (int32_t) ceil(minLengthFixed * minLengthFixed);
+
+    // borders are replicated like in box blur, so every window has the same number of pixels,
+    // zero row is subtracted while sums are filled, ring row radius * 2 + 1 is computed only after that
+    int16_t* zero = ring + (ringRows - 1) * 3 * width;
+    memset(zero, 0, 3 * width * sizeof(int16_t));
+
+    for (int y = -radius; y <= radius; y++) {
+
+        const int16_t* grad = dense_flow_gradient(img, imgStride, nextImg, nextStride, width, height,
+                                                  clamp_index(y, height), ring, ringRows, &computedRows, kernels);
+
+        kernels->flow_accumulate_row(columnSums, grad, zero, width);
+    }
+
+    for (int y = 0; y < height; y++) {
+
+        for (int plane = 0; plane < DENSE_FLOW_PLANES; plane++)
+            window_sum_row(columnSums + plane * width, windowSums + plane * width, width, radius);
+
+        kernels->flow_solve_row(windowSums, dx + y * flowStride, dy + y * flowStride, mask + y * maskStride, width,
+                                regularization, inverseCount, minLengthSq);
+
+        if (y == height - 1)
+            break;
+
+        const int16_t* add = dense_flow_gradient(img, imgStride, nextImg, nextStride, width, height,
+                                                 clamp_index(y + radius + 1, height), ring, ringRows,
+                                                 &computedRows, kernels);
+        const int16_t* sub = dense_flow_gradient(img, imgStride, nextImg, nextStride, width, height,
+                                                 clamp_index(y - radius, height), ring, ringRows,
+                                                 &computedRows, kernels);
+
+        kernels->flow_accumulate_row(columnSums, add, sub, width);
+    }
+}
+
+void dense_flow_mask(const uint8_t* img, int imgStride, const uint8_t* nextImg, int nextStride, int width, int height,
+                     int radius, double minLength, int16_t* dx, int16_t* dy, int flowStride,
+                     uint8_t* mask, int maskStride, uint8_t* scratch) {
+
+    dense_flow_mask_with_kernels(img, imgStride, nextImg, nextStride, width, height, radius, minLength,
+                                 dx, dy, flowStride, mask, maskStride, scratch, get_image_kernels());
+}
+
+void flow_length_mask(const float* flow, int flowStride, uint8_t* mask, int maskStride, int width, int height,
+                      double minLength) {
+
+    const ImageKernels* kernels = get_image_kernels();
+
+    float minLengthSq = (float) (minLength * minLength);
+
+    for (int y = 0; y < height; y++)
+        kernels->flow_length_mask_row(flow + y * flowStride, mask + y * maskStride, width, minLengthSq);
+}
+
+typedef struct BlobRun {
+    int start, end;     // [start, end) of the row
+    int label;
+} BlobRun;
+
+// union-find node, area and box are valid for roots
+typedef struct BlobLabel {
+    int parent;
+    int area;
+    int minX, minY, maxX, maxY;
+} BlobLabel;
+
+static inline int blob_runs_per_row(int width) {
+
+    // runs are separated by at least one empty pixel
+    return (width + 1) / 2;
+}
+
+int find_motion_blobs_scratch_size(int width, int height) {
+
+    int runsPerRow = blob_runs_per_row(width);
+
+    // every run can start a new label
+    return 2 * runsPerRow * (int) sizeof(BlobRun) + runsPerRow * height * (int) sizeof(BlobLabel);
+}
+
+static int blob_root(BlobLabel* labels, int label) {
+
+    while (labels[label].parent != label) {
+
+        // path halving
+        labels[label].parent = labels[labels[label].parent].parent;
+        label = labels[label].parent;
+    }
+
+    return label;
+}
+
+// joins components of two roots, returns the new root
+static int blob_union(BlobLabel* labels, int a, int b) {
+
+    if (a == b)
+        return a;
+
+    int root = a < b ? a : b;
+    int child = a < b ? b : a;
+
+    BlobLabel* r = labels + root;
+    BlobLabel* c = labels + child;
+
+    c->parent = root;
+    r->area += c->area;
+
+    r->minX = c->minX < r->minX ? c->minX : r->minX;
+    r->minY = c->minY < r->minY ? c->minY : r->minY;
+    r->maxX = c->maxX > r->maxX ? c->maxX : r->maxX;
+    r->maxY = c->maxY > r->maxY ? c->maxY : r->maxY;
+
+    return root;
+}
+
+// finds runs of non-zero pixels, skips empty 8 byte blocks at once
+static int find_row_runs(const uint8_t* row, int width, BlobRun* runs) {
+
+    int count = 0;
+    int x = 0;
+
+    while (x < width) {
+
+        while (x + 8 <= width) {
+
+            uint64_t block;
+            memcpy(&block, row + x, 8);
+
+            if (block != 0)
+                break;
+
+            x += 8;
+        }
+
+        if (x >= width)
+            break;
+
+        if (row[x] == 0) {
+            x++;
+            continue;
+        }
+
+        int start = x;
+        while (x < width && row[x] != 0)
+            x++;
+
+        runs[count].start = start;
+        runs[count].end = x;
+        runs[count].label = -1;
+        count++;
+    }
+
+    return count;
+}
+
+static void write_motion_blob(const BlobLabel* label, MotionBlob* blob) {
+
+    blob->x = label->minX;
+    blob->y = label->minY;
+    blob->width = label->maxX - label->minX + 1;
+    blob->height = label->maxY - label->minY + 1;
+    blob->area = label->area;
+}
+
+int find_motion_blobs(const uint8_t* mask, int stride, int width, int height, int minArea,
+                      MotionBlob* blobs, int maxBlobs, int* blobsCount, uint8_t* scratch) {
+
+    int runsPerRow = blob_runs_per_row(width);
+
+    BlobRun* prevRuns = (BlobRun*) scratch;
+    BlobRun* runs = prevRuns + runsPerRow;
+    BlobLabel* labels = (BlobLabel*) (runs + runsPerRow);
+
+    int prevCount = 0;
+    int labelsCount = 0;
+    int foundLabel = -1;
+
+    // a reported box of the deciding component has to be whole, so labelling goes on while it grows
+    int completeFound = blobsCount != NULL;
+
+    for (int y = 0; y < height && (foundLabel < 0 || completeFound); y++) {
+
+        int count = find_row_runs(mask + y * stride, width, runs);
+        int first = 0;
+
+        for (int i = 0; i < count && (foundLabel < 0 || completeFound); i++) {
+
+            BlobRun* run = runs + i;
+
+            // runs of the previous row that end before this one starts can't touch the following ones either
+            while (first < prevCount && prevRuns[first].end < run->start)
+                first++;
+
+            int label = -1;
+
+            // diagonal neighbours count, so previous run may end right before or start right after this one
+            for (int j = first; j < prevCount && prevRuns[j].start <= run->end; j++) {
+
+                int root = blob_root(labels, prevRuns[j].label);
+                label = label < 0 ? root : blob_union(labels, label, root);
+            }
+
+            if (label < 0) {
+
+                label = labelsCount++;
+
+                labels[label].parent = label;
+                labels[label].area = 0;
+                labels[label].minX = run->start;
+                labels[label].minY = y;
+                labels[label].maxX = run->end - 1;
+                labels[label].maxY = y;
+            }
+
+            BlobLabel* root = labels + label;
+
+            root->area += run->end - run->start;
+            root->minX = run->start < root->minX ? run->start : root->minX;
+            root->maxX = run->end - 1 > root->maxX ? run->end - 1 : root->maxX;
+            root->maxY = y;
+
+            run->label = label;
+
+            if (foundLabel < 0 && root->area >= minArea)
+                foundLabel = label;
+        }
+
+        // only runs of the next row can touch it, so a row without them ends the component
+        if (foundLabel >= 0 && completeFound) {
+
+            int foundRoot = blob_root(labels, foundLabel);
+            int grown = 0;
+
+            for (int i = 0; i < count && !grown; i++)
+                grown = blob_root(labels, runs[i].label) == foundRoot;
+
+            if (!grown)
+                break;
+        }
+
+        BlobRun* swap = prevRuns;
+        prevRuns = runs;
+        runs = swap;
+        prevCount = count;
+    }
+
+    if (blobsCount != NULL) {
+
+        int written = 0;
+
+        // later rows may have joined it under a lower label
+        if (foundLabel >= 0)
+            foundLabel = blob_root(labels, foundLabel);
+
+        if (foundLabel >= 0 && written < maxBlobs)
+            write_motion_blob(labels + foundLabel, blobs + written++);
+
+        for (int label = 0; label < labelsCount && written < maxBlobs; label++) {
+
+            if (labels[label].parent == label && label != foundLabel)
+                write_motion_blob(labels + label, blobs + written++);
+        }
+
+        *blobsCount = written;
+    }
+
+    return foundLabel >= 0;
+}
+
+// quantized layers
+
+int quantized_conv3x3_output_size(int size, int stride) {
+
+    return size >= 3 ? (size - 3) / stride + 1 : 0;
+}
+
+static inline uint8_t requantize(int32_t sum, float scale) {
+
+    // negative values are cut off, which is the ReLU of the layer
+    float value = (float) sum * scale;
+
+    return (uint8_t) (value <= 0.0f ? 0 : value >= 255.0f ? 255 : (int) (value + 0.5f));
+}
+
+static void quantized_conv3x3_with_kernels(const uint8_t* src, int width, int height, int channels, int stride,
+                                           const int8_t* weights, const int32_t* bias, const float* scale,
+                                           int outChannels, uint8_t* dst, const ImageKernels* kernels) {
+
+    int outWidth = quantized_conv3x3_output_size(width, stride);
+    int outHeight = quantized_conv3x3_output_size(height, stride);
+
+    // three neighbouring pixels of a row are one contiguous run of 3 * channels values
+    int run = 3 * channels;
+    int rowSize = width * channels;
+
+    for (int y = 0; y < outHeight; y++) {
+
+        const uint8_t* row0 = src + y * stride * rowSize;
+        const uint8_t* row1 = row0 + rowSize;
+        const uint8_t* row2 = row1 + rowSize;
+
+        for (int x = 0; x < outWidth; x++) {
+
+            int offset = x * stride * channels;
+
+            for (int o = 0; o < outChannels; o++) {
+
+                const int8_t* w = weights + o * 3 * run;
+
+                int32_t sum = bias[o] + kernels->dot_u8s8_row(row0 + offset, w, run) +
+                              kernels->dot_u8s8_row(row1 + offset, w + run, run) +
+                              kernels->dot_u8s8_row(row2 + offset, w + 2 * run, run);
+
+                *dst++ = requantize(sum, scale[o]);
+            }
+        }
+    }
+}
+
+void quantized_conv3x3(const uint8_t* src, int width, int height, int channels, int stride,
+                       const int8_t* weights, const int32_t* bias, const float* scale, int outChannels,
+                       uint8_t* dst) {
+
+    quantized_conv3x3_with_kernels(src, width, height, channels, stride, weights, bias, scale, outChannels, dst,
+                                   get_image_kernels());
+}
+
+void quantized_dense(const uint8_t* src, int length, const int8_t* weights, const int32_t* bias, int outputs,
+                     int32_t* dst) {
+
+    const ImageKernels* kernels = get_image_kernels();
+
+    for (int o = 0; o < outputs; o++)
+        dst[o] = bias[o] + kernels->dot_u8s8_row(src, weights + o * length, length);
+}
+
 #define BENCHMARK_TAG "PW_BENCHMARK"
 
 #pragma clang optimize off
@@ -153,9 +818,14 @@ void convert_yuv420_888_to_yuv420p(uint8_t* dataY, uint8_t* dataU, uint8_t* data
 
 void benchmark_convert_yuv420_888_to_yuv420p(void) {
 
+    // semi-planar layout that camera gives us: U and V are interleaved with pixel stride 2
     uint8_t* Y = malloc(WIDTH * HEIGHT);
-    uint8_t* U = malloc(WIDTH * HEIGHT);
-    uint8_t* V = malloc(WIDTH * HEIGHT);
+    uint8_t* UV = malloc(WIDTH * HEIGHT / 2);
+
+    for (int i = 0; i < WIDTH * HEIGHT; i++)
+        Y[i] = (uint8_t) i;
+    for (int i = 0; i < WIDTH * HEIGHT / 2; i++)
+        UV[i] = (uint8_t) (i * 7);
 
     AVFrame* yuv_frame = av_frame_alloc();
     yuv_frame->width = WIDTH;
@@ -164,21 +834,342 @@ void benchmark_convert_yuv420_888_to_yuv420p(void) {
     if (av_frame_get_buffer(yuv_frame, 32) < 0)
         return;
 
-    for (int times = 0; times < 10; times++) {
-        double startTime = getTime();
-        for (int counter = 0; counter < 1000; counter++)
-            convert_yuv420_888_to_yuv420p(Y, U, V, WIDTH, WIDTH, WIDTH, yuv_frame);
+    const ImageKernels* kernels[4];
+    int kernelsCount = get_available_image_kernels(kernels, 4);
+
+    double scalarElapsed = 0.0;
+
+    for (int k = 0; k < kernelsCount; k++) {
+
+        double bestElapsed = 0.0;
+
+        for (int times = 0; times < 10; times++) {
+            double startTime = getTime();
+            for (int counter = 0; counter < 1000; counter++)
+                convert_yuv420_888_to_yuv420p_with_kernels(Y, UV, UV + 1, WIDTH, WIDTH, WIDTH, 2,
+                                                           yuv_frame, kernels[k]);
 
-        double elapsed = getTime() - startTime;
+            double elapsed = getTime() - startTime;
 
-        print_log(ANDROID_LOG_INFO, BENCHMARK_TAG, "%f", elapsed);
+            if (times == 0 || elapsed < bestElapsed)
+                bestElapsed = elapsed;
+        }
+
+        if (k == 0)
+            scalarElapsed = bestElapsed;
+
+        print_log(ANDROID_LOG_INFO, BENCHMARK_TAG, "%s: %f ms per frame (x%.2f vs scalar)",
+                  kernels[k]->name, bestElapsed, scalarElapsed / bestElapsed);
     }
 
     av_frame_free(&yuv_frame);
 
-    free(V);
-    free(U);
+    free(UV);
     free(Y);
 }
 
-#pragma clang optimize on
\ No newline at end of file
+void benchmark_box_blur_gray(void) {
+
+    // detector input size, sigma of 21x21 gaussian
+    const int width = 320, height = 140;
+    const double sigma = 3.5;
+
+    uint8_t* source = malloc(width * height);
+    uint8_t* reference = malloc(width * height);
+    uint8_t* image = malloc(width * height);
+    uint8_t* scratch = malloc((size_t) box_blur_scratch_size(width, height));
+
+    for (int i = 0; i < width * height; i++)
+        source[i] = (uint8_t) ((i % width) ^ (i / width) ^ (i * 31));
+
+    const ImageKernels* kernels[4];
+    int kernelsCount = get_available_image_kernels(kernels, 4);
+
+    double scalarElapsed = 0.0;
+
+    for (int k = 0; k < kernelsCount; k++) {
+
+        memcpy(image, source, (size_t) (width * height));
+        box_blur_gray_with_kernels(image, width, width, height, sigma, scratch, kernels[k]);
+
+        // all implementations have to give exactly the same output
+        if (k == 0)
+            memcpy(reference, image, (size_t) (width * height));
+        else if (memcmp(reference, image, (size_t) (width * height)) != 0)
+            print_log(ANDROID_LOG_ERROR, BENCHMARK_TAG, "%s: box blur differs from scalar", kernels[k]->name);
+
+        double bestElapsed = 0.0;
+
+        for (int times = 0; times < 10; times++) {
+            double startTime = getTime();
+            for (int counter = 0; counter < 100; counter++)
+                box_blur_gray_with_kernels(image, width, width, height, sigma, scratch, kernels[k]);
+
+            double elapsed = (getTime() - startTime) / 100;
+
+            if (times == 0 || elapsed < bestElapsed)
+                bestElapsed = elapsed;
+        }
+
+        if (k == 0)
+            scalarElapsed = bestElapsed;
+
+        print_log(ANDROID_LOG_INFO, BENCHMARK_TAG, "box blur %s: %f ms per frame (x%.2f vs scalar)",
+                  kernels[k]->name, bestElapsed * 1000.0, scalarElapsed / bestElapsed);
+    }
+
+    free(scratch);
+    free(image);
+    free(reference);
+    free(source);
+}
+
+void benchmark_dense_flow(void) {
+
+    // detector input size, blurred texture with a blob moved by 1.5 pixels
+    const int width = 320, height = 140, radius = 6;
+
+    uint8_t* image = malloc(width * height);
+    uint8_t* nextImage = malloc(width * height);
+    int16_t* dx = malloc(width * height * sizeof(int16_t));
+    int16_t* dy = malloc(width * height * sizeof(int16_t));
+    int16_t* referenceDx = malloc(width * height * sizeof(int16_t));
+    int16_t* referenceDy = malloc(width * height * sizeof(int16_t));
+    uint8_t* mask = malloc(width * height);
+    uint8_t* referenceMask = malloc(width * height);
+    uint8_t* scratch = malloc((size_t) dense_flow_scratch_size(width, radius));
+
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+
+            double background = 120.0 + 40.0 * sin(x * 0.11) * cos(y * 0.07);
+            double blob = 80.0 * exp(-((x - 160.0) * (x - 160.0) + (y - 70.0) * (y - 70.0)) / 200.0);
+            double movedBlob = 80.0 * exp(-((x - 161.5) * (x - 161.5) + (y - 70.0) * (y - 70.0)) / 200.0);
+
+            image[y * width + x] = (uint8_t) (background + blob);
+            nextImage[y * width + x] = (uint8_t) (background + movedBlob);
+        }
+    }
+
+    const ImageKernels* kernels[4];
+    int kernelsCount = get_available_image_kernels(kernels, 4);
+
+    double scalarElapsed = 0.0;
+
+    for (int k = 0; k < kernelsCount; k++) {
+
+        dense_flow_mask_with_kernels(image, width, nextImage, width, width, height, radius, 0.1,
+                                     dx, dy, width, mask, width, scratch, kernels[k]);
+
+        if (k == 0) {
+            memcpy(referenceDx, dx, width * height * sizeof(int16_t));
+            memcpy(referenceDy, dy, width * height * sizeof(int16_t));
+            memcpy(referenceMask, mask, (size_t) (width * height));
+        } else {
+
+            // ARMv7 NEON rounds a bit differently, flow may be one unit (1/256 pixel) off
+            int maxDifference = 0, maskDifferences = 0;
+
+            for (int i = 0; i < width * height; i++) {
+
+                int differenceX = abs(dx[i] - referenceDx[i]);
+                int differenceY = abs(dy[i] - referenceDy[i]);
+
+                maxDifference = differenceX > maxDifference ? differenceX : maxDifference;
+                maxDifference = differenceY > maxDifference ? differenceY : maxDifference;
+
+                if (mask[i] != referenceMask[i])
+                    maskDifferences++;
+            }
+
+            if (maxDifference > 1)
+                print_log(ANDROID_LOG_ERROR, BENCHMARK_TAG,
+                          "%s: dense flow differs from scalar by %d/256 px (%d mask pixels)",
+                          kernels[k]->name, maxDifference, maskDifferences);
+        }
+
+        double bestElapsed = 0.0;
+
+        for (int times = 0; times < 10; times++) {
+            double startTime = getTime();
+            for (int counter = 0; counter < 100; counter++)
+                dense_flow_mask_with_kernels(image, width, nextImage, width, width, height, radius, 0.1,
+                                             dx, dy, width, mask, width, scratch, kernels[k]);
+
+            double elapsed = (getTime() - startTime) / 100;
+
+            if (times == 0 || elapsed < bestElapsed)
+                bestElapsed = elapsed;
+        }
+
+        if (k == 0)
+            scalarElapsed = bestElapsed;
+
+        print_log(ANDROID_LOG_INFO, BENCHMARK_TAG, "dense flow %s: %f ms per frame (x%.2f vs scalar)",
+                  kernels[k]->name, bestElapsed * 1000.0, scalarElapsed / bestElapsed);
+    }
+
+    free(scratch);
+    free(referenceMask);
+    free(mask);
+    free(referenceDy);
+    free(referenceDx);
+    free(dy);
+    free(dx);
+    free(nextImage);
+    free(image);
+}
+
+void benchmark_find_motion_blobs(void) {
+
+    // detector input size, flow with speckles of noise and a moving blob in the middle
+    const int width = 320, height = 140;
+
+    float* flow = malloc(width * height * 2 * sizeof(float));
+    uint8_t* mask = malloc(width * height);
+    uint8_t* referenceMask = malloc(width * height);
+    uint8_t* scratch = malloc((size_t) find_motion_blobs_scratch_size(width, height));
+
+    unsigned int seed = 1;
+
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+
+            seed = seed * 1103515245 + 12345;
+
+            int insideBlob = (x - 160) * (x - 160) + (y - 70) * (y - 70) < 30 * 30;
+            float noise = ((seed >> 16) & 0xff) > 240 ? 0.2f : 0.0f;
+
+            flow[(y * width + x) * 2] = insideBlob ? 1.5f : noise;
+            flow[(y * width + x) * 2 + 1] = insideBlob ? 0.5f : -noise;
+        }
+    }
+
+    const ImageKernels* kernels[4];
+    int kernelsCount = get_available_image_kernels(kernels, 4);
+
+    double scalarElapsed = 0.0;
+
+    for (int k = 0; k < kernelsCount; k++) {
+
+        for (int y = 0; y < height; y++)
+            kernels[k]->flow_length_mask_row(flow + y * width * 2, mask + y * width, width, 0.01f);
+
+        if (k == 0)
+            memcpy(referenceMask, mask, (size_t) (width * height));
+        else if (memcmp(mask, referenceMask, (size_t) (width * height)) != 0)
+            print_log(ANDROID_LOG_ERROR, BENCHMARK_TAG, "%s: flow length mask differs from scalar",
+                      kernels[k]->name);
+
+        double bestElapsed = 0.0;
+        int found = 0;
+
+        for (int times = 0; times < 10; times++) {
+            double startTime = getTime();
+            for (int counter = 0; counter < 100; counter++) {
+
+                for (int y = 0; y < height; y++)
+                    kernels[k]->flow_length_mask_row(flow + y * width * 2, mask + y * width, width, 0.01f);
+
+                // whole blob has to be labelled, area threshold is never reached
+                found = find_motion_blobs(mask, width, width, height, width * height + 1, NULL, 0, NULL, scratch);
+            }
+
+            double elapsed = (getTime() - startTime) / 100;
+
+            if (times == 0 || elapsed < bestElapsed)
+                bestElapsed = elapsed;
+        }
+
+        if (k == 0)
+            scalarElapsed = bestElapsed;
+
+        print_log(ANDROID_LOG_INFO, BENCHMARK_TAG, "flow mask and blobs %s: %f ms per frame (x%.2f vs scalar)%s",
+                  kernels[k]->name, bestElapsed * 1000.0, scalarElapsed / bestElapsed, found ? " (unexpected)" : "");
+    }
+
+    free(scratch);
+    free(referenceMask);
+    free(mask);
+    free(flow);
+}
+
+void benchmark_quantized_conv3x3(void) {
+
+    // second layer of the person classifier: 15x31 input with 8 channels, 16 output channels
+    const int width = 15, height = 31, channels = 8, outChannels = 16, stride = 2;
+
+    int outSize = quantized_conv3x3_output_size(width, stride) * quantized_conv3x3_output_size(height, stride) *
+                  outChannels;
+
+    uint8_t* src = malloc(width * height * channels);
+    int8_t* weights = malloc(outChannels * 9 * channels);
+    int32_t* bias = malloc(outChannels * sizeof(int32_t));
+    float* scale = malloc(outChannels * sizeof(float));
+    uint8_t* dst = malloc((size_t) outSize);
+    uint8_t* reference = malloc((size_t) outSize);
+
+    unsigned int seed = 1;
+
+    for (int i = 0; i < width * height * channels; i++) {
+        seed = seed * 1103515245 + 12345;
+        src[i] = (uint8_t) (seed >> 16);
+    }
+
+    for (int i = 0; i < outChannels * 9 * channels; i++) {
+        seed = seed * 1103515245 + 12345;
+        weights[i] = (int8_t) (seed >> 16);
+    }
+
+    for (int o = 0; o < outChannels; o++) {
+        bias[o] = (o - outChannels / 2) * 1000;
+        scale[o] = 1.0f / 256.0f;
+    }
+
+    const ImageKernels* kernels[4];
+    int kernelsCount = get_available_image_kernels(kernels, 4);
+
+    double scalarElapsed = 0.0;
+
+    for (int k = 0; k < kernelsCount; k++) {
+
+        quantized_conv3x3_with_kernels(src, width, height, channels, stride, weights, bias, scale, outChannels, dst,
+                                       kernels[k]);
+
+        // integer sums, so all implementations have to agree exactly
+        if (k == 0)
+            memcpy(reference, dst, (size_t) outSize);
+        else if (memcmp(reference, dst, (size_t) outSize) != 0)
+            print_log(ANDROID_LOG_ERROR, BENCHMARK_TAG, "%s: quantized convolution differs from scalar",
+                      kernels[k]->name);
+
+        double bestElapsed = 0.0;
+
+        for (int times = 0; times < 10; times++) {
+            double startTime = getTime();
+            for (int counter = 0; counter < 100; counter++)
+                quantized_conv3x3_with_kernels(src, width, height, channels, stride, weights, bias, scale,
+                                               outChannels, dst, kernels[k]);
+
+            double elapsed = (getTime() - startTime) / 100;
+
+            if (times == 0 || elapsed < bestElapsed)
+                bestElapsed = elapsed;
+        }
+
+        if (k == 0)
+            scalarElapsed = bestElapsed;
+
+        print_log(ANDROID_LOG_INFO, BENCHMARK_TAG, "quantized convolution %s: %f ms per layer (x%.2f vs scalar)",
+                  kernels[k]->name, bestElapsed * 1000.0, scalarElapsed / bestElapsed);
+    }
+
+    free(reference);
+    free(dst);
+    free(scale);
+    free(bias);
+    free(weights);
+    free(src);
+}
+
+#pragma clang optimize on
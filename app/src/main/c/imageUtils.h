@@ -10,8 +10,72 @@ int dumpBMP8(uint8_t* pixels, int width, int height, const char* filePath);
 int dumpYUV420(AVFrame *yuv_frame, const char* filePath);
 
 void convert_yuv420_888_to_yuv420p(uint8_t* dataY, uint8_t* dataU, uint8_t* dataV, int strideY,
-                                   int strideU, int strideV, AVFrame *dst);
+                                   int strideU, int strideV, int pixelStrideUV, AVFrame *dst);
+
+// true if U and V planes are interleaved UVUV... in a single buffer, i.e. can be used as NV12 as is
+int is_yuv420_888_nv12(uint8_t* dataU, uint8_t* dataV, int strideU, int strideV, int pixelStrideUV);
+
+void convert_yuv420_888_to_nv12(uint8_t* dataY, uint8_t* dataUV, int strideY, int strideUV, AVFrame *dst);
+
+// detector preprocessing in a single pass over the source: 2x2 area downscale of a gray plane
+// to dstWidth x dstHeight with contrast scaled by 0.75, returns sum of the result pixels
+uint64_t downscale_gray_with_contrast(const uint8_t* src, int srcStride, uint8_t* dst, int dstStride,
+                                      int dstWidth, int dstHeight);
+
+// sigmas box blur approximates, boxes stop growing above the maximum
+#define BOX_BLUR_MIN_SIGMA 0.5
+#define BOX_BLUR_MAX_SIGMA 60.0
+
+// approximation of gaussian blur by three stacked box filters, cost per pixel doesn't depend on sigma,
+// blurs gray image in place with replicated borders, scratch must hold box_blur_scratch_size bytes
+void box_blur_gray(uint8_t* data, int stride, int width, int height, double sigma, uint8_t* scratch);
+int box_blur_scratch_size(int width, int height);
+// distance in pixels that blur can carry a value to
+int box_blur_support(double sigma);
+
+// single scale dense Lucas-Kanade flow from img to nextImg on 16 bit gradients, window is (2 * radius + 1)^2
+// (radius up to 31) and brightness offset between the frames is ignored like in Farneback,
+// dx and dy planes receive flow in 1/256 pixels (strides in elements), mask marks pixels (255) whose flow
+// is at least minLength long, scratch must hold dense_flow_scratch_size bytes
+void dense_flow_mask(const uint8_t* img, int imgStride, const uint8_t* nextImg, int nextStride, int width, int height,
+                     int radius, double minLength, int16_t* dx, int16_t* dy, int flowStride,
+                     uint8_t* mask, int maskStride, uint8_t* scratch);
+int dense_flow_scratch_size(int width, int radius);
+
+// marks (255) pixels of a float x, y flow field (strides in floats) whose flow is at least minLength long
+void flow_length_mask(const float* flow, int flowStride, uint8_t* mask, int maskStride, int width, int height,
+                      double minLength);
+
+typedef struct MotionBlob {
+    int x, y, width, height;    // bounding box
+    int area;                   // pixels
+} MotionBlob;
+
+// 8-connected components of non-zero mask pixels labelled in a single pass over row runs, stops as soon as
+// a component reaches minArea pixels and returns 1 then, 0 if there is none; with blobsCount labelling goes on
+// until that component is complete and up to maxBlobs components seen so far are written to blobs
+// (the complete one first), their number to blobsCount; scratch must hold find_motion_blobs_scratch_size bytes
+int find_motion_blobs(const uint8_t* mask, int stride, int width, int height, int minArea,
+                      MotionBlob* blobs, int maxBlobs, int* blobsCount, uint8_t* scratch);
+int find_motion_blobs_scratch_size(int width, int height);
+
+// int8 quantized layers of the person classifier, activations are unsigned 8 bit values laid out as
+// height x width x channels, weights signed 8 bit; 3x3 convolution without padding writes
+// clamp(round((bias[o] + sum of products) * scale[o]), 0, 255) for every output channel o, which is
+// a ReLU too, weights are laid out as outChannels x 3 x 3 x channels
+void quantized_conv3x3(const uint8_t* src, int width, int height, int channels, int stride,
+                       const int8_t* weights, const int32_t* bias, const float* scale, int outChannels,
+                       uint8_t* dst);
+// output width or height of the convolution for input width or height
+int quantized_conv3x3_output_size(int size, int stride);
+// fully connected layer writes raw sums with bias, weights are laid out as outputs x length
+void quantized_dense(const uint8_t* src, int length, const int8_t* weights, const int32_t* bias, int outputs,
+                     int32_t* dst);
 
 void benchmark_convert_yuv420_888_to_yuv420p(void);
+void benchmark_box_blur_gray(void);
+void benchmark_dense_flow(void);
+void benchmark_find_motion_blobs(void);
+void benchmark_quantized_conv3x3(void);
 
 #endif //PEOPLEWATCHER_IMAGEUTILS_H
@@ -1,8 +1,48 @@
 #ifndef PEOPLEWATCHER_LOG_H
 #define PEOPLEWATCHER_LOG_H
 
+#ifdef __ANDROID__
+
 #include <android/log.h>
 
 #define print_log(level, tag, ...) __android_log_print(level, tag, __VA_ARGS__);
+#define vprint_log(level, tag, fmt, args) __android_log_vprint(level, tag, fmt, args);
+
+#else
+
+// host builds (replay tool) write log to stderr
+
+#include <stdarg.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum android_LogPriority {
+    ANDROID_LOG_UNKNOWN = 0,
+    ANDROID_LOG_DEFAULT,
+    ANDROID_LOG_VERBOSE,
+    ANDROID_LOG_DEBUG,
+    ANDROID_LOG_INFO,
+    ANDROID_LOG_WARN,
+    ANDROID_LOG_ERROR,
+    ANDROID_LOG_FATAL,
+    ANDROID_LOG_SILENT
+} android_LogPriority;
+
+// messages below this priority are discarded
+extern int host_log_priority;
+
+int host_log_print(int priority, const char *tag, const char *fmt, ...);
+int host_log_vprint(int priority, const char *tag, const char *fmt, va_list args);
+
+#ifdef __cplusplus
+}
+#endif
+
+#define print_log(level, tag, ...) host_log_print(level, tag, __VA_ARGS__);
+#define vprint_log(level, tag, fmt, args) host_log_vprint(level, tag, fmt, args);
+
+#endif
 
 #endif //PEOPLEWATCHER_LOG_H
@@ -2,28 +2,39 @@
 
 #include "log.h"
 #include "exceptionUtils.h"
+#include "EngineStats.h"
 
+extern "C" {
+#include "generalUtils.h"
+}
+
+#include <cstdio>
 #include <cstring>
+#include <stdexcept>
 
 #define ASYNC_IO_TAG "PW_ASYNC_IO"
 
 #define IO_BUFFERS_COUNT (0x100000 / IO_BUFFER_SIZE)
 
 AsyncIO::AsyncIO(void) :
+    initialized(0),
+    placement(NULL),
     pendingOperations(IO_BUFFERS_COUNT * 2),
     freeBuffers(IO_BUFFERS_COUNT) {
 }
 
-void AsyncIO::initialize(void) {
+void AsyncIO::initialize(const ThreadPlacement *placement) {
 
     if (this->initialized)
         return;
 
+    this->placement = placement;
+
     pthread_check_error(pthread_mutex_init(&mutex, NULL));
     pthread_check_error(pthread_cond_init(&cond, NULL));
 
     pthread_check_error(pthread_mutex_lock(&mutex));
-    pthread_check_error(pthread_create(&thread, NULL, thread_entrypoint, NULL));
+    pthread_check_error(pthread_create(&thread, NULL, thread_entrypoint, this));
     pthread_check_error(pthread_cond_wait(&cond, &mutex));
     pthread_check_error(pthread_mutex_unlock(&mutex));
 
@@ -44,12 +55,15 @@ void AsyncIO::allocateBuffers(void) {
 
 void* AsyncIO::thread_entrypoint(void* opaque) {
 
-    AsyncIO::getInstance().threadLoop();
+    ((AsyncIO*) opaque)->threadLoop();
     return NULL;
 }
 
 void AsyncIO::threadLoop(void) {
 
+    if (placement != NULL)
+        placement->placeCurrentThread(RoleIO);
+
     pthread_check_error(pthread_mutex_lock(&mutex));
     allocateBuffers();
     pthread_check_error(pthread_cond_signal(&cond));
@@ -63,12 +77,16 @@ void AsyncIO::threadLoop(void) {
 
         if (operation.operationType == Write) {
 
+            double startTime = getTime();
+
             size_t ret = fwrite(operation.buffer, 1, operation.size, operation.file);
             if (ret != operation.size)
                 throw new std::runtime_error("Async IO write failed");
 
             fflush(operation.file);
 
+            EngineStats::getInstance().addLatency(StageWrite, getTime() - startTime);
+
             print_log(ANDROID_LOG_DEBUG, ASYNC_IO_TAG, "written: %d", ret);
 
             this->freeBuffers.enqueue(operation.buffer);
@@ -132,4 +150,10 @@ void AsyncIO::terminate(void) {
     pendingOperations.enqueue(operation);
 
     pthread_check_error(pthread_join(thread, NULL));
+
+    void* buffer;
+    while (freeBuffers.try_dequeue(buffer))
+        free(buffer);
+
+    this->initialized = 0;
 }
\ No newline at end of file
@@ -3,22 +3,20 @@
 
 #include <pthread.h>
 
-#include "readerwriterqueue.h"
+#include "blockingconcurrentqueue.h"
+
+#include "ThreadPlacement.h"
 
 using namespace moodycamel;
 
+// single IO thread shared by encoders of all streams
 class AsyncIO {
 public:
-    static AsyncIO &getInstance() {
-        static AsyncIO instance;
+    AsyncIO(void);
 
-        return instance;
-    }
-    
     AsyncIO(AsyncIO const&) = delete;
     void operator=(AsyncIO const&)  = delete;
 private:
-    AsyncIO(void);
 
     enum AsyncIOOperationType {
         Write,
@@ -35,8 +33,12 @@ private:
 
     int initialized;
 
-    BlockingReaderWriterQueue<AsyncIOOperation> pendingOperations;
-    BlockingReaderWriterQueue<void*> freeBuffers;
+    const ThreadPlacement *placement;
+
+    // several encoder threads write and take buffers, so queues have to be multi producer/consumer,
+    // writes of one encoder still stay in order since they come from the same thread
+    BlockingConcurrentQueue<AsyncIOOperation> pendingOperations;
+    BlockingConcurrentQueue<void*> freeBuffers;
 
     pthread_mutex_t mutex;
     pthread_cond_t cond;
@@ -49,7 +51,8 @@ private:
 public:
     static const int IO_BUFFER_SIZE = 0x8000;
 
-    void initialize(void);
+    // placement may be NULL
+    void initialize(const ThreadPlacement *placement);
 
     void write(FILE *f, void* buffer, size_t size);
     void closeFile(FILE **f);
@@ -0,0 +1,68 @@
+#include "BackgroundDetectorEngine.h"
+
+#include <stdexcept>
+
+#include <opencv2/imgproc.hpp>
+#include <opencv2/bgsegm.hpp>
+
+#include "exceptionUtils.h"
+
+BackgroundDetectorEngine::BackgroundDetectorEngine(DetectorEngineType type, const Mat &zoneMask) :
+    DetectorEngine(zoneMask), type(type), framesApplied(0) {
+
+    if (type == DetectorMOG2)
+        subtractor = createBackgroundSubtractorMOG2(500, 16.0, true);
+    else if (type == DetectorCNT)
+        subtractor = bgsegm::createBackgroundSubtractorCNT();
+    else
+        throw new std::runtime_error("Not a background subtraction engine");
+
+    pthread_check_error(pthread_mutex_init(&mutex, NULL));
+}
+
+BackgroundDetectorEngine::~BackgroundDetectorEngine(void) {
+
+    pthread_check_error(pthread_mutex_destroy(&mutex));
+}
+
+bool BackgroundDetectorEngine::detectMotion(const DetectionInput &input, Rect *motionBlob) {
+
+    Mat img = wrapGrayFrame(input.frame->gray);
+    Mat foreground, mask;
+
+    // every frame gets exactly one input, so model sees each frame once, pool threads
+    // may swap neighbouring frames, which doesn't matter for a model with long history
+    pthread_check_error(pthread_mutex_lock(&mutex));
+
+    subtractor->apply(img, foreground);
+    bool warmingUp = ++framesApplied <= WARMUP_FRAMES;
+
+    pthread_check_error(pthread_mutex_unlock(&mutex));
+
+    if (warmingUp)
+        return false;
+
+    threshold(foreground, mask, FOREGROUND_THRESHOLD, 255, THRESH_BINARY);
+
+    // single pixel noise would otherwise glue blobs together
+    morphologyEx(mask, mask, MORPH_OPEN, getStructuringElement(MORPH_RECT, Size(3, 3)));
+
+    // model learns excluded areas too, they just never count as motion
+    if (!zoneMask.empty())
+        bitwise_and(mask, zoneMask, mask);
+
+    std::vector<Rect> blobs;
+
+    bool haveMotion = haveMotionBlob(mask, &blobs);
+
+    // blob that reached the motion area is reported first
+    if (haveMotion)
+        *motionBlob = blobs[0];
+
+    return haveMotion;
+}
+
+void BackgroundDetectorEngine::reset(void) {
+
+    // camera doesn't move between records, so the model stays valid and isn't relearned
+}
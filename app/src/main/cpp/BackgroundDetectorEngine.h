@@ -0,0 +1,37 @@
+#ifndef PEOPLEWATCHER_BACKGROUNDDETECTORENGINE_H
+#define PEOPLEWATCHER_BACKGROUNDDETECTORENGINE_H
+
+#include <pthread.h>
+
+#include <opencv2/video.hpp>
+
+#include "DetectorEngine.h"
+
+// Background subtraction, model of the stream is updated with one frame per detection.
+// Detections of the stream are serialized on the model, other streams aren't affected.
+class BackgroundDetectorEngine : public DetectorEngine {
+public:
+    BackgroundDetectorEngine(DetectorEngineType type, const Mat &zoneMask);
+    ~BackgroundDetectorEngine(void);
+
+    BackgroundDetectorEngine(BackgroundDetectorEngine const&) = delete;
+    void operator=(BackgroundDetectorEngine const&)  = delete;
+private:
+    // model marks almost everything as foreground until it has seen some frames
+    static const int WARMUP_FRAMES = 20;
+    // MOG2 marks shadows with 127, they are not motion
+    static const int FOREGROUND_THRESHOLD = 200;
+
+    DetectorEngineType type;
+
+    pthread_mutex_t mutex;
+    Ptr<BackgroundSubtractor> subtractor;
+    long long framesApplied;
+public:
+    const char* getName(void) { return getTypeName(type); }
+
+    bool detectMotion(const DetectionInput &input, Rect *motionBlob);
+    void reset(void);
+};
+
+#endif //PEOPLEWATCHER_BACKGROUNDDETECTORENGINE_H
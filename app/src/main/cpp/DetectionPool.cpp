@@ -0,0 +1,376 @@
+#include "DetectionPool.h"
+
+#include <cstdint>
+#include <stdexcept>
+
+#include <sched.h>
+
+#include "exceptionUtils.h"
+#include "EngineStats.h"
+
+extern "C" {
+#include "generalUtils.h"
+}
+
+static_assert(DetectionPool::MAX_THREADS <= EngineStats::MAX_WORKERS, "worker stats don't cover all workers");
+
+PoolTaskGroup::PoolTaskGroup(void) : pending(0) {
+
+    pthread_check_error(pthread_mutex_init(&mutex, NULL));
+    pthread_check_error(pthread_cond_init(&cond, NULL));
+}
+
+PoolTaskGroup::~PoolTaskGroup(void) {
+
+    pthread_check_error(pthread_cond_destroy(&cond));
+    pthread_check_error(pthread_mutex_destroy(&mutex));
+}
+
+void PoolTaskGroup::taskFinished(void) {
+
+    pthread_check_error(pthread_mutex_lock(&mutex));
+
+    if (--pending == 0)
+        pthread_check_error(pthread_cond_broadcast(&cond));
+
+    pthread_check_error(pthread_mutex_unlock(&mutex));
+}
+
+void PoolTaskGroup::waitForQuiescence(void) {
+
+    pthread_check_error(pthread_mutex_lock(&mutex));
+
+    while (pending > 0)
+        pthread_check_error(pthread_cond_wait(&cond, &mutex));
+
+    pthread_check_error(pthread_mutex_unlock(&mutex));
+}
+
+DetectionPool::DetectionPool(void) : initialized(0), workers(NULL), threadsCount(0), placement(NULL), nextWorker(0),
+                                     queuedTasks(0), activeTasks(0), activeThreads(0), stopping(false),
+                                     sleepingWorkers(0) {
+}
+
+DetectionPool::~DetectionPool(void) {
+
+    terminate();
+}
+
+void DetectionPool::initialize(int threadsCount, const ThreadPlacement *placement) {
+
+    if (this->initialized)
+        return;
+
+    if (threadsCount <= 0 || threadsCount > MAX_THREADS)
+        throw new std::runtime_error("Invalid number of pool threads");
+
+    pthread_check_error(pthread_mutex_init(&sleepMutex, NULL));
+    pthread_check_error(pthread_cond_init(&sleepCond, NULL));
+    pthread_check_error(pthread_cond_init(&parkCond, NULL));
+
+    pthread_check_error(pthread_mutex_init(&idleMutex, NULL));
+    pthread_check_error(pthread_cond_init(&idleCond, NULL));
+
+    this->threadsCount = threadsCount;
+    this->placement = placement;
+    this->activeThreads = threadsCount;
+    this->stopping = false;
+
+    workers = new Worker[threadsCount];
+
+    for (int i = 0; i < threadsCount; i++) {
+
+        Worker *worker = workers + i;
+
+        worker->pool = this;
+        worker->index = i;
+
+        worker->queue.enqueuePos = 0;
+        worker->queue.dequeuePos = 0;
+
+        for (int slot = 0; slot < QUEUE_SIZE; slot++)
+            worker->queue.slots[slot].sequence = (size_t) slot;
+    }
+
+    for (int i = 0; i < threadsCount; i++)
+        pthread_check_error(pthread_create(&workers[i].thread, NULL, thread_entrypoint, workers + i));
+
+    this->initialized = 1;
+}
+
+void DetectionPool::terminate(void) {
+
+    if (!this->initialized)
+        return;
+
+    waitForQuiescence();
+
+    pthread_check_error(pthread_mutex_lock(&sleepMutex));
+    stopping = true;
+    pthread_check_error(pthread_cond_broadcast(&sleepCond));
+    pthread_check_error(pthread_cond_broadcast(&parkCond));
+    pthread_check_error(pthread_mutex_unlock(&sleepMutex));
+
+    for (int i = 0; i < threadsCount; i++)
+        pthread_check_error(pthread_join(workers[i].thread, NULL));
+
+    delete[] workers;
+    workers = NULL;
+    threadsCount = 0;
+
+    pthread_check_error(pthread_cond_destroy(&idleCond));
+    pthread_check_error(pthread_mutex_destroy(&idleMutex));
+
+    pthread_check_error(pthread_cond_destroy(&parkCond));
+    pthread_check_error(pthread_cond_destroy(&sleepCond));
+    pthread_check_error(pthread_mutex_destroy(&sleepMutex));
+
+    this->initialized = 0;
+}
+
+bool DetectionPool::enqueueTask(TaskQueue *queue, const PoolTask &task) {
+
+    TaskSlot *slot;
+    size_t pos = queue->enqueuePos.load(std::memory_order_relaxed);
+
+    while (true) {
+
+        slot = queue->slots + (pos & (QUEUE_SIZE - 1));
+
+        size_t sequence = slot->sequence.load(std::memory_order_acquire);
+        intptr_t difference = (intptr_t) sequence - (intptr_t) pos;
+
+        if (difference == 0) {
+            if (queue->enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                break;
+        } else if (difference < 0)
+            return false;   // full
+        else
+            pos = queue->enqueuePos.load(std::memory_order_relaxed);
+    }
+
+    slot->task = task;
+    slot->sequence.store(pos + 1, std::memory_order_release);
+
+    return true;
+}
+
+bool DetectionPool::dequeueTask(TaskQueue *queue, PoolTask *task) {
+
+    TaskSlot *slot;
+    size_t pos = queue->dequeuePos.load(std::memory_order_relaxed);
+
+    while (true) {
+
+        slot = queue->slots + (pos & (QUEUE_SIZE - 1));
+
+        size_t sequence = slot->sequence.load(std::memory_order_acquire);
+        intptr_t difference = (intptr_t) sequence - (intptr_t) (pos + 1);
+
+        if (difference == 0) {
+            if (queue->dequeuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                break;
+        } else if (difference < 0)
+            return false;   // empty
+        else
+            pos = queue->dequeuePos.load(std::memory_order_relaxed);
+    }
+
+    *task = slot->task;
+    slot->sequence.store(pos + QUEUE_SIZE, std::memory_order_release);
+
+    return true;
+}
+
+bool DetectionPool::submit(PoolTaskGroup *group, PoolTaskFunction function, void *arg) {
+
+    if (!this->initialized)
+        return false;
+
+    PoolTask task = { };
+    task.function = function;
+    task.arg = arg;
+    task.group = group;
+
+    // counted before the task becomes visible, so no counter can go below zero
+    if (group != NULL)
+        group->pending++;
+    activeTasks++;
+    queuedTasks++;
+
+    int active = activeThreads;
+    int first = (nextWorker++ & 0x7fffffff) % active;
+    bool queued = false;
+
+    // next active worker in turn, or any other one when its queue is full
+    for (int i = 0; i < threadsCount && !queued; i++)
+        queued = enqueueTask(&workers[i < active ? (first + i) % active : i].queue, task);
+
+    if (!queued) {
+
+        queuedTasks--;
+
+        if (group != NULL)
+            group->taskFinished();
+
+        if (--activeTasks == 0) {
+            pthread_check_error(pthread_mutex_lock(&idleMutex));
+            pthread_check_error(pthread_cond_broadcast(&idleCond));
+            pthread_check_error(pthread_mutex_unlock(&idleMutex));
+        }
+
+        return false;
+    }
+
+    // one awake worker is enough, it takes the task from whichever queue it landed in
+    if (sleepingWorkers > 0) {
+        pthread_check_error(pthread_mutex_lock(&sleepMutex));
+        pthread_check_error(pthread_cond_signal(&sleepCond));
+        pthread_check_error(pthread_mutex_unlock(&sleepMutex));
+    }
+
+    return true;
+}
+
+// own queue first, then steal from the others starting with the next one
+bool DetectionPool::takeTask(int workerIndex, PoolTask *task, bool *stolen) {
+
+    for (int i = 0; i < threadsCount; i++) {
+
+        if (dequeueTask(&workers[(workerIndex + i) % threadsCount].queue, task)) {
+
+            queuedTasks--;
+            *stolen = i != 0;
+
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void DetectionPool::waitForTask(void) {
+
+    for (int round = 0; round < SPIN_ROUNDS; round++) {
+
+        if (queuedTasks > 0 || stopping)
+            return;
+
+        sched_yield();
+    }
+
+    pthread_check_error(pthread_mutex_lock(&sleepMutex));
+
+    // submit counts the task before it looks at sleepingWorkers, so one of us sees the other
+    sleepingWorkers++;
+
+    while (queuedTasks == 0 && !stopping)
+        pthread_check_error(pthread_cond_wait(&sleepCond, &sleepMutex));
+
+    sleepingWorkers--;
+
+    pthread_check_error(pthread_mutex_unlock(&sleepMutex));
+}
+
+void DetectionPool::park(Worker *worker) {
+
+    pthread_check_error(pthread_mutex_lock(&sleepMutex));
+
+    while (worker->index >= activeThreads && !stopping)
+        pthread_check_error(pthread_cond_wait(&parkCond, &sleepMutex));
+
+    pthread_check_error(pthread_mutex_unlock(&sleepMutex));
+}
+
+void DetectionPool::setActiveThreads(int count) {
+
+    if (!this->initialized)
+        return;
+
+    if (count < 1)
+        count = 1;
+    if (count > threadsCount)
+        count = threadsCount;
+
+    pthread_check_error(pthread_mutex_lock(&sleepMutex));
+    activeThreads = count;
+    pthread_check_error(pthread_cond_broadcast(&parkCond));
+    pthread_check_error(pthread_mutex_unlock(&sleepMutex));
+}
+
+void DetectionPool::taskFinished(PoolTask *task) {
+
+    if (task->group != NULL)
+        task->group->taskFinished();
+
+    if (--activeTasks == 0) {
+        pthread_check_error(pthread_mutex_lock(&idleMutex));
+        pthread_check_error(pthread_cond_broadcast(&idleCond));
+        pthread_check_error(pthread_mutex_unlock(&idleMutex));
+    }
+}
+
+void DetectionPool::waitForQuiescence(void) {
+
+    pthread_check_error(pthread_mutex_lock(&idleMutex));
+
+    while (activeTasks > 0)
+        pthread_check_error(pthread_cond_wait(&idleCond, &idleMutex));
+
+    pthread_check_error(pthread_mutex_unlock(&idleMutex));
+}
+
+void* DetectionPool::thread_entrypoint(void* opaque) {
+
+    Worker *worker = (Worker*) opaque;
+
+    worker->pool->workerLoop(worker);
+    return NULL;
+}
+
+void DetectionPool::workerLoop(Worker *worker) {
+
+    if (placement != NULL)
+        placement->placeCurrentThread(RoleDetection);
+
+    EngineStats &stats = EngineStats::getInstance();
+
+    double idleStartTime = getTime();
+
+    while (true) {
+
+        PoolTask task;
+        bool stolen;
+
+        // parked time isn't idle time, the worker isn't available then
+        if (worker->index >= activeThreads && !stopping) {
+
+            park(worker);
+
+            idleStartTime = getTime();
+            continue;
+        }
+
+        if (takeTask(worker->index, &task, &stolen)) {
+
+            double startTime = getTime();
+
+            task.function(task.arg);
+
+            double endTime = getTime();
+
+            stats.countWorkerTask(worker->index, endTime - startTime, startTime - idleStartTime, stolen);
+
+            idleStartTime = endTime;
+
+            taskFinished(&task);
+            continue;
+        }
+
+        // terminate waits for quiescence first, so nothing is left in queues
+        if (stopping)
+            break;
+
+        waitForTask();
+    }
+}
@@ -0,0 +1,136 @@
+#ifndef PEOPLEWATCHER_DETECTIONPOOL_H
+#define PEOPLEWATCHER_DETECTIONPOOL_H
+
+#include <atomic>
+
+#include <pthread.h>
+
+#include "ThreadPlacement.h"
+
+typedef void (*PoolTaskFunction)(void* arg);
+
+// tasks of one owner (stream), the owner can wait for its own tasks while the pool keeps serving others
+class PoolTaskGroup {
+public:
+    PoolTaskGroup(void);
+    ~PoolTaskGroup(void);
+
+    PoolTaskGroup(PoolTaskGroup const&) = delete;
+    void operator=(PoolTaskGroup const&)  = delete;
+private:
+    friend class DetectionPool;
+
+    // submitted and not finished yet, changed under mutex so a waiter can destroy the group right after
+    std::atomic_int pending;
+
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+
+    void taskFinished(void);
+public:
+    int getPending(void) { return pending; }
+
+    // blocks until every task of the group submitted so far has finished
+    void waitForQuiescence(void);
+};
+
+// Fixed set of workers, each with its own bounded queue of preallocated task slots.
+// Tasks are spread round robin, a worker with an empty queue steals from the others before it sleeps.
+// Queues are lock free, only sleeping and waking take a mutex, nothing is allocated per task.
+class DetectionPool {
+public:
+    DetectionPool(void);
+    ~DetectionPool(void);
+
+    DetectionPool(DetectionPool const&) = delete;
+    void operator=(DetectionPool const&)  = delete;
+
+    static const int MAX_THREADS = 16;
+private:
+    // per worker, power of two, all queues together hold every detection that can be scheduled
+    static const int QUEUE_SIZE = 64;
+    // rounds of looking for work (yielding in between) before a worker goes to sleep
+    static const int SPIN_ROUNDS = 16;
+
+    struct PoolTask {
+        PoolTaskFunction function;
+        void *arg;
+        PoolTaskGroup *group;
+    };
+
+    struct TaskSlot {
+        std::atomic<size_t> sequence;
+        PoolTask task;
+    };
+
+    // bounded multi producer multi consumer queue, slot sequence numbers tell whose turn it is,
+    // positions live on separate cache lines so producers and consumers don't share them
+    struct TaskQueue {
+        std::atomic<size_t> enqueuePos;
+        char enqueuePadding[64];
+        std::atomic<size_t> dequeuePos;
+        char dequeuePadding[64];
+        TaskSlot slots[QUEUE_SIZE];
+    };
+
+    struct Worker {
+        DetectionPool *pool;
+        int index;
+        pthread_t thread;
+        TaskQueue queue;
+    };
+
+    int initialized;
+
+    Worker *workers;
+    int threadsCount;
+
+    const ThreadPlacement *placement;
+
+    std::atomic_int nextWorker;
+    // tasks waiting in queues, and tasks either waiting or running
+    std::atomic_int queuedTasks, activeTasks;
+
+    // workers with index above the limit park, tasks left in their queues are stolen by the others
+    std::atomic_int activeThreads;
+
+    std::atomic_bool stopping;
+    std::atomic_int sleepingWorkers;
+
+    pthread_mutex_t sleepMutex;
+    pthread_cond_t sleepCond;
+    pthread_cond_t parkCond;
+
+    pthread_mutex_t idleMutex;
+    pthread_cond_t idleCond;
+
+    static bool enqueueTask(TaskQueue *queue, const PoolTask &task);
+    static bool dequeueTask(TaskQueue *queue, PoolTask *task);
+
+    bool takeTask(int workerIndex, PoolTask *task, bool *stolen);
+    void waitForTask(void);
+    void park(Worker *worker);
+    void taskFinished(PoolTask *task);
+
+    static void* thread_entrypoint(void* opaque);
+    void workerLoop(Worker *worker);
+public:
+    // workers run on cores of the detection role, placement may be NULL
+    void initialize(int threadsCount, const ThreadPlacement *placement);
+    // waits for all submitted tasks, then stops workers
+    void terminate(void);
+
+    // false if queues of all workers are full, group may be NULL
+    bool submit(PoolTaskGroup *group, PoolTaskFunction function, void *arg);
+
+    // blocks until no task of any group is waiting or running
+    void waitForQuiescence(void);
+
+    // how many workers take tasks, 1..threads count, parked workers wake up when the limit grows again
+    void setActiveThreads(int count);
+
+    int getThreadsCount(void) { return threadsCount; }
+    int getActiveThreads(void) { return activeThreads; }
+};
+
+#endif //PEOPLEWATCHER_DETECTIONPOOL_H
@@ -0,0 +1,171 @@
+#include "DetectorEngine.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+#include <opencv2/imgproc.hpp>
+
+#include "FlowDetectorEngine.h"
+#include "BackgroundDetectorEngine.h"
+
+extern "C" {
+#include "imageUtils.h"
+}
+
+DetectorEngine* DetectorEngine::create(const MotionDetectorConfig &config, int width, int height,
+                                       const Mat &zoneMask) {
+
+    switch (config.engine) {
+        case DetectorFarneback:
+        case DetectorDISUltrafast:
+        case DetectorDISFast:
+        case DetectorFixedFlow:
+            return new FlowDetectorEngine(config, width, height, zoneMask);
+        case DetectorMOG2:
+        case DetectorCNT:
+            return new BackgroundDetectorEngine(config.engine, zoneMask);
+        default:
+            throw new std::runtime_error("Unknown detector engine");
+    }
+}
+
+const char* DetectorEngine::getTypeName(DetectorEngineType type) {
+
+    switch (type) {
+        case DetectorFarneback:
+            return "farneback";
+        case DetectorMOG2:
+            return "mog2";
+        case DetectorCNT:
+            return "cnt";
+        case DetectorDISUltrafast:
+            return "dis-ultrafast";
+        case DetectorDISFast:
+            return "dis-fast";
+        case DetectorFixedFlow:
+            return "fixed-flow";
+        default:
+            return "unknown";
+    }
+}
+
+DetectorEngineType DetectorEngine::getTypeByName(const char *name) {
+
+    for (int type = 0; type < DetectorEngineTypesCount; type++) {
+
+        if (strcmp(name, getTypeName((DetectorEngineType) type)) == 0)
+            return (DetectorEngineType) type;
+    }
+
+    return DetectorEngineTypesCount;
+}
+
+Rect DetectorEngine::rasterizeZones(const std::vector<DetectionZone> &zones, int width, int height,
+                                    Mat *downscaledMask) {
+
+    bool haveIncludes = false;
+
+    for (const DetectionZone &zone : zones) {
+
+        if (zone.polygon.size() < 3)
+            throw new std::runtime_error("Detection zone needs at least 3 points");
+
+        haveIncludes |= !zone.exclude;
+    }
+
+    Mat mask(height, width, CV_8UC1, Scalar::all(haveIncludes ? 0 : 255));
+
+    // includes first, so exclusions cut out of them wherever they overlap
+    for (int pass = 0; pass < 2; pass++) {
+
+        for (const DetectionZone &zone : zones) {
+
+            if (zone.exclude == (pass == 1)) {
+
+                const Point *points = zone.polygon.data();
+                int pointsCount = (int) zone.polygon.size();
+
+                fillPoly(mask, &points, &pointsCount, 1, Scalar::all(zone.exclude ? 0 : 255));
+            }
+        }
+    }
+
+    int minX = width, minY = height, maxX = -1, maxY = -1;
+
+    for (int y = 0; y < height; y++) {
+
+        const uint8_t *row = mask.ptr<uint8_t>(y);
+
+        for (int x = 0; x < width; x++) {
+
+            if (row[x] != 0) {
+                minX = std::min(minX, x);
+                maxX = std::max(maxX, x);
+                minY = std::min(minY, y);
+                maxY = std::max(maxY, y);
+            }
+        }
+    }
+
+    downscaledMask->release();
+
+    if (maxX < 0)
+        return Rect();
+
+    // detector downscales 2x2 blocks
+    minX &= ~1;
+    minY &= ~1;
+    maxX = std::min(maxX | 1, (width & ~1) - 1);
+    maxY = std::min(maxY | 1, (height & ~1) - 1);
+
+    Rect box(minX, minY, maxX - minX + 1, maxY - minY + 1);
+
+    // downscaled pixel is looked at when any of its source pixels is
+    Mat downscaled(box.height / 2, box.width / 2, CV_8UC1);
+    bool everywhere = true;
+
+    for (int y = 0; y < downscaled.rows; y++) {
+
+        const uint8_t *row = mask.ptr<uint8_t>(box.y + y * 2) + box.x;
+        const uint8_t *nextRow = mask.ptr<uint8_t>(box.y + y * 2 + 1) + box.x;
+        uint8_t *dst = downscaled.ptr<uint8_t>(y);
+
+        for (int x = 0; x < downscaled.cols; x++) {
+
+            dst[x] = row[x * 2] | row[x * 2 + 1] | nextRow[x * 2] | nextRow[x * 2 + 1];
+            everywhere &= dst[x] != 0;
+        }
+    }
+
+    if (!everywhere)
+        *downscaledMask = downscaled;
+
+    return box;
+}
+
+static thread_local std::vector<uint8_t> tls_blob_scratch;
+
+bool DetectorEngine::haveMotionBlob(const Mat &mask, std::vector<Rect> *blobs) {
+
+    tls_blob_scratch.resize((size_t) find_motion_blobs_scratch_size(mask.cols, mask.rows));
+
+    MotionBlob found[MAX_REPORTED_BLOBS];
+    int foundCount = 0;
+
+    bool haveMotion = find_motion_blobs(mask.data, (int) mask.step, mask.cols, mask.rows, MIN_MOTION_AREA,
+                                        found, MAX_REPORTED_BLOBS, &foundCount, tls_blob_scratch.data()) != 0;
+
+    if (blobs != NULL) {
+
+        for (int i = 0; i < foundCount; i++)
+            blobs->push_back(Rect(found[i].x, found[i].y, found[i].width, found[i].height));
+    }
+
+    return haveMotion;
+}
+
+Mat DetectorEngine::wrapGrayFrame(const AVFrame *frame) {
+
+    return Mat(frame->height, frame->width, CV_8UC1, frame->data[0], (size_t) frame->linesize[0]);
+}
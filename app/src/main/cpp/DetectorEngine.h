@@ -0,0 +1,104 @@
+#ifndef PEOPLEWATCHER_DETECTORENGINE_H
+#define PEOPLEWATCHER_DETECTORENGINE_H
+
+#include <inttypes.h>
+
+#include <vector>
+
+#include "opencv2/core.hpp"
+
+extern "C" {
+#include "libavutil/frame.h"
+}
+
+using namespace cv;
+
+enum DetectorEngineType {
+    DetectorFarneback,      // dense optical flow between consecutive frames
+    DetectorMOG2,           // gaussian mixture background model
+    DetectorCNT,            // pixel stability counting background model from bgsegm, cheapest one
+    DetectorDISUltrafast,   // dense inverse search optical flow, ultrafast preset
+    DetectorDISFast,        // dense inverse search optical flow, fast preset
+    DetectorFixedFlow,      // own 16 bit fixed point Lucas-Kanade flow that writes motion mask directly
+    DetectorEngineTypesCount
+};
+
+// polygon in frame pixels, detection only looks inside include zones (whole frame if there are none)
+// and never inside exclude zones
+struct DetectionZone {
+    bool exclude;
+    std::vector<Point> polygon;
+};
+
+struct MotionDetectorConfig {
+    std::vector<DetectionZone> zones;
+    DetectorEngineType engine;
+    bool warmStartFlow;     // start flow from the previous pair's flow when frames are consecutive
+    bool verifyWarmStart;   // also run cold start for every warm region and count agreement (slow)
+    bool verifyFixedFlow;   // also run Farneback for every fixed point flow region and count agreement (slow)
+    double blurSigma;       // noise suppression before flow, 3.5 matches former 21x21 gaussian
+    int maxDetectionBatch;  // most frame pairs one pool task carries during bursts, 1 disables batching
+    bool adaptiveRate;      // detect sparsely while nothing moves and skip frames known motion already covers
+    bool trackMotion;       // flow engines: during an event look for motion around tracked blobs first
+    bool classifyPeople;    // record motion only when the person classifier sees a person, if engine has one
+    bool forwardAllFrames;  // frames without motion go to the callback too, with real timestamps (encoder pre-roll)
+
+    MotionDetectorConfig(void) : engine(DetectorFarneback), warmStartFlow(true),
+                                 verifyWarmStart(false), verifyFixedFlow(false), blurSigma(3.5),
+                                 maxDetectionBatch(4), adaptiveRate(true), trackMotion(true),
+                                 classifyPeople(true), forwardAllFrames(false) { }
+};
+
+// downscaled and contrast scaled detector input with statistics gathered while it was produced
+struct PreprocessedFrame {
+    AVFrame *gray;
+    uint64_t luminanceSum;
+};
+
+// one decision: is there motion in frame, nextFrame follows it in the stream
+struct DetectionInput {
+    const PreprocessedFrame *frame, *nextFrame;
+    long long sequenceNum;
+    bool followsPreviousInput;      // previous input ended with our frame and no frames were lost
+};
+
+// Decides whether a pair of preprocessed frames of one stream has motion. One instance per stream,
+// detectMotion is called from pool threads and may run concurrently for consecutive inputs.
+class DetectorEngine {
+public:
+    explicit DetectorEngine(const Mat &zoneMask) : zoneMask(zoneMask) { }
+    virtual ~DetectorEngine(void) { }
+
+    virtual const char* getName(void) = 0;
+
+    // box of the blob that decided goes to motionBlob, in input pixels
+    virtual bool detectMotion(const DetectionInput &input, Rect *motionBlob) = 0;
+
+    // called after flush, when no detections are running, the next input starts a new sequence
+    virtual void reset(void) = 0;
+
+    // zoneMask is 255 where detection looks, in input pixels, empty if it looks everywhere
+    static DetectorEngine* create(const MotionDetectorConfig &config, int width, int height, const Mat &zoneMask);
+
+    // rasterizes zones of a width x height frame once, returns the smallest even aligned box around
+    // the included pixels and writes their mask at half resolution of the box to downscaledMask,
+    // which stays empty when every pixel of the box is included; empty box if nothing is included
+    static Rect rasterizeZones(const std::vector<DetectionZone> &zones, int width, int height, Mat *downscaledMask);
+
+    static const char* getTypeName(DetectorEngineType type);
+    // returns DetectorEngineTypesCount for unknown names
+    static DetectorEngineType getTypeByName(const char *name);
+protected:
+    Mat zoneMask;
+
+    // same rule for every engine: motion is an 8-connected blob of at least MIN_MOTION_AREA pixels in binary mask
+    static const int MIN_MOTION_AREA = 20 * 20;
+    static const int MAX_REPORTED_BLOBS = 16;
+
+    // labelling stops at the first blob that is large enough, boxes of blobs seen until then
+    // (the large one first) are added to blobs when it is given
+    static bool haveMotionBlob(const Mat &mask, std::vector<Rect> *blobs = NULL);
+    static Mat wrapGrayFrame(const AVFrame *frame);
+};
+
+#endif //PEOPLEWATCHER_DETECTORENGINE_H
@@ -3,24 +3,42 @@
 #include <sys/stat.h>
 #include <dirent.h>
 
+#include <stdexcept>
+
 #include "log.h"
 #include "exceptionUtils.h"
 
-#include "AsyncIO.h"
+#include "EngineStats.h"
+#include "MotionDetector.h"
 
 #define ENCODER_TAG "PW_ENCODER"
 
-#define FRAME_BUFFER_SIZE 20 * 3 // 20 fps for 3 seconds (~28 MB buffer)
+#define PRE_ROLL_BYTES_PER_SECOND (256 * 1024) // 2 Mbit/s, a lot more than quiet scenes take
 
-Encoder::Encoder(void) : pendingOperations(FRAME_BUFFER_SIZE, 2, 2) {
+Encoder::Encoder(void) : initialized(0), width(0), height(0), preRollSeconds(0), asyncIO(NULL), placement(NULL), budget(NULL),
+                         queuedFrames(0), maxQueuedFrames(0), io_file(NULL), io_buffer(NULL) {
 }
 
-void Encoder::initialize(const char *rootDir) {
+void Encoder::initialize(const char *rootDir, int width, int height, int maxQueuedFrames, AsyncIO *asyncIO,
+                         const ThreadPlacement *placement, const ThreadBudget *budget, int preRollSeconds) {
 
     if (this->initialized)
         return;
 
+    this->maxQueuedFrames = maxQueuedFrames;
+
+    // frames with motion come from whichever detection pool thread drains the results,
+    // or from the detector thread when it drains a skipped detection
+    pendingOperations = BlockingConcurrentQueue<EncoderOperation>((size_t) maxQueuedFrames, 2,
+                                                                  3 + MotionDetector::MAX_POOL_THREADS);
+
     this->rootDir = std::string(rootDir);
+    this->width = width;
+    this->height = height;
+    this->preRollSeconds = preRollSeconds;
+    this->asyncIO = asyncIO;
+    this->placement = placement;
+    this->budget = budget;
 
     removeAllInUseFlags();
 
@@ -28,7 +46,7 @@ void Encoder::initialize(const char *rootDir) {
 
     avfilter_register_all();
 
-    pthread_check_error(pthread_create(&thread, NULL, thread_entrypoint, NULL));
+    pthread_check_error(pthread_create(&thread, NULL, thread_entrypoint, this));
 
     this->initialized = 1;
 }
@@ -68,18 +86,38 @@ void Encoder::stopRecord(void) {
 
 bool Encoder::canAcceptFrame(void) {
 
-    return this->pendingOperations.size_approx() < FRAME_BUFFER_SIZE;
+    return queuedFrames < maxQueuedFrames;
 }
 
-void Encoder::sendFrame(AVFrame* yuvFrame) {
+double Encoder::getLoad(void) {
+
+    return (double) queuedFrames / maxQueuedFrames;
+}
+
+void Encoder::sendFrame(AVFrame* yuvFrame, bool haveMotion) {
 
     EncoderOperation operation = { };
     operation.operationType = EncodeFrame;
     operation.frame = yuvFrame;
+    operation.haveMotion = haveMotion;
+
+    // senders drain results one at a time, so the count doesn't pass the limit
+    bool queued = false;
+
+    if (queuedFrames < maxQueuedFrames) {
+
+        queuedFrames++;
 
-    if (!pendingOperations.try_enqueue(operation)) {
+        queued = pendingOperations.try_enqueue(operation);
+        if (!queued)
+            queuedFrames--;
+    }
+
+    if (!queued) {
+
+        print_log(ANDROID_LOG_WARN, ENCODER_TAG, "Frame drop (%d frames in queue)", (int) queuedFrames);
 
-        print_log(ANDROID_LOG_WARN, ENCODER_TAG, "Frame drop (%d operations in queue)", pendingOperations.size_approx());
+        EngineStats::getInstance().countDrop(DropAtEncoderQueue);
 
         av_frame_free(&yuvFrame);
     } else {
@@ -179,19 +217,28 @@ bool Encoder::removeInUseFlag(std::string filePath) {
     return true;
 }
 
-void Encoder::startEncoding(void) {
+void Encoder::startEncoding(AVPixelFormat pixelFormat) {
 
     currentRecordFilePath = getFilePathForRecord();
 
-    encoder.startRecord(Record, x264, WIDTH, HEIGHT, currentRecordFilePath.c_str(), encoder_callback);
+    // budget may have changed since the last record, a running encoder keeps its threads
+    int threadsCount = budget != NULL ? budget->getEncoderThreads() : 1;
+
+    print_log(ANDROID_LOG_INFO, ENCODER_TAG, "Starting record with %d encoder threads", threadsCount);
+
+    encoder.setPreRoll(preRollSeconds * 1000000000LL, (size_t) preRollSeconds * PRE_ROLL_BYTES_PER_SECOND);
+    encoder.startRecord(Record, x264, width, height, pixelFormat, threadsCount, currentRecordFilePath.c_str(),
+                        encoder_callback, this);
 }
 
 void Encoder::stopEncoding(void) {
 
-    encoder.closeRecord();
+    bool written = encoder.closeRecord();
 
     my_assert(!currentRecordFilePath.empty());
-    if (!removeInUseFlag(currentRecordFilePath))
+
+    // pre-roll without motion never creates the file
+    if (written && !removeInUseFlag(currentRecordFilePath))
         throw new std::runtime_error("Couldn't remove in use flag from current record");
     currentRecordFilePath = "";
 }
@@ -200,15 +247,26 @@ void Encoder::stopEncoding(void) {
 
 void* Encoder::thread_entrypoint(void* opaque) {
 
-    Encoder::getInstance().threadLoop();
+    ((Encoder*) opaque)->threadLoop();
     return NULL;
 }
 
 void Encoder::threadLoop(void) {
 
+    // before the encoder is opened, so its threads inherit the placement
+    if (placement != NULL)
+        placement->placeCurrentThread(RoleEncoder);
+
     long long startTime = 0;
     bool recordStarted = false;
 
+    // encoder is opened on the first frame, because only then we know its pixel format
+    bool encodingStarted = false;
+    AVPixelFormat encodingFormat = AV_PIX_FMT_NONE;
+
+    // with pre-roll every camera frame comes here, so drops outside of a record are logged once per pause
+    bool dropLogged = false;
+
     while (true) {
 
         EncoderOperation operation;
@@ -220,9 +278,8 @@ void Encoder::threadLoop(void) {
             if (!recordStarted) {
                 my_assert(startTime == 0);
 
-                startEncoding();
-
                 recordStarted = true;
+                dropLogged = false;
             } else {
                 print_log(ANDROID_LOG_WARN, ENCODER_TAG, "Record is already started");
             }
@@ -231,32 +288,62 @@ void Encoder::threadLoop(void) {
 
             AVFrame *yuvFrame = operation.frame;
 
+            queuedFrames--;
+
             if (recordStarted) {
 
+                AVPixelFormat frameFormat = (AVPixelFormat) yuvFrame->format;
+
+                if (encodingStarted && frameFormat != encodingFormat) {
+
+                    print_log(ANDROID_LOG_WARN, ENCODER_TAG, "Input pixel format changed, starting new record");
+
+                    stopEncoding();
+
+                    startTime = 0;
+                    encodingStarted = false;
+                }
+
+                if (!encodingStarted) {
+
+                    startEncoding(frameFormat);
+
+                    encodingStarted = true;
+                    encodingFormat = frameFormat;
+                }
+
                 if (startTime == 0)
                     startTime = yuvFrame->pts;
 
                 my_assert(yuvFrame->pts >= startTime);
                 yuvFrame->pts -= startTime;
 
-                encoder.writeFrame(yuvFrame);
+                encoder.writeFrame(yuvFrame, operation.haveMotion);
+
+                // frame data is referenced by filters now, release our frame so its buffer can go back to the pool
+                av_frame_free(&yuvFrame);
             } else {
 
-                print_log(ANDROID_LOG_WARN, ENCODER_TAG, "Framed drop because record isn't started");
+                if (!dropLogged) {
+                    print_log(ANDROID_LOG_WARN, ENCODER_TAG, "Frames are dropped because record isn't started");
+                    dropLogged = true;
+                }
 
                 av_frame_free(&yuvFrame);
             }
 
         } else if (operation.operationType == CloseRecord || operation.operationType == FinalizeEncoder) {
 
-            if (recordStarted) {
+            if (encodingStarted) {
 
                 stopEncoding();
 
-                startTime = 0;
-                recordStarted = false;
+                encodingStarted = false;
             }
 
+            startTime = 0;
+            recordStarted = false;
+
             if (operation.operationType == FinalizeEncoder)
                 break;
         }
@@ -291,7 +378,7 @@ AVIOContext* Encoder::createIO(const char *filePath) {
         return NULL;
     }
 
-    AVIOContext* pb = avio_alloc_context((uint8_t *) io_buffer, io_buffer_size, 1, io_file, NULL,
+    AVIOContext* pb = avio_alloc_context((uint8_t *) io_buffer, io_buffer_size, 1, this, NULL,
                              io_write_callback, NULL);
 
     if (pb == NULL) {
@@ -316,7 +403,7 @@ void Encoder::closeIO(AVIOContext **pb) {
     av_freep(&this->io_buffer);
 
     // schedule file close
-    AsyncIO::getInstance().closeFile(&io_file);
+    asyncIO->closeFile(&io_file);
 
     print_log(ANDROID_LOG_INFO, ENCODER_TAG, "io closed");
 }
@@ -324,24 +411,28 @@ void Encoder::closeIO(AVIOContext **pb) {
 // static C-like callbacks
 
 
-void* Encoder::encoder_callback(RequestType request, const void* param) {
+void* Encoder::encoder_callback(void* opaque, RequestType request, const void* param) {
+
+    Encoder *encoder = (Encoder*) opaque;
 
     switch (request) {
         case CreateIO: {
-            return Encoder::getInstance().createIO((const char*) param);
+            return encoder->createIO((const char*) param);
         };
         case CloseIO: {
-            Encoder::getInstance().closeIO((AVIOContext**) param);
+            encoder->closeIO((AVIOContext**) param);
             return NULL;
         };
     }
+
+    return NULL;
 }
 
 int Encoder::io_write_callback(void *opaque, uint8_t *buf, int buf_size) {
 
-    FILE *f = (FILE*) opaque;
+    Encoder *encoder = (Encoder*) opaque;
 
-    AsyncIO::getInstance().write(f, (void*) buf, (size_t) buf_size);
+    encoder->asyncIO->write(encoder->io_file, (void*) buf, (size_t) buf_size);
 
     return buf_size;
 }
\ No newline at end of file
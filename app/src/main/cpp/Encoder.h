@@ -1,8 +1,12 @@
 #ifndef PEOPLEWATCHER_ENCODER_H
 #define PEOPLEWATCHER_ENCODER_H
 
+#include <atomic>
+
 #include "blockingconcurrentqueue.h"
 #include "FFmpegUtils.h"
+#include "AsyncIO.h"
+#include "ThreadBudget.h"
 
 extern "C" {
 #include "libavutil/frame.h"
@@ -10,18 +14,14 @@ extern "C" {
 
 using namespace moodycamel;
 
+// one instance per stream, file writes go through the shared async IO thread
 class Encoder {
 public:
-    static Encoder& getInstance() {
-        static Encoder instance;
-
-        return instance;
-    }
+    Encoder(void);
 
     Encoder(Encoder const&) = delete;
     void operator=(Encoder const&)  = delete;
 private:
-    Encoder(void);
 
     enum FrameOperationType {
         StartRecord,
@@ -33,13 +33,23 @@ private:
     struct EncoderOperation {
         FrameOperationType  operationType;
         AVFrame *frame;
+        bool haveMotion;
     };
 
     int initialized;
 
     std::string rootDir;
+    int width, height;
+    int preRollSeconds;
+
+    AsyncIO *asyncIO;
+    const ThreadPlacement *placement;
+    const ThreadBudget *budget;
 
     BlockingConcurrentQueue<EncoderOperation> pendingOperations;
+    // frames in pendingOperations and their limit from the frame budget
+    std::atomic_int queuedFrames;
+    int maxQueuedFrames;
 
     FFmpegEncoder encoder;
     std::string currentRecordFilePath;
@@ -56,24 +66,25 @@ private:
     bool removeInUseFlag(std::string filePath);
     void removeAllInUseFlags(void);
 
-    void startEncoding(void);
+    void startEncoding(AVPixelFormat pixelFormat);
     void stopEncoding(void);
 
     AVIOContext* createIO(const char *filePath);
     void closeIO(AVIOContext **pb);
 
-    static void* encoder_callback(RequestType request, const void* param);
+    static void* encoder_callback(void* opaque, RequestType request, const void* param);
     static int io_write_callback(void *opaque, uint8_t *buf, int buf_size);
 public:
-    static const int WIDTH  = 640;
-    static const int HEIGHT = 480;
-
-    void initialize(const char *rootDir);
+    // with preRollSeconds every frame is sent, frames without motion wait encoded until motion or eviction
+    void initialize(const char *rootDir, int width, int height, int maxQueuedFrames, AsyncIO *asyncIO,
+                    const ThreadPlacement *placement, const ThreadBudget *budget, int preRollSeconds);
 
     void startRecord(void);
     void stopRecord(void);
     bool canAcceptFrame(void);
-    void sendFrame(AVFrame* yuvFrame);
+    // queued frames relative to the limit, 0..1
+    double getLoad(void);
+    void sendFrame(AVFrame* yuvFrame, bool haveMotion);
     void terminate(void);
 };
 
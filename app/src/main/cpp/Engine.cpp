@@ -1,110 +1,152 @@
 #include "Engine.h"
 
+#include <stdexcept>
 #include <unistd.h>
 
+#include "opencv2/core.hpp"
+
 #include "log.h"
+#include "EngineStats.h"
 
-#include "opencv2/highgui.hpp"
+#define ENGINE_TAG "PW_ENGINE"
 
-extern "C" {
-#include "imageUtils.h"
+Engine::Engine(void) : initialized(0), streams(), streamsCount(0) {
 }
 
-#include "Encoder.h"
-#include "AsyncIO.h"
-#include "MotionDetector.h"
+void Engine::initialize(const EngineConfig &config) {
 
-#define ENGINE_TAG "PW_ENGINE"
+    if (this->initialized)
+        return;
 
-using namespace cv;
+    if (config.placement < 0 || config.placement >= PlacementPoliciesCount)
+        throw new std::runtime_error("Unknown thread placement policy");
 
-Engine::Engine(void) {
-}
+    // model is read before any thread starts, so a bad one fails initialization cleanly
+    if (!config.personModel.empty())
+        personClassifier.load(config.personModel.c_str());
 
-void Engine::initialize(const char *rootDir) {
+    placement.initialize(config.placement);
 
-    if (this->initialized)
-        return;
+    frameBudget.initialize(config.frameMemoryBudget);
+
+    asyncIO.initialize(&placement);
 
-    AsyncIO::getInstance().initialize();
-    Encoder::getInstance().initialize(rootDir);
-    MotionDetector::getInstance().initialize(rootDir, motionDetectorCallback);
+    // detection of all streams shares one pool, it grows with the number of cores instead of streams
+    budget.initialize(placement, DetectionPool::MAX_THREADS);
+
+    // 0 runs parallel_for_ bodies on the calling thread, it would compete with the other workers otherwise
+    int openCVThreads = budget.getOpenCVThreads();
+    cv::setNumThreads(openCVThreads > 1 ? openCVThreads : 0);
+
+    // workers for the whole budget are started, the ones detection doesn't get now are parked
+    detectionPool.initialize(budget.getMaxDetectionThreads(), &placement);
+    detectionPool.setActiveThreads(budget.getDetectionThreads());
 
     nice(-20);
 
+    print_log(ANDROID_LOG_INFO, ENGINE_TAG, "Engine is initialized, %d detection threads, %s placement, %s",
+              budget.getDetectionThreads(), ThreadPlacement::getPolicyName(placement.getPolicy()),
+              personClassifier.isLoaded() ? "person classifier" : "no person classifier");
+
     this->initialized = 1;
 }
 
-void Engine::finalize(void) {
+int Engine::addStream(const StreamConfig &config) {
 
-    MotionDetector::getInstance().terminate();
-    Encoder::getInstance().terminate();
-    AsyncIO::getInstance().terminate();
+    if (!this->initialized)
+        throw new std::runtime_error("Engine isn't initialized");
 
-    print_log(ANDROID_LOG_INFO, ENGINE_TAG, "Engine is finalized");
-}
+    int streamId = streamsCount;
+    if (streamId >= MAX_STREAMS)
+        throw new std::runtime_error("Too many streams");
+
+    StreamPipeline *stream = new StreamPipeline(streamId, config);
+    stream->initialize(&asyncIO, &detectionPool, &placement, &budget, &frameBudget,
+                       personClassifier.isLoaded() ? &personClassifier : NULL);
 
-void Engine::startRecord(void) {
+    streams[streamId] = stream;
+    streamsCount++;
 
-    Encoder::getInstance().startRecord();
+    budget.setStreamsCount(streamsCount);
+
+    return streamId;
 }
 
-void Engine::stopRecord(void) {
+StreamPipeline* Engine::getStream(int streamId) {
 
-    MotionDetector::getInstance().flush();
+    if (streamId < 0 || streamId >= streamsCount)
+        throw new std::runtime_error("Unknown stream");
 
-    Encoder::getInstance().stopRecord();
+    return streams[streamId];
 }
 
-void Engine::restartRecordIfFramesTooFarApart(long long realtimeTimestamp) {
+void Engine::finalize(void) {
 
-    if (lastMotionRealtimeTimestamp != 0) {
+    if (!this->initialized)
+        return;
+
+    for (int streamId = 0; streamId < streamsCount; streamId++)
+        streams[streamId]->finalize();
 
-        long long RECORD_SPLIT_TIME = (long long) 6 * 60 * 60 * 1000 * 1000 * 1000;
-        long long elapsed = realtimeTimestamp - lastMotionRealtimeTimestamp;
+    // all detectors are flushed at this point, so this only stops the workers
+    detectionPool.terminate();
 
-        if (elapsed >= RECORD_SPLIT_TIME) {
+    EngineStats &stats = EngineStats::getInstance();
 
-            print_log(ANDROID_LOG_INFO, ENGINE_TAG, "restarting record");
+    for (int worker = 0; worker < DetectionPool::MAX_THREADS; worker++) {
 
-            lastMotionRealtimeTimestamp = 0;
+        WorkerStats workerStats = stats.getWorkerStats(worker);
 
-            stopRecord();
-            startRecord();
-        }
+        if (workerStats.tasks > 0)
+            print_log(ANDROID_LOG_INFO, ENGINE_TAG,
+                      "Detection worker %d: %lld tasks (%lld stolen), busy %.2f s, idle %.2f s", worker,
+                      workerStats.tasks, workerStats.stolenTasks, workerStats.busy, workerStats.idle);
     }
-}
 
-void Engine::sendFrame(uint8_t* dataY, uint8_t* dataU, uint8_t* dataV,
-                       int strideY, int strideU, int strideV, long long timestamp) {
+    // encoders are closed, so all their writes are already queued
+    asyncIO.terminate();
 
-    restartRecordIfFramesTooFarApart(timestamp);
+    print_log(ANDROID_LOG_INFO, ENGINE_TAG, "Frame memory: %.1f MB of %.1f MB budget reserved by streams",
+              frameBudget.getPeakBytes() / (1024.0 * 1024.0), frameBudget.getBytes() / (1024.0 * 1024.0));
 
-    if (MotionDetector::getInstance().canAcceptFrame()) {
+    for (int streamId = 0; streamId < streamsCount; streamId++) {
+        delete streams[streamId];
+        streams[streamId] = NULL;
+    }
+    streamsCount = 0;
 
-        AVFrame *yuvFrame = av_frame_alloc();
-        yuvFrame->width = Encoder::WIDTH;
-        yuvFrame->height = Encoder::HEIGHT;
-        yuvFrame->format = AV_PIX_FMT_YUV420P;
-        yuvFrame->pts = timestamp;
-        av_check_error(av_frame_get_buffer(yuvFrame, 32));
+    this->initialized = 0;
 
-        convert_yuv420_888_to_yuv420p(dataY, dataU, dataV, strideY, strideU, strideV, yuvFrame);
+    print_log(ANDROID_LOG_INFO, ENGINE_TAG, "Engine is finalized");
+}
 
-        MotionDetector::getInstance().sendFrame(yuvFrame);
-    } else {
-        print_log(ANDROID_LOG_WARN, ENGINE_TAG, "Frame drop");
-    }
+void Engine::startRecord(int streamId) {
+
+    getStream(streamId)->startRecord();
 }
 
-void Engine::motionDetected(AVFrame* yuvFrame, long long realtimeTimestamp) {
+void Engine::stopRecord(int streamId) {
 
-    lastMotionRealtimeTimestamp = realtimeTimestamp;
+    getStream(streamId)->stopRecord();
+}
 
-    Encoder::getInstance().sendFrame(yuvFrame);
+bool Engine::canAcceptFrame(int streamId) {
+
+    return getStream(streamId)->canAcceptFrame();
+}
+
+const FrameLimits& Engine::getFrameLimits(int streamId) {
+
+    return getStream(streamId)->getFrameLimits();
 }
 
-void Engine::motionDetectorCallback(AVFrame *yuvFrame, long long realtimeTimestamp) {
-    
-    Engine::getInstance().motionDetected(yuvFrame, realtimeTimestamp);
-}
\ No newline at end of file
+void Engine::sendFrame(int streamId, uint8_t* dataY, uint8_t* dataU, uint8_t* dataV,
+                       int strideY, int strideU, int strideV, int pixelStrideUV, long long timestamp) {
+
+    StreamPipeline *stream = getStream(streamId);
+
+    stream->sendFrame(dataY, dataU, dataV, strideY, strideU, strideV, pixelStrideUV, timestamp);
+
+    if (budget.sampleLoad(stream->getDetectionLoad(), stream->getEncoderLoad()))
+        detectionPool.setActiveThreads(budget.getDetectionThreads());
+}
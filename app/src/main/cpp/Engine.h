@@ -1,6 +1,7 @@
 #ifndef PEOPLEWATCHER_ENGINE_H
 #define PEOPLEWATCHER_ENGINE_H
 
+#include <atomic>
 #include <string>
 #include <inttypes.h>
 
@@ -8,37 +9,71 @@ extern "C" {
 #include "libavutil/frame.h"
 }
 
+#include "AsyncIO.h"
+#include "DetectionPool.h"
+#include "FrameBudget.h"
+#include "PersonClassifier.h"
+#include "StreamPipeline.h"
+#include "ThreadBudget.h"
+#include "ThreadPlacement.h"
+
+struct EngineConfig {
+    PlacementPolicy placement;  // which cores detection, encoder, coordination and IO threads run on
+    std::string personModel;    // person classifier model file, motion without a person isn't recorded;
+                                // empty records every motion
+    size_t frameMemoryBudget;   // bytes of raw and gray frames all streams hold together, split in stream slices
+
+    EngineConfig(void) : placement(PlacementFloating), frameMemoryBudget(FrameBudget::DEFAULT_BYTES) { }
+};
+
+// Owns resources shared by all streams (detection thread pool, IO thread, thread and frame budgets and
+// person classifier)
+// and routes calls to per stream pipelines.
 class Engine {
 public:
-    static Engine& getInstance() {
-        static Engine instance;
-
-        return instance;
-    }
+    Engine(void);
 
     Engine(Engine const&)          = delete;
     void operator=(Engine const&)  = delete;
 private:
-    Engine(void);
+    static const int MAX_STREAMS = 8;
 
     int initialized;
 
-    long long lastMotionRealtimeTimestamp;
+    ThreadPlacement placement;
+    ThreadBudget budget;
+    FrameBudget frameBudget;
+
+    AsyncIO asyncIO;
+
+    DetectionPool detectionPool;
 
-    void restartRecordIfFramesTooFarApart(long long realtimeTimestamp);
+    PersonClassifier personClassifier;
 
-    static void motionDetectorCallback(AVFrame *yuvFrame, long long realtimeTimestamp);
-    void motionDetected(AVFrame* yuvFrame, long long realtimeTimestamp);
+    // streams are only added, never removed until finalization
+    StreamPipeline* streams[MAX_STREAMS];
+    std::atomic_int streamsCount;
+
+    StreamPipeline* getStream(int streamId);
 public:
-    // all these methods should be called from single thread
+    void initialize(const EngineConfig &config = EngineConfig());
 
-    void initialize(const char* rootDir);
+    const ThreadPlacement& getPlacement(void) const { return placement; }
+    const ThreadBudget& getThreadBudget(void) const { return budget; }
+    const FrameBudget& getFrameBudget(void) const { return frameBudget; }
     void finalize(void);
 
-    void startRecord(void);
-    void stopRecord(void);
-    void sendFrame(uint8_t* dataY, uint8_t* dataU, uint8_t* dataV,
-                   int strideY, int strideU, int strideV, long long timestamp);
+    // returns id of the new stream
+    int addStream(const StreamConfig &config);
+
+    // per stream methods should be called from the thread that delivers frames of the stream
+
+    void startRecord(int streamId);
+    void stopRecord(int streamId);
+    bool canAcceptFrame(int streamId);
+    const FrameLimits& getFrameLimits(int streamId);
+    void sendFrame(int streamId, uint8_t* dataY, uint8_t* dataU, uint8_t* dataV,
+                   int strideY, int strideU, int strideV, int pixelStrideUV, long long timestamp);
 };
 
 #endif //PEOPLEWATCHER_ENGINE_H
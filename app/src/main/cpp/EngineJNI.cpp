@@ -7,17 +7,42 @@
 
 #include "Engine.h"
 
+// detection zone kinds, values match EngineManager.ZONE_INCLUDE and ZONE_EXCLUDE
+#define ZONE_INCLUDE 0
+#define ZONE_EXCLUDE 1
+
+// engine lives between initializeEngine and finalizeEngine, all streams are added to it
+static Engine *engine;
+
+static Engine* getEngine(void) {
+
+    if (engine == NULL)
+        throw new std::runtime_error("Engine isn't initialized");
+
+    return engine;
+}
+
 extern "C" JNIEXPORT void JNICALL Java_com_galover_media_peoplewatcher_EngineManager_initializeEngine(
-        JNIEnv *env, jobject /*this*/, jstring rootDir) {
+        JNIEnv *env, jobject /*this*/, jint threadPlacement, jstring personModel) {
 
     try {
         COFFEE_TRY() {
 
-            const char *rootDirStr = env->GetStringUTFChars(rootDir, JNI_FALSE);
+            if (engine == NULL)
+                engine = new Engine();
+
+            EngineConfig config;
+            config.placement = (PlacementPolicy) threadPlacement;
+
+            // null records every motion
+            if (personModel != NULL) {
 
-            Engine::getInstance().initialize(rootDirStr);
+                const char *personModelStr = env->GetStringUTFChars(personModel, JNI_FALSE);
+                config.personModel = std::string(personModelStr);
+                env->ReleaseStringUTFChars(personModel, personModelStr);
+            }
 
-            env->ReleaseStringUTFChars(rootDir, rootDirStr);
+            engine->initialize(config);
 
         } COFFEE_CATCH() {
             coffeecatch_throw_exception(env);
@@ -27,13 +52,80 @@ extern "C" JNIEXPORT void JNICALL Java_com_galover_media_peoplewatcher_EngineMan
     }
 }
 
+extern "C" JNIEXPORT jint JNICALL Java_com_galover_media_peoplewatcher_EngineManager_addStream(
+        JNIEnv *env, jobject /*this*/, jstring outputDir, jint width, jint height, jintArray detectionZones,
+        jint detectorEngine, jint preRollSeconds) {
+
+    jint streamId = -1;
+
+    try {
+        COFFEE_TRY() {
+
+            const char *outputDirStr = env->GetStringUTFChars(outputDir, JNI_FALSE);
+
+            StreamConfig config;
+            config.outputDir = std::string(outputDirStr);
+            config.width = width;
+            config.height = height;
+            config.preRollSeconds = preRollSeconds;
+            config.detector.engine = (DetectorEngineType) detectorEngine;
+
+            env->ReleaseStringUTFChars(outputDir, outputDirStr);
+
+            // kind, points count and x, y of every point, zone after zone
+            jsize zonesLength = env->GetArrayLength(detectionZones);
+            jint *zones = env->GetIntArrayElements(detectionZones, NULL);
+            bool malformed = false;
+
+            for (jsize i = 0; i < zonesLength; ) {
+
+                jint pointsCount = i + 1 < zonesLength ? zones[i + 1] : -1;
+
+                if (pointsCount < 0 || pointsCount > (zonesLength - i - 2) / 2) {
+                    malformed = true;
+                    break;
+                }
+
+                DetectionZone zone;
+                zone.exclude = zones[i] == ZONE_EXCLUDE;
+
+                for (jint point = 0; point < pointsCount; point++)
+                    zone.polygon.push_back(Point(zones[i + 2 + point * 2], zones[i + 3 + point * 2]));
+
+                config.detector.zones.push_back(zone);
+
+                i += 2 + pointsCount * 2;
+            }
+
+            env->ReleaseIntArrayElements(detectionZones, zones, JNI_ABORT);
+
+            if (malformed)
+                throw new std::runtime_error("Malformed detection zones");
+
+            streamId = getEngine()->addStream(config);
+
+        } COFFEE_CATCH() {
+            coffeecatch_throw_exception(env);
+        } COFFEE_END();
+    } catch(...) {
+        swallow_cpp_exception_and_throw_java(env);
+    }
+
+    return streamId;
+}
+
 extern "C" JNIEXPORT void JNICALL Java_com_galover_media_peoplewatcher_EngineManager_finalizeEngine(
         JNIEnv *env, jobject /*this*/) {
 
     try {
         COFFEE_TRY() {
 
-            Engine::getInstance().finalize();
+            if (engine != NULL) {
+                engine->finalize();
+
+                delete engine;
+                engine = NULL;
+            }
 
         } COFFEE_CATCH() {
             coffeecatch_throw_exception(env);
@@ -44,11 +136,11 @@ extern "C" JNIEXPORT void JNICALL Java_com_galover_media_peoplewatcher_EngineMan
 }
 
 extern "C" JNIEXPORT void JNICALL Java_com_galover_media_peoplewatcher_EngineManager_startRecord(
-        JNIEnv *env, jobject /*this*/) {
+        JNIEnv *env, jobject /*this*/, jint streamId) {
     try {
         COFFEE_TRY() {
 
-            Engine::getInstance().startRecord();
+            getEngine()->startRecord(streamId);
 
         } COFFEE_CATCH() {
             coffeecatch_throw_exception(env);
@@ -59,9 +151,9 @@ extern "C" JNIEXPORT void JNICALL Java_com_galover_media_peoplewatcher_EngineMan
 }
 
 extern "C" JNIEXPORT void JNICALL Java_com_galover_media_peoplewatcher_EngineManager_sendFrame(
-        JNIEnv *env, jobject /*this*/,
+        JNIEnv *env, jobject /*this*/, jint streamId,
         jobject Y, jobject U, jobject V,
-        jint strideY, jint strideU, jint strideV,
+        jint strideY, jint strideU, jint strideV, jint pixelStrideUV,
         jlong timestamp) {
 
     try {
@@ -71,7 +163,8 @@ extern "C" JNIEXPORT void JNICALL Java_com_galover_media_peoplewatcher_EngineMan
             uint8_t* dataU = (uint8_t *) env->GetDirectBufferAddress(U);
             uint8_t* dataV = (uint8_t *) env->GetDirectBufferAddress(V);
 
-            Engine::getInstance().sendFrame(dataY, dataU, dataV, strideY, strideU, strideV, timestamp);
+            getEngine()->sendFrame(streamId, dataY, dataU, dataV, strideY, strideU, strideV, pixelStrideUV,
+                              timestamp);
 
         } COFFEE_CATCH() {
             coffeecatch_throw_exception(env);
@@ -82,11 +175,11 @@ extern "C" JNIEXPORT void JNICALL Java_com_galover_media_peoplewatcher_EngineMan
 }
 
 extern "C" JNIEXPORT void JNICALL Java_com_galover_media_peoplewatcher_EngineManager_stopRecord(
-        JNIEnv *env, jobject /*this*/) {
+        JNIEnv *env, jobject /*this*/, jint streamId) {
     try {
         COFFEE_TRY() {
 
-            Engine::getInstance().stopRecord();
+            getEngine()->stopRecord(streamId);
 
         } COFFEE_CATCH() {
             coffeecatch_throw_exception(env);
@@ -0,0 +1,213 @@
+#include "EngineStats.h"
+
+#include <algorithm>
+#include <vector>
+
+#include "exceptionUtils.h"
+
+EngineStats::EngineStats(void) {
+
+    pthread_check_error(pthread_mutex_init(&latencyMutex, NULL));
+
+    reset();
+}
+
+void EngineStats::countDrop(DropSite site) {
+
+    drops[site]++;
+}
+
+void EngineStats::addLatency(PipelineStage stage, double seconds) {
+
+    pthread_check_error(pthread_mutex_lock(&latencyMutex));
+
+    LatencyWindow &window = latencies[stage];
+    window.samples[window.count % LATENCY_WINDOW] = (float) seconds;
+    window.count++;
+
+    pthread_check_error(pthread_mutex_unlock(&latencyMutex));
+}
+
+void EngineStats::countEvent(EngineCounter counter) {
+
+    counters[counter]++;
+}
+
+void EngineStats::countWorkerTask(int worker, double busySeconds, double idleSeconds, bool stolen) {
+
+    workerTasks[worker]++;
+    if (stolen)
+        workerStolenTasks[worker]++;
+
+    workerBusyTime[worker] += (long long) (busySeconds * 1000.0 * 1000.0);
+    workerIdleTime[worker] += (long long) (idleSeconds * 1000.0 * 1000.0);
+}
+
+long long EngineStats::getDrops(DropSite site) {
+
+    return drops[site];
+}
+
+long long EngineStats::getCount(EngineCounter counter) {
+
+    return counters[counter];
+}
+
+StageLatency EngineStats::getLatency(PipelineStage stage) {
+
+    StageLatency result = { };
+
+    std::vector<float> samples;
+
+    pthread_check_error(pthread_mutex_lock(&latencyMutex));
+
+    LatencyWindow &window = latencies[stage];
+    result.count = window.count;
+
+    long long samplesCount = std::min(window.count, (long long) LATENCY_WINDOW);
+    samples.assign(window.samples, window.samples + samplesCount);
+
+    pthread_check_error(pthread_mutex_unlock(&latencyMutex));
+
+    if (samples.empty())
+        return result;
+
+    std::sort(samples.begin(), samples.end());
+
+    result.p50 = samples[(samples.size() - 1) * 50 / 100];
+    result.p99 = samples[(samples.size() - 1) * 99 / 100];
+    result.max = samples.back();
+
+    return result;
+}
+
+WorkerStats EngineStats::getWorkerStats(int worker) {
+
+    WorkerStats result = { };
+
+    result.tasks = workerTasks[worker];
+    result.stolenTasks = workerStolenTasks[worker];
+    result.busy = workerBusyTime[worker] / (1000.0 * 1000.0);
+    result.idle = workerIdleTime[worker] / (1000.0 * 1000.0);
+
+    return result;
+}
+
+void EngineStats::reset(void) {
+
+    for (int site = 0; site < DropSitesCount; site++)
+        drops[site] = 0;
+
+    for (int counter = 0; counter < EngineCountersCount; counter++)
+        counters[counter] = 0;
+
+    for (int worker = 0; worker < MAX_WORKERS; worker++) {
+        workerTasks[worker] = 0;
+        workerStolenTasks[worker] = 0;
+        workerBusyTime[worker] = 0;
+        workerIdleTime[worker] = 0;
+    }
+
+    pthread_check_error(pthread_mutex_lock(&latencyMutex));
+
+    for (int stage = 0; stage < PipelineStagesCount; stage++)
+        latencies[stage].count = 0;
+
+    pthread_check_error(pthread_mutex_unlock(&latencyMutex));
+}
+
+const char* EngineStats::getDropSiteName(DropSite site) {
+
+    switch (site) {
+        case DropAtEngine:
+            return "Frame drop";
+        case DropAtFramePool:
+            return "Frame drop at frame pool";
+        case DropAtSendFrame:
+            return "Frame drop at sendFrame";
+        case DropAtSchedule:
+            return "Frame drop at schedule";
+        case DropAtThreadPool:
+            return "Frame drop at thread pool";
+        case DropAtEncoderQueue:
+            return "Encoder queue full";
+        default:
+            return "Unknown";
+    }
+}
+
+const char* EngineStats::getStageName(PipelineStage stage) {
+
+    switch (stage) {
+        case StageConvert:
+            return "convert";
+        case StageDetection:
+            return "detection";
+        case StageOpticalFlow:
+            return "flow";
+        case StageFlowCold:
+            return "flow-cold";
+        case StageFlowWarm:
+            return "flow-warm";
+        case StageFlowReference:
+            return "flow-reference";
+        case StageClassification:
+            return "classify";
+        case StageEncode:
+            return "encode";
+        case StageWrite:
+            return "write";
+        default:
+            return "unknown";
+    }
+}
+
+const char* EngineStats::getCounterName(EngineCounter counter) {
+
+    switch (counter) {
+        case CounterFlowColdStart:
+            return "flow cold starts";
+        case CounterFlowWarmStart:
+            return "flow warm starts";
+        case CounterWarmStartAgreement:
+            return "warm start agreements";
+        case CounterWarmStartDisagreement:
+            return "warm start disagreements";
+        case CounterFixedFlowAgreement:
+            return "fixed flow agreements";
+        case CounterFixedFlowDisagreement:
+            return "fixed flow disagreements";
+        case CounterCoreToEncoder:
+            return "cores moved to encoding";
+        case CounterCoreToDetection:
+            return "cores moved to detection";
+        case CounterBatchedPair:
+            return "batched detection pairs";
+        case CounterDetectionRun:
+            return "detections run";
+        case CounterDetectionSkippedIdle:
+            return "detections skipped while idle";
+        case CounterDetectionSkippedCovered:
+            return "detections skipped, motion covers";
+        case CounterTrackedDecision:
+            return "decided around tracked motion";
+        case CounterTrackedMiss:
+            return "tracked motion missed";
+        case CounterPersonConfirmed:
+            return "motion with a person";
+        case CounterPersonRejected:
+            return "motion without a person";
+        case CounterPersonRecent:
+            return "motion near a recent person";
+        case CounterPreRollCommit:
+            return "pre-roll commits";
+        case CounterPreRollEvicted:
+            return "pre-roll GOPs evicted early";
+        case CounterFrameEvicted:
+            return "frames evicted before motion";
+        case CounterFrameOverBudget:
+            return "frames over memory budget";
+        default:
+            return "unknown";
+    }
+}
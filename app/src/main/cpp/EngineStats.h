@@ -0,0 +1,120 @@
+#ifndef PEOPLEWATCHER_ENGINESTATS_H
+#define PEOPLEWATCHER_ENGINESTATS_H
+
+#include <atomic>
+
+#include <pthread.h>
+
+// places where a frame can be thrown away before it reaches the file
+enum DropSite {
+    DropAtEngine,               // "Frame drop", detector didn't accept the frame
+    DropAtFramePool,            // no free frame buffer
+    DropAtSendFrame,            // detector operations queue is full
+    DropAtSchedule,             // too many detections scheduled or waiting for earlier results
+    DropAtThreadPool,           // thread pool refused the task
+    DropAtEncoderQueue,         // encoder operations queue is full
+    DropSitesCount
+};
+
+enum PipelineStage {
+    StageConvert,               // camera buffer to frame copy on JNI thread
+    StageDetection,             // motion detection of one frame pair
+    StageOpticalFlow,           // optical flow part of detection, only pairs that passed tile check
+    StageFlowCold,              // flow of one region started from zero
+    StageFlowWarm,              // flow of one region started from the previous pair's flow
+    StageFlowReference,         // verification: Farneback flow of a region that fixed point flow decided
+    StageClassification,        // person classifier on the motion box of one pair
+    StageEncode,                // filters + encoder for one frame
+    StageWrite,                 // async IO write of one buffer
+    PipelineStagesCount
+};
+
+// events worth counting that are neither drops nor latencies
+enum EngineCounter {
+    CounterFlowColdStart,           // flow region calculated from zero
+    CounterFlowWarmStart,           // flow region started from the previous pair's flow
+    CounterWarmStartAgreement,      // verification: cold start of a warm region gave the same decision
+    CounterWarmStartDisagreement,   // verification: cold start of a warm region gave another decision
+    CounterFixedFlowAgreement,      // verification: Farneback gave the same decision as fixed point flow
+    CounterFixedFlowDisagreement,   // verification: Farneback gave another decision than fixed point flow
+    CounterCoreToEncoder,           // thread budget moved a core from detection to encoding
+    CounterCoreToDetection,         // thread budget moved a core from encoding to detection
+    CounterBatchedPair,             // frame pair that shared a pool task with the pair before it
+    CounterDetectionRun,            // frame pair sent to detection
+    CounterDetectionSkippedIdle,    // adaptive rate: pair between idle samples, no motion assumed
+    CounterDetectionSkippedCovered, // adaptive rate: pair already recorded because of earlier motion
+    CounterTrackedDecision,         // motion found around tracked blobs, rest of the frame skipped
+    CounterTrackedMiss,             // no motion around tracked blobs, whole frame examined
+    CounterPersonConfirmed,         // classifier found a person in the motion box
+    CounterPersonRejected,          // classifier found no person, motion isn't recorded
+    CounterPersonRecent,            // motion accepted without classifier, a person was confirmed just before
+    CounterPreRollCommit,           // motion wrote compressed pre-roll to the record
+    CounterPreRollEvicted,          // pre-roll GOP evicted before it aged out, byte budget or packet slots
+    CounterFrameEvicted,            // frame waiting for motion evicted before motion could be decided
+    CounterFrameOverBudget,         // frame buffer refused because the frame budget is used up
+    EngineCountersCount
+};
+
+struct StageLatency {
+    long long count;
+    double p50, p99, max;       // in seconds
+};
+
+// one detection pool thread
+struct WorkerStats {
+    long long tasks;
+    long long stolenTasks;      // taken from queues of other workers
+    double busy, idle;          // in seconds, idle is the time between tasks
+};
+
+// counters are lock free, latency samples are kept in a bounded window per stage
+class EngineStats {
+public:
+    static const int MAX_WORKERS = 16;
+
+    static EngineStats& getInstance() {
+        static EngineStats instance;
+
+        return instance;
+    }
+
+    EngineStats(EngineStats const&)    = delete;
+    void operator=(EngineStats const&) = delete;
+private:
+    EngineStats(void);
+
+    static const int LATENCY_WINDOW = 4096;
+
+    struct LatencyWindow {
+        float samples[LATENCY_WINDOW];
+        long long count;
+    };
+
+    std::atomic<long long> drops[DropSitesCount];
+    std::atomic<long long> counters[EngineCountersCount];
+
+    // times in microseconds
+    std::atomic<long long> workerTasks[MAX_WORKERS], workerStolenTasks[MAX_WORKERS];
+    std::atomic<long long> workerBusyTime[MAX_WORKERS], workerIdleTime[MAX_WORKERS];
+
+    pthread_mutex_t latencyMutex;
+    LatencyWindow latencies[PipelineStagesCount];
+public:
+    void countDrop(DropSite site);
+    void addLatency(PipelineStage stage, double seconds);
+    void countEvent(EngineCounter counter);
+    void countWorkerTask(int worker, double busySeconds, double idleSeconds, bool stolen);
+
+    long long getDrops(DropSite site);
+    long long getCount(EngineCounter counter);
+    StageLatency getLatency(PipelineStage stage);
+    WorkerStats getWorkerStats(int worker);
+
+    void reset(void);
+
+    static const char* getDropSiteName(DropSite site);
+    static const char* getStageName(PipelineStage stage);
+    static const char* getCounterName(EngineCounter counter);
+};
+
+#endif //PEOPLEWATCHER_ENGINESTATS_H
@@ -1,9 +1,10 @@
 #include "FFmpegUtils.h"
 
 #include <stdexcept>
-#include <android/log.h>
+#include <unistd.h>
 
 #include "exceptionUtils.h"
+#include "EngineStats.h"
 
 extern "C" {
 #include "libavutil/error.h"
@@ -18,23 +19,60 @@ extern "C" {
 
 #define ENCODER_TAG "PW_ENCODER"
 
+// host builds can point this to any TrueType font
+#ifndef TIMESTAMP_FONT_FILE
+#define TIMESTAMP_FONT_FILE "/system/fonts/DroidSans.ttf"
+#endif
+
+FFmpegEncoder::FFmpegEncoder(void) : useFFmpeg(false), callback(NULL), callback_opaque(NULL),
+                                     input_pix_fmt(AV_PIX_FMT_NONE), encoder_pix_fmt(AV_PIX_FMT_NONE),
+                                     format_ctx(NULL), video_stream(NULL), areHeadersWritten(false),
+                                     out_format(NULL), width(0), height(0), outputOpened(false),
+                                     preRollTime(0), preRollBytes(0), committing(false), keyframeWanted(false),
+                                     forceKeyframe(false), ptsOffset(0), nextPts(0),
+                                     lastPacketPts(AV_NOPTS_VALUE), frameInterval(0),
+                                     video_codec_ctx(NULL), video_params(NULL),
+#ifdef HAVE_MEDIACODEC
+                                     format(NULL), codec(NULL),
+#endif
+                                     video_filter_graph(NULL), inputs(NULL), outputs(NULL),
+                                     video_buffersink_ctx(NULL), video_buffersrc_ctx(NULL),
+                                     filtered_video_frame(NULL) {
+}
+
 void FFmpegEncoder::startRecord(RecordType recordType, EncoderType encoderType, int width, int height,
-                                const char *filePath, encoder_callback_func callback) {
+                                AVPixelFormat pixelFormat, int threadsCount, const char *filePath,
+                                encoder_callback_func callback, void* callbackOpaque) {
 
     free();
 
     this->callback = callback;
+    this->callback_opaque = callbackOpaque;
 
     this->useFFmpeg = encoderType == x264 || encoderType == openh264;
 
     input_time_base = av_make_q(1, 1000 * 1000 * 1000); // nanoseconds
 
+    // libx264 and MediaCodec take NV12 natively, openh264 only knows planar I420
+    input_pix_fmt = pixelFormat;
+    if (encoderType == openh264 || (pixelFormat != AV_PIX_FMT_NV12 && pixelFormat != AV_PIX_FMT_YUV420P))
+        encoder_pix_fmt = AV_PIX_FMT_YUV420P;
+    else
+        encoder_pix_fmt = pixelFormat;
+
     // search for all structs we need, before we allocate something
 
-    AVOutputFormat *out_format = av_guess_format(NULL, filePath, NULL);
+    out_format = av_guess_format(NULL, filePath, NULL);
     if (out_format == NULL)
         throw std::runtime_error("Couldn't find output format");
 
+    if (preRollTime > 0 && !useFFmpeg)
+        throw std::runtime_error("Pre-roll needs libx264 or openh264");
+
+    this->width = width;
+    this->height = height;
+    this->outputPath = std::string(filePath);
+
     if (useFFmpeg) {
         // find encoder
         AVCodec *video_codec;
@@ -54,10 +92,15 @@ void FFmpegEncoder::startRecord(RecordType recordType, EncoderType encoderType,
 
         video_codec_ctx->width = width;
         video_codec_ctx->height = height;
-        video_codec_ctx->pix_fmt = AV_PIX_FMT_YUV420P;
+        video_codec_ctx->pix_fmt = encoder_pix_fmt;
         video_codec_ctx->time_base = av_make_q(1, 60);
         video_codec_ctx->profile = FF_PROFILE_H264_CONSTRAINED_BASELINE;
         video_codec_ctx->level = 30;
+        // without it libx264 starts frame and lookahead threads by the number of cores
+        video_codec_ctx->thread_count = threadsCount;
+        // pre-roll is cut at keyframes, so its GOPs have to be well below the pre-roll time
+        if (preRollTime > 0)
+            video_codec_ctx->gop_size = PRE_ROLL_GOP_SIZE;
 
         // sync codec with output format (important)
 
@@ -79,6 +122,7 @@ void FFmpegEncoder::startRecord(RecordType recordType, EncoderType encoderType,
 
         encoder_time_base = video_codec_ctx->time_base;
     } else {
+#ifdef HAVE_MEDIACODEC
         // initialize MediaCodec
 
         my_assert(codec == NULL);
@@ -93,7 +137,8 @@ void FFmpegEncoder::startRecord(RecordType recordType, EncoderType encoderType,
         AMediaFormat_setInt32(format, "height", height);
         AMediaFormat_setInt32(format, "i-frame-interval", 60);
         AMediaFormat_setInt32(format, "frame-rate", 20);
-        AMediaFormat_setInt32(format, "color-format", 19);
+        // COLOR_FormatYUV420SemiPlanar or COLOR_FormatYUV420Planar
+        AMediaFormat_setInt32(format, "color-format", encoder_pix_fmt == AV_PIX_FMT_NV12 ? 21 : 19);
         AMediaFormat_setInt32(format, "priority", 0);
 
         // constant bitrate
@@ -115,58 +160,32 @@ void FFmpegEncoder::startRecord(RecordType recordType, EncoderType encoderType,
         format = NULL;
 
         encoder_time_base = av_make_q(1, 1000 * 1000); // microseconds
+#else
+        throw std::runtime_error("MediaCodec encoder is only available on Android");
+#endif
     }
 
-    // setup file format
-
-    my_assert(format_ctx == NULL);
-    av_check_error(avformat_alloc_output_context2(&format_ctx, out_format, NULL, NULL));
-
-    // add video stream to file
-
-    video_stream = avformat_new_stream(format_ctx, NULL);
-    if (video_stream == NULL)
-        throw std::runtime_error("Couldn't create video stream");
-
-    video_stream->codecpar->codec_type = AVMEDIA_TYPE_VIDEO;
-    video_stream->codecpar->codec_id = AV_CODEC_ID_H264;
-    video_stream->codecpar->width = width;
-    video_stream->codecpar->height = height;
-    video_stream->codecpar->format = AV_PIX_FMT_YUV420P;
-
-    // creating actual file on disk
-
-    if (callback) {
+    // packets wait in encoder time base, the file's time base is only known once its header is written
+    pendingMotion.clear();
+    committing = false;
+    keyframeWanted = false;
+    forceKeyframe = false;
+    ptsOffset = 0;
+    nextPts = 0;
+    lastPacketPts = AV_NOPTS_VALUE;
+    frameInterval = 0;
 
-        my_assert(format_ctx->pb == NULL);
+    if (preRollTime > 0) {
 
-        format_ctx->pb = (AVIOContext*) callback(CreateIO, filePath);
-        if (format_ctx->pb == NULL)
-            throw new std::runtime_error("IO callback couldn't create IO context");
-    }
-    else
-        av_check_error(avio_open(&format_ctx->pb, filePath, AVIO_FLAG_WRITE));
-
-    if (useFFmpeg) {
-        // copy extra data from codec if any
-        // this is also part of syncing codec with output format
-        // output format may will this data to produce valid output
-
-        size_t extradata_size = (size_t) video_codec_ctx->extradata_size;
-        video_stream->codecpar->extradata_size = extradata_size;
-        if (extradata_size > 0) {
-            video_stream->codecpar->extradata = (uint8_t *) av_mallocz(
-                    extradata_size + AV_INPUT_BUFFER_PADDING_SIZE);
-            memcpy(video_stream->codecpar->extradata, video_codec_ctx->extradata, extradata_size);
-        }
+        int seconds = (int) ((preRollTime + 999999999LL) / 1000000000LL);
 
-        // initialize file header
-        av_check_error(avformat_write_header(format_ctx, NULL));
+        preRoll.initialize(av_rescale_q(preRollTime, input_time_base, encoder_time_base), preRollBytes,
+                           seconds * PRE_ROLL_MAX_FPS + PRE_ROLL_GOP_SIZE);
+    } else
+        preRoll.release();
 
-        areHeadersWritten = true;
-    } else {
-        areHeadersWritten = false;
-    }
+    if (!preRoll.isEnabled())
+        openOutput();
 
     // filters
 
@@ -180,15 +199,23 @@ void FFmpegEncoder::startRecord(RecordType recordType, EncoderType encoderType,
 
     snprintf(args, sizeof(args),
              "video_size=%dx%d:pix_fmt=%d:time_base=%d/%d",
-             video_stream->codecpar->width, video_stream->codecpar->height,
-             video_stream->codecpar->format,
+             width, height,
+             input_pix_fmt,
              input_time_base.num, input_time_base.den);
 
     av_check_error(avfilter_graph_create_filter(&video_buffersrc_ctx, buffersrc, "in", args, NULL,
                                                 video_filter_graph));
 
-    av_check_error(avfilter_graph_create_filter(&video_buffersink_ctx, buffersink, "out", NULL, NULL,
-                                         video_filter_graph));
+    // sink must be constrained before initialization, so graph inserts conversion only when formats differ
+    video_buffersink_ctx = avfilter_graph_alloc_filter(video_filter_graph, buffersink, "out");
+    if (video_buffersink_ctx == NULL)
+        throw std::runtime_error("Couldn't allocate buffer sink");
+
+    enum AVPixelFormat sink_pix_fmts[] = { encoder_pix_fmt, AV_PIX_FMT_NONE };
+    av_check_error(av_opt_set_int_list(video_buffersink_ctx, "pix_fmts", sink_pix_fmts,
+                                       AV_PIX_FMT_NONE, AV_OPT_SEARCH_CHILDREN));
+
+    av_check_error(avfilter_init_str(video_buffersink_ctx, NULL));
 
     my_assert(outputs == NULL);
     outputs = avfilter_inout_alloc();
@@ -209,10 +236,16 @@ void FFmpegEncoder::startRecord(RecordType recordType, EncoderType encoderType,
             snprintf(args, sizeof(args), "null");
             break;
         case Record:
-            snprintf(args, sizeof(args),
-                     "drawtext=fontfile='/system/fonts/DroidSans.ttf':" \
-                     "text=%%{localtime\\}:x=5:y=5:fontsize=24:" \
-                     "fontcolor=white@0.75:box=1:boxcolor=black@0.75");
+            if (access(TIMESTAMP_FONT_FILE, R_OK) == 0) {
+                snprintf(args, sizeof(args),
+                         "drawtext=fontfile='" TIMESTAMP_FONT_FILE "':" \
+                         "text=%%{localtime\\}:x=5:y=5:fontsize=24:" \
+                         "fontcolor=white@0.75:box=1:boxcolor=black@0.75");
+            } else {
+                print_log(ANDROID_LOG_WARN, ENCODER_TAG, "Font %s not found, recording without timestamp",
+                          TIMESTAMP_FONT_FILE);
+                snprintf(args, sizeof(args), "null");
+            }
             break;
         default:
             snprintf(args, sizeof(args), "null");
@@ -226,7 +259,69 @@ void FFmpegEncoder::startRecord(RecordType recordType, EncoderType encoderType,
     filtered_video_frame = av_frame_alloc();
 }
 
-void FFmpegEncoder::writeFrame(AVFrame* frame) {
+void FFmpegEncoder::openOutput(void) {
+
+    // setup file format
+
+    my_assert(format_ctx == NULL);
+    av_check_error(avformat_alloc_output_context2(&format_ctx, out_format, NULL, NULL));
+
+    // add video stream to file
+
+    video_stream = avformat_new_stream(format_ctx, NULL);
+    if (video_stream == NULL)
+        throw std::runtime_error("Couldn't create video stream");
+
+    video_stream->codecpar->codec_type = AVMEDIA_TYPE_VIDEO;
+    video_stream->codecpar->codec_id = AV_CODEC_ID_H264;
+    video_stream->codecpar->width = width;
+    video_stream->codecpar->height = height;
+    video_stream->codecpar->format = encoder_pix_fmt;
+
+    // creating actual file on disk
+
+    if (callback) {
+
+        my_assert(format_ctx->pb == NULL);
+
+        format_ctx->pb = (AVIOContext*) callback(callback_opaque, CreateIO, outputPath.c_str());
+        if (format_ctx->pb == NULL)
+            throw new std::runtime_error("IO callback couldn't create IO context");
+    }
+    else
+        av_check_error(avio_open(&format_ctx->pb, outputPath.c_str(), AVIO_FLAG_WRITE));
+
+    if (useFFmpeg) {
+        // copy extra data from codec if any
+        // this is also part of syncing codec with output format
+        // output format may will this data to produce valid output
+
+        size_t extradata_size = (size_t) video_codec_ctx->extradata_size;
+        video_stream->codecpar->extradata_size = extradata_size;
+        if (extradata_size > 0) {
+            video_stream->codecpar->extradata = (uint8_t *) av_mallocz(
+                    extradata_size + AV_INPUT_BUFFER_PADDING_SIZE);
+            memcpy(video_stream->codecpar->extradata, video_codec_ctx->extradata, extradata_size);
+        }
+
+        // initialize file header
+        av_check_error(avformat_write_header(format_ctx, NULL));
+
+        areHeadersWritten = true;
+    } else {
+        areHeadersWritten = false;
+    }
+
+    outputOpened = true;
+}
+
+void FFmpegEncoder::setPreRoll(long long time, size_t maxBytes) {
+
+    preRollTime = time;
+    preRollBytes = maxBytes;
+}
+
+void FFmpegEncoder::writeFrame(AVFrame* frame, bool haveMotion) {
 
     int ret = av_buffersrc_add_frame(video_buffersrc_ctx, frame);
     if (ret < 0) {
@@ -241,7 +336,7 @@ void FFmpegEncoder::writeFrame(AVFrame* frame) {
             filtered_video_frame->pts = av_rescale_q(filtered_video_frame->pts,
                                                      input_time_base, encoder_time_base);
 
-            encodeFrame(filtered_video_frame);
+            encodeFrame(filtered_video_frame, haveMotion);
         } else
         if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) {
             break;
@@ -252,11 +347,21 @@ void FFmpegEncoder::writeFrame(AVFrame* frame) {
     }
 }
 
-void FFmpegEncoder::encodeFrame(AVFrame *frame) {
+void FFmpegEncoder::encodeFrame(AVFrame *frame, bool haveMotion) {
 
     double startTime = getTime();
 
     if (useFFmpeg) {
+        // neither encoder reorders or drops frames, so packets come out in the order of these flags
+        if (frame != NULL && preRoll.isEnabled())
+            pendingMotion.push_back(haveMotion);
+
+        if (frame != NULL && forceKeyframe) {
+
+            frame->pict_type = AV_PICTURE_TYPE_I;
+            forceKeyframe = false;
+        }
+
         av_check_error(avcodec_send_frame(video_codec_ctx, frame));
 
         av_frame_unref(frame);
@@ -269,10 +374,14 @@ void FFmpegEncoder::encodeFrame(AVFrame *frame) {
             int ret = avcodec_receive_packet(video_codec_ctx, &packet);
             if (ret >= 0) {
 
-                av_packet_rescale_ts(&packet, encoder_time_base, video_stream->time_base);
-                packet.stream_index = video_stream->index;
+                bool packetHaveMotion = false;
 
-                writePacket(&packet);
+                if (!pendingMotion.empty()) {
+                    packetHaveMotion = pendingMotion.front();
+                    pendingMotion.pop_front();
+                }
+
+                writePacket(&packet, packetHaveMotion);
             } else if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) {
                 break;
             } else {
@@ -281,6 +390,7 @@ void FFmpegEncoder::encodeFrame(AVFrame *frame) {
             }
         }
     } else {
+#ifdef HAVE_MEDIACODEC
         if (frame == NULL) {
 
             media_status_t status;
@@ -300,19 +410,28 @@ void FFmpegEncoder::encodeFrame(AVFrame *frame) {
                 if (buffer == NULL)
                     throw new std::runtime_error("Input buffer is NULL");
 
-                size_t frameSize = (size_t) frame->linesize[0] * frame->height +
-                                   (frame->linesize[1] * frame->height / 2) * 2;
+                // Y plane followed by either interleaved UV plane (NV12) or U and V planes (I420)
+                int planesCount = frame->format == AV_PIX_FMT_NV12 ? 2 : 3;
+
+                size_t planeSizes[3];
+                size_t frameSize = 0;
+
+                for (int plane = 0; plane < planesCount; plane++) {
+
+                    int planeHeight = plane == 0 ? frame->height : frame->height / 2;
+
+                    planeSizes[plane] = (size_t) frame->linesize[plane] * planeHeight;
+                    frameSize += planeSizes[plane];
+                }
 
                 if (frameSize > bufferSize)
                     throw new std::runtime_error("Input buffer is smaller than frame");
 
-                memcpy(buffer, frame->data[0], (size_t) frame->linesize[0] * frame->height);
-                buffer += frame->linesize[0] * frame->height;
-
-                memcpy(buffer, frame->data[1], (size_t) frame->linesize[1] * (frame->height / 2));
-                buffer += frame->linesize[1] * (frame->height / 2);
+                for (int plane = 0; plane < planesCount; plane++) {
 
-                memcpy(buffer, frame->data[2], (size_t) frame->linesize[2] * (frame->height / 2));
+                    memcpy(buffer, frame->data[plane], planeSizes[plane]);
+                    buffer += planeSizes[plane];
+                }
 
                 media_status_t status;
 
@@ -370,10 +489,7 @@ void FFmpegEncoder::encodeFrame(AVFrame *frame) {
                     packet.pts = info.presentationTimeUs;
                     packet.dts = packet.pts;
 
-                    av_packet_rescale_ts(&packet, encoder_time_base, video_stream->time_base);
-                    packet.stream_index = video_stream->index;
-
-                    writePacket(&packet);
+                    writePacket(&packet, true);
                 }
 
                 AMediaCodec_releaseOutputBuffer(codec, (size_t) outputBufferIndex, false);
@@ -386,14 +502,104 @@ void FFmpegEncoder::encodeFrame(AVFrame *frame) {
             } else
                 throw new std::runtime_error("Error while getting output buffer");
         }
+#endif
     }
 
     double elapsed = getTime() - startTime;
 
+    if (frame != NULL)
+        EngineStats::getInstance().addLatency(StageEncode, elapsed);
+
     print_log(ANDROID_LOG_DEBUG, ENCODER_TAG, "%f ms per frame", elapsed * 1000);
 }
 
-void FFmpegEncoder::writePacket(AVPacket *packet) {
+static void shift_timestamps(AVPacket *packet, int64_t offset) {
+
+    packet->pts -= offset;
+
+    if (packet->dts != AV_NOPTS_VALUE)
+        packet->dts -= offset;
+}
+
+void FFmpegEncoder::writePacket(AVPacket *packet, bool haveMotion) {
+
+    if (preRoll.isEnabled()) {
+
+        bool keyframe = (packet->flags & AV_PKT_FLAG_KEY) != 0;
+
+        if (lastPacketPts != AV_NOPTS_VALUE && packet->pts > lastPacketPts)
+            frameInterval = packet->pts - lastPacketPts;
+        lastPacketPts = packet->pts;
+
+        // rest of the GOP references committed packets, so a commit lasts until the next keyframe
+        if (committing && keyframe && !haveMotion)
+            committing = false;
+
+        if (!committing && (haveMotion || keyframeWanted)) {
+
+            // a part can't start with a packet that references frames the file doesn't have
+            if (!preRoll.canContinue() && !keyframe) {
+
+                if (!keyframeWanted)
+                    forceKeyframe = true;
+                keyframeWanted = true;
+            } else {
+
+                commitPreRoll(packet->pts);
+                committing = true;
+                keyframeWanted = false;
+            }
+        }
+
+        if (!committing) {
+
+            preRoll.push(packet);
+            return;
+        }
+
+        shift_timestamps(packet, ptsOffset);
+        nextPts = packet->pts + frameInterval;
+    }
+
+    muxPacket(packet);
+}
+
+// writes waiting packets in front of the first packet with motion, time between commits is cut out of the record
+void FFmpegEncoder::commitPreRoll(int64_t motionPts) {
+
+    if (!outputOpened)
+        openOutput();
+
+    // ring starts with the oldest packet, or motion starts the part when the ring is empty
+    ptsOffset = motionPts - nextPts;
+
+    AVPacket packet;
+    av_init_packet(&packet);
+    packet.data = NULL;
+    packet.size = 0;
+
+    bool first = true;
+
+    while (preRoll.pop(&packet)) {
+
+        if (first) {
+            ptsOffset = packet.pts - nextPts;
+            first = false;
+        }
+
+        shift_timestamps(&packet, ptsOffset);
+        nextPts = packet.pts + frameInterval;
+
+        muxPacket(&packet);
+    }
+
+    EngineStats::getInstance().countEvent(CounterPreRollCommit);
+}
+
+void FFmpegEncoder::muxPacket(AVPacket *packet) {
+
+    av_packet_rescale_ts(packet, encoder_time_base, video_stream->time_base);
+    packet->stream_index = video_stream->index;
 
     int ret = av_interleaved_write_frame(format_ctx, packet);
     if (ret < 0) {
@@ -405,28 +611,36 @@ void FFmpegEncoder::writePacket(AVPacket *packet) {
     avio_flush(format_ctx->pb);
 }
 
-void FFmpegEncoder::closeRecord(void) {
+bool FFmpegEncoder::closeRecord(void) {
 
     // flush filters
     print_log(ANDROID_LOG_INFO, ENCODER_TAG, "flushing filters");
-    writeFrame(NULL);
+    writeFrame(NULL, false);
 
     // flush codec
     print_log(ANDROID_LOG_INFO, ENCODER_TAG, "flushing codec");
-    encodeFrame(NULL);
+    encodeFrame(NULL, false);
+
+    // pre-roll that nothing committed is dropped with the ring
+    bool written = outputOpened;
 
-    // flush output file
-    print_log(ANDROID_LOG_INFO, ENCODER_TAG, "flushing file");
-    av_check_error(av_interleaved_write_frame(format_ctx, NULL));
+    if (outputOpened) {
 
-    if (areHeadersWritten) {
-        print_log(ANDROID_LOG_INFO, ENCODER_TAG, "writing trailer");
-        av_check_error(av_write_trailer(format_ctx));
+        // flush output file
+        print_log(ANDROID_LOG_INFO, ENCODER_TAG, "flushing file");
+        av_check_error(av_interleaved_write_frame(format_ctx, NULL));
+
+        if (areHeadersWritten) {
+            print_log(ANDROID_LOG_INFO, ENCODER_TAG, "writing trailer");
+            av_check_error(av_write_trailer(format_ctx));
+        }
     }
 
     print_log(ANDROID_LOG_INFO, ENCODER_TAG, "record closed");
 
     free();
+
+    return written;
 }
 
 void FFmpegEncoder::free(void) {
@@ -437,7 +651,7 @@ void FFmpegEncoder::free(void) {
     if (format_ctx != NULL) {
 
         if (callback)
-            callback(CloseIO, &format_ctx->pb);
+            callback(callback_opaque, CloseIO, &format_ctx->pb);
         else
             avio_closep(&format_ctx->pb);
 
@@ -445,12 +659,20 @@ void FFmpegEncoder::free(void) {
         format_ctx = NULL;
     }
 
+    outputOpened = false;
+
+    // pre-roll
+
+    preRoll.clear();
+    pendingMotion.clear();
+
     // video encoder
 
     if (useFFmpeg) {
         av_dict_free(&video_params);
         avcodec_free_context(&video_codec_ctx);
     } else {
+#ifdef HAVE_MEDIACODEC
         if (format != NULL) {
             AMediaFormat_delete(format);
             format = NULL;
@@ -460,6 +682,7 @@ void FFmpegEncoder::free(void) {
             AMediaCodec_delete(codec);
             codec = NULL;
         }
+#endif
     }
 
     // filters
@@ -475,12 +698,13 @@ void FFmpegEncoder::free(void) {
     av_frame_free(&filtered_video_frame);
 }
 
-void FFmpegEncoder::TestMemoryLeak(RecordType recordType, EncoderType encoderType, int width, int height, const char *filePath) {
+void FFmpegEncoder::TestMemoryLeak(RecordType recordType, EncoderType encoderType, int width, int height,
+                                   AVPixelFormat pixelFormat, const char *filePath) {
 
-    FFmpegEncoder instance = FFmpegEncoder();
+    FFmpegEncoder instance;
 
     for (int counter = 0; counter < 10 * 1000 * 1000; counter++) {
-        instance.startRecord(recordType, encoderType, width, height, filePath, NULL);
+        instance.startRecord(recordType, encoderType, width, height, pixelFormat, 1, filePath, NULL, NULL);
 
         instance.closeRecord();
     }
@@ -498,7 +722,10 @@ public:
 
 std::string get_ffmpeg_error_str(int ret) {
 
-    return std::string(av_err2str(ret));
+    char error_str[AV_ERROR_MAX_STRING_SIZE] = { 0 };
+    av_strerror(ret, error_str, sizeof(error_str));
+
+    return std::string(error_str);
 }
 
 ffmpeg_error::ffmpeg_error(int ret) throw()
@@ -514,7 +741,7 @@ void av_check_error(int ret) {
 
 void av_log_callback(void *avcl, int level, const char *fmt, va_list vl) {
 
-    enum android_LogPriority priority;
+    android_LogPriority priority;
 
     if (level > AV_LOG_INFO)
         return;
@@ -546,7 +773,7 @@ void av_log_callback(void *avcl, int level, const char *fmt, va_list vl) {
             break;
     }
 
-    __android_log_vprint(priority, FFMPEG_TAG, fmt, vl);
+    vprint_log(priority, FFMPEG_TAG, fmt, vl);
 }
 
 void setup_ffmpeg_log(void) {
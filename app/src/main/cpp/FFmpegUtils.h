@@ -1,6 +1,7 @@
 #ifndef PEOPLEWATCHER_FFMPEGUTILS_H
 #define PEOPLEWATCHER_FFMPEGUTILS_H
 
+#include <deque>
 #include <string>
 
 extern "C" {
@@ -10,7 +11,12 @@ extern "C" {
 #include "libavfilter/avfilter.h"
 };
 
+#include "PacketRing.h"
+
+#ifdef __ANDROID__
 #include "media/NdkMediaCodec.h"
+#define HAVE_MEDIACODEC 1
+#endif
 
 void setup_ffmpeg_log();
 void av_check_error(int ret);
@@ -31,7 +37,7 @@ enum RequestType {
     CloseIO
 };
 
-typedef void* (*encoder_callback_func)(RequestType request, const void* param);
+typedef void* (*encoder_callback_func)(void* opaque, RequestType request, const void* param);
 
 class FFmpegEncoder
 {
@@ -40,22 +46,46 @@ private:
     bool useFFmpeg;
 
     encoder_callback_func callback;
+    void* callback_opaque;
 
     // timebase
     AVRational input_time_base, encoder_time_base;
 
-    // file format
+    // frames come in input format, encoder gets them in its own format (filters convert if they differ)
+    AVPixelFormat input_pix_fmt, encoder_pix_fmt;
+
+    // file format, output is opened at start or, with pre-roll, by the first commit
     AVFormatContext *format_ctx;
     AVStream *video_stream;
     bool areHeadersWritten;
+    AVOutputFormat *out_format;
+    std::string outputPath;
+    int width, height;
+    bool outputOpened;
+
+    // pre-roll: every frame is encoded and its packet waits in the ring until a frame with motion commits it
+    static const int PRE_ROLL_GOP_SIZE = 20;    // frames, 1 s at camera rate
+    static const int PRE_ROLL_MAX_FPS = 60;     // packet slots of the ring per second
+    long long preRollTime;                      // in nanoseconds, 0 writes every frame
+    size_t preRollBytes;
+    PacketRing preRoll;
+    std::deque<bool> pendingMotion;     // motion of frames inside the codec, one packet comes out per frame
+    bool committing;                    // packets go to the file until the GOP the motion ended in is complete
+    bool keyframeWanted;                // motion came while the ring held no keyframe, the next keyframe commits
+    bool forceKeyframe;                 // next frame sent to the codec is encoded as a keyframe
+    int64_t ptsOffset;                  // time between committed parts that is cut out, in encoder time base
+    int64_t nextPts;                    // pts the next committed part starts at
+    int64_t lastPacketPts, frameInterval;
 
     // ffmpeg codec
     AVCodecContext *video_codec_ctx;
     AVDictionary *video_params;
 
+#ifdef HAVE_MEDIACODEC
     // hardware codec
     AMediaFormat* format;
     AMediaCodec* codec;
+#endif
 
     // filters
     AVFilterGraph *video_filter_graph;
@@ -63,17 +93,30 @@ private:
     AVFilterContext *video_buffersink_ctx, *video_buffersrc_ctx;
     AVFrame *filtered_video_frame;
 
-    void encodeFrame(AVFrame *frame);
-    void writePacket(AVPacket *packet);
+    void openOutput(void);
+    void encodeFrame(AVFrame *frame, bool haveMotion);
+    void writePacket(AVPacket *packet, bool haveMotion);
+    void commitPreRoll(int64_t motionPts);
+    void muxPacket(AVPacket *packet);
 
     void free(void);
 public:
-    void startRecord(RecordType recordType, EncoderType encoderType, int width, int height,
-                     const char *filePath, encoder_callback_func callback);
-    void writeFrame(AVFrame* frame);
-    void closeRecord(void);
+    FFmpegEncoder(void);
 
-    static void TestMemoryLeak(RecordType recordType, EncoderType encoderType, int width, int height, const char *filePath);
+    // threadsCount is used by libx264 and openh264, MediaCodec manages its own threads
+    void startRecord(RecordType recordType, EncoderType encoderType, int width, int height,
+                     AVPixelFormat pixelFormat, int threadsCount, const char *filePath,
+                     encoder_callback_func callback, void* callbackOpaque);
+    // packets of the following records wait for motion for up to time nanoseconds, 0 writes every frame,
+    // only libx264 and openh264 support it
+    void setPreRoll(long long time, size_t maxBytes);
+    // without pre-roll haveMotion is ignored, every frame is written
+    void writeFrame(AVFrame* frame, bool haveMotion);
+    // false if pre-roll was never committed, no file was created then
+    bool closeRecord(void);
+
+    static void TestMemoryLeak(RecordType recordType, EncoderType encoderType, int width, int height,
+                               AVPixelFormat pixelFormat, const char *filePath);
 };
 
 #endif //PEOPLEWATCHER_FFMPEGUTILS_H
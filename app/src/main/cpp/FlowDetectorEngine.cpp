@@ -0,0 +1,720 @@
+#include "FlowDetectorEngine.h"
+
+#include <algorithm>
+
+#include <opencv2/imgproc.hpp>
+#include <opencv2/optflow.hpp>
+
+#include "log.h"
+#include "exceptionUtils.h"
+#include "EngineStats.h"
+
+extern "C" {
+#include "imageUtils.h"
+#include "imageKernels.h"
+}
+
+#define FLOW_ENGINE_TAG "PW_FLOW_ENGINE"
+
+// pixel moves if its flow is at least this long
+static const double MIN_FLOW_LENGTH = 0.1;
+
+FlowDetectorEngine::FlowDetectorEngine(const MotionDetectorConfig &config, int width, int height,
+                                       const Mat &zoneMask) :
+    DetectorEngine(zoneMask), config(config), lastFlowSequenceNum(-1) {
+
+    lastFlow = Mat::zeros(height, width, CV_32FC2);
+
+    if (!zoneMask.empty()) {
+
+        int tilesX = (width + TILE_SIZE - 1) / TILE_SIZE;
+        int tilesY = (height + TILE_SIZE - 1) / TILE_SIZE;
+
+        zoneTiles.resize((size_t) (tilesX * tilesY));
+
+        for (int tileY = 0; tileY < tilesY; tileY++) {
+            for (int tileX = 0; tileX < tilesX; tileX++) {
+
+                Rect tile = Rect(tileX * TILE_SIZE, tileY * TILE_SIZE, TILE_SIZE, TILE_SIZE) & Rect(0, 0, width, height);
+                zoneTiles[tileY * tilesX + tileX] = countNonZero(zoneMask(tile)) > 0;
+            }
+        }
+    }
+
+    pthread_check_error(pthread_mutex_init(&flowMutex, NULL));
+}
+
+FlowDetectorEngine::~FlowDetectorEngine(void) {
+
+    pthread_check_error(pthread_mutex_destroy(&flowMutex));
+}
+
+// excluded tiles are neither compared nor become part of a region
+void FlowDetectorEngine::findChangedRegions(AVFrame *frame, AVFrame *nextFrame, const std::vector<uint8_t> &zoneTiles,
+                                            std::vector<Rect> *regions) {
+
+    const ImageKernels *kernels = get_image_kernels();
+
+    int width = frame->width;
+    int height = frame->height;
+
+    int tilesX = (width + TILE_SIZE - 1) / TILE_SIZE;
+    int tilesY = (height + TILE_SIZE - 1) / TILE_SIZE;
+
+    std::vector<uint8_t> changed((size_t) (tilesX * tilesY), 0);
+    int changedCount = 0;
+
+    for (int tileY = 0; tileY < tilesY; tileY++) {
+
+        int y0 = tileY * TILE_SIZE;
+        int rows = std::min(TILE_SIZE, height - y0);
+
+        for (int tileX = 0; tileX < tilesX; tileX++) {
+
+            if (!zoneTiles.empty() && !zoneTiles[tileY * tilesX + tileX])
+                continue;
+
+            int x0 = tileX * TILE_SIZE;
+            int cols = std::min(TILE_SIZE, width - x0);
+
+            uint32_t sad = 0;
+
+            for (int y = y0; y < y0 + rows; y++)
+                sad += kernels->sad_row(frame->data[0] + y * frame->linesize[0] + x0,
+                                        nextFrame->data[0] + y * nextFrame->linesize[0] + x0, cols);
+
+            if (sad > (uint32_t) (TILE_CHANGE_THRESHOLD * rows * cols)) {
+                changed[tileY * tilesX + tileX] = 1;
+                changedCount++;
+            }
+        }
+    }
+
+    if (changedCount == 0)
+        return;
+
+    // group 8-connected changed tiles, each group becomes a region
+
+    std::vector<int> stack;
+    std::vector<Rect> groups;
+
+    for (int start = 0; start < tilesX * tilesY; start++) {
+
+        if (changed[start] != 1)
+            continue;
+
+        int minX = tilesX, minY = tilesY, maxX = -1, maxY = -1;
+
+        changed[start] = 2;
+        stack.push_back(start);
+
+        while (!stack.empty()) {
+
+            int tile = stack.back();
+            stack.pop_back();
+
+            int tileX = tile % tilesX;
+            int tileY = tile / tilesX;
+
+            minX = std::min(minX, tileX);
+            minY = std::min(minY, tileY);
+            maxX = std::max(maxX, tileX);
+            maxY = std::max(maxY, tileY);
+
+            for (int dy = -1; dy <= 1; dy++) {
+                for (int dx = -1; dx <= 1; dx++) {
+
+                    int x = tileX + dx;
+                    int y = tileY + dy;
+
+                    if (x < 0 || y < 0 || x >= tilesX || y >= tilesY || changed[y * tilesX + x] != 1)
+                        continue;
+
+                    changed[y * tilesX + x] = 2;
+                    stack.push_back(y * tilesX + x);
+                }
+            }
+        }
+
+        Rect group(minX * TILE_SIZE - TILE_REGION_MARGIN, minY * TILE_SIZE - TILE_REGION_MARGIN,
+                   (maxX - minX + 1) * TILE_SIZE + TILE_REGION_MARGIN * 2,
+                   (maxY - minY + 1) * TILE_SIZE + TILE_REGION_MARGIN * 2);
+
+        groups.push_back(group & Rect(0, 0, width, height));
+    }
+
+    // margins can make regions overlap, flow shouldn't be calculated twice for the same pixels
+
+    bool merged = true;
+
+    while (merged) {
+
+        merged = false;
+
+        for (size_t i = 0; i < groups.size() && !merged; i++) {
+            for (size_t j = i + 1; j < groups.size() && !merged; j++) {
+
+                if ((groups[i] & groups[j]).area() > 0) {
+
+                    groups[i] = groups[i] | groups[j];
+                    groups.erase(groups.begin() + j);
+                    merged = true;
+                }
+            }
+        }
+    }
+
+    regions->insert(regions->end(), groups.begin(), groups.end());
+}
+
+// keeps the region centered where possible, shifts it back inside the frame at borders
+Rect FlowDetectorEngine::growRegion(const Rect &region, int minSize, const Size &frameSize) {
+
+    Rect grown = region;
+
+    if (grown.width < minSize) {
+        grown.x -= (minSize - grown.width) / 2;
+        grown.width = minSize;
+    }
+
+    if (grown.height < minSize) {
+        grown.y -= (minSize - grown.height) / 2;
+        grown.height = minSize;
+    }
+
+    grown.x = std::max(0, std::min(grown.x, frameSize.width - grown.width));
+    grown.y = std::max(0, std::min(grown.y, frameSize.height - grown.height));
+
+    return grown & Rect(0, 0, frameSize.width, frameSize.height);
+}
+
+static thread_local std::vector<uint8_t> tls_blur_scratch;
+
+// preprocessed frames are shared between detections, so region is blurred in a copy,
+// copy includes pixels around the region that blur can reach, like GaussianBlur on a view would
+void FlowDetectorEngine::blurRegion(const Mat &img, const Rect &region, Mat *blurred) {
+
+    int support = box_blur_support(config.blurSigma);
+
+    Rect expanded = Rect(region.x - support, region.y - support, region.width + support * 2,
+                         region.height + support * 2) & Rect(0, 0, img.cols, img.rows);
+
+    Mat copy;
+    img(expanded).copyTo(copy);
+
+    tls_blur_scratch.resize((size_t) box_blur_scratch_size(copy.cols, copy.rows));
+
+    box_blur_gray(copy.data, (int) copy.step, copy.cols, copy.rows, config.blurSigma, tls_blur_scratch.data());
+
+    *blurred = copy(region - expanded.tl());
+}
+
+// DIS keeps per instance buffers, instance lives with the pool thread and serves every stream it detects for
+static thread_local Ptr<optflow::DISOpticalFlow> tls_dis[2];
+
+static optflow::DISOpticalFlow* getDisInstance(int preset) {
+
+    if (tls_dis[preset].empty())
+        tls_dis[preset] = optflow::createOptFlow_DIS(preset);
+
+    return tls_dis[preset];
+}
+
+void FlowDetectorEngine::calcFlow(DetectorEngineType algorithm, const Mat &img, const Mat &nextImg, Mat &flow,
+                                  bool warmStart) {
+
+    switch (algorithm) {
+        case DetectorDISUltrafast:
+        case DetectorDISFast: {
+
+            int preset = algorithm == DetectorDISFast ? optflow::DISOpticalFlow::PRESET_FAST :
+                         optflow::DISOpticalFlow::PRESET_ULTRAFAST;
+
+            // DIS starts from the contents of flow whenever it is frame sized, so cold start has to clear it
+            if (!warmStart)
+                flow.setTo(Scalar::all(0));
+
+            getDisInstance(preset)->calc(img, nextImg, flow);
+            break;
+        }
+        default:
+            if (warmStart)
+                calcOpticalFlowFarneback(img, nextImg, flow, 0.5, 1, WARM_FLOW_WINDOW, 1, 5, 1.1,
+                                         OPTFLOW_USE_INITIAL_FLOW);
+            else
+                calcOpticalFlowFarneback(img, nextImg, flow, 0.5, 1, COLD_FLOW_WINDOW, 1, 5, 1.1, 0);
+    }
+}
+
+static thread_local Mat tls_flow_dx, tls_flow_dy, tls_flow_mask;
+static thread_local std::vector<uint8_t> tls_flow_scratch;
+
+// top left part of a per thread buffer that grows to the largest region, so regions don't allocate
+static Mat regionBuffer(Mat &buffer, const Size &size, int type) {
+
+    if (buffer.type() != type || buffer.cols < size.width || buffer.rows < size.height)
+        buffer.create(std::max(buffer.rows, size.height), std::max(buffer.cols, size.width), type);
+
+    return buffer(Rect(Point(0, 0), size));
+}
+
+// fixed point flow keeps dx and dy in separate 16 bit planes and thresholds them on the fly
+void FlowDetectorEngine::calcFixedFlowMask(const Mat &img, const Mat &nextImg, Mat &mask) {
+
+    Mat dx = regionBuffer(tls_flow_dx, img.size(), CV_16SC1);
+    Mat dy = regionBuffer(tls_flow_dy, img.size(), CV_16SC1);
+
+    tls_flow_scratch.resize((size_t) dense_flow_scratch_size(img.cols, FIXED_FLOW_RADIUS));
+
+    dense_flow_mask(img.data, (int) img.step, nextImg.data, (int) nextImg.step, img.cols, img.rows,
+                    FIXED_FLOW_RADIUS, MIN_FLOW_LENGTH, (int16_t*) dx.data, (int16_t*) dy.data,
+                    (int) (dx.step / sizeof(int16_t)), mask.data, (int) mask.step, tls_flow_scratch.data());
+}
+
+bool FlowDetectorEngine::detectMotionWithFlow(DetectorEngineType algorithm, const Mat &img, const Mat &nextImg,
+                                              Mat &flow, bool warmStart, std::vector<Rect> *blobs,
+                                              const Mat &regionZoneMask) {
+
+    Mat mask = regionBuffer(tls_flow_mask, img.size(), CV_8UC1);
+
+    if (algorithm == DetectorFixedFlow)
+        calcFixedFlowMask(img, nextImg, mask);
+    else {
+        calcFlow(algorithm, img, nextImg, flow, warmStart);
+        flow_length_mask((const float*) flow.data, (int) (flow.step / sizeof(float)), mask.data, (int) mask.step,
+                         flow.cols, flow.rows, MIN_FLOW_LENGTH);
+    }
+
+    // region margins reach into excluded pixels, whatever moves there isn't motion
+    if (!regionZoneMask.empty())
+        bitwise_and(mask, regionZoneMask, mask);
+
+    return haveMotionBlob(mask, blobs);
+}
+
+// flow is a frame sized buffer, flow of the region is written into its part
+// boxes of motion blobs found in the region are added to blobs in frame coordinates
+bool FlowDetectorEngine::detectMotionInRegion(const Mat &img, const Mat &nextImg, const Rect &region, Mat &flow,
+                                              const DetectionInput &input, std::vector<Rect> *blobs) {
+
+    EngineStats &stats = EngineStats::getInstance();
+
+    Mat regionImg, nextRegionImg;
+    Mat regionFlow = flow(region);
+    Mat regionZoneMask = zoneMask.empty() ? Mat() : zoneMask(region);
+
+    blurRegion(img, region, &regionImg);
+    blurRegion(nextImg, region, &nextRegionImg);
+
+    bool warmStart = usesInitialFlow() && input.followsPreviousInput &&
+                     loadInitialFlow(input.sequenceNum, region, regionFlow);
+
+    // decision of the same region by another way of calculation, -1 if not verified
+    int referenceDecision = -1;
+
+    if (warmStart && config.verifyWarmStart) {
+
+        Mat coldFlow(region.size(), CV_32FC2);
+
+        int64 startTime = getTickCount();
+        referenceDecision = detectMotionWithFlow(config.engine, regionImg, nextRegionImg, coldFlow, false, NULL,
+                                                 regionZoneMask);
+        stats.addLatency(StageFlowCold, (getTickCount() - startTime) / getTickFrequency());
+    } else if (config.engine == DetectorFixedFlow && config.verifyFixedFlow) {
+
+        Mat farnebackFlow(region.size(), CV_32FC2);
+
+        int64 startTime = getTickCount();
+        referenceDecision = detectMotionWithFlow(DetectorFarneback, regionImg, nextRegionImg, farnebackFlow, false,
+                                                 NULL, regionZoneMask);
+        stats.addLatency(StageFlowReference, (getTickCount() - startTime) / getTickFrequency());
+    }
+
+    int64 startTime = getTickCount();
+
+    size_t firstBlob = blobs->size();
+
+    bool haveMovement = detectMotionWithFlow(config.engine, regionImg, nextRegionImg, regionFlow, warmStart, blobs,
+                                             regionZoneMask);
+
+    for (size_t i = firstBlob; i < blobs->size(); i++)
+        (*blobs)[i] += region.tl();
+
+    stats.addLatency(warmStart ? StageFlowWarm : StageFlowCold, (getTickCount() - startTime) / getTickFrequency());
+    stats.countEvent(warmStart ? CounterFlowWarmStart : CounterFlowColdStart);
+
+    if (referenceDecision != -1) {
+
+        bool agree = referenceDecision == haveMovement;
+
+        if (warmStart)
+            stats.countEvent(agree ? CounterWarmStartAgreement : CounterWarmStartDisagreement);
+        else
+            stats.countEvent(agree ? CounterFixedFlowAgreement : CounterFixedFlowDisagreement);
+    }
+
+    return haveMovement;
+}
+
+// copies flow of the previous pair that overlaps region, false if there is nothing to start from
+bool FlowDetectorEngine::loadInitialFlow(long long sequenceNum, const Rect &region, Mat &regionFlow) {
+
+    bool found = false;
+
+    pthread_check_error(pthread_mutex_lock(&flowMutex));
+
+    // previous pair may still be in progress on another thread, then we just start cold
+    if (lastFlowSequenceNum == sequenceNum - 1) {
+
+        for (const Rect &lastRegion : lastFlowRegions) {
+
+            Rect common = lastRegion & region;
+            if (common.area() == 0)
+                continue;
+
+            if (!found) {
+                regionFlow.setTo(Scalar::all(0));
+                found = true;
+            }
+
+            lastFlow(common).copyTo(regionFlow(common - region.tl()));
+        }
+    }
+
+    pthread_check_error(pthread_mutex_unlock(&flowMutex));
+
+    return found;
+}
+
+void FlowDetectorEngine::storeFlow(long long sequenceNum, const Mat &flow, const std::vector<Rect> &regions) {
+
+    pthread_check_error(pthread_mutex_lock(&flowMutex));
+
+    // pairs can finish out of order, keep the latest one
+    if (sequenceNum > lastFlowSequenceNum) {
+
+        for (const Rect &region : regions)
+            flow(region).copyTo(lastFlow(region));
+
+        lastFlowRegions = regions;
+        lastFlowSequenceNum = sequenceNum;
+    }
+
+    pthread_check_error(pthread_mutex_unlock(&flowMutex));
+}
+
+void FlowDetectorEngine::resetFlow(void) {
+
+    pthread_check_error(pthread_mutex_lock(&flowMutex));
+
+    lastFlowRegions.clear();
+    lastFlowSequenceNum = -1;
+
+    pthread_check_error(pthread_mutex_unlock(&flowMutex));
+}
+
+static thread_local Mat tls_flow;
+static thread_local std::vector<Rect> tls_blobs;
+
+// parts of region outside of all holes: bands above and below a hole and pieces left and right of it
+static void subtractRegions(const Rect &region, const std::vector<Rect> &holes, std::vector<Rect> *parts) {
+
+    std::vector<Rect> pieces(1, region), next;
+
+    for (const Rect &hole : holes) {
+
+        next.clear();
+
+        for (const Rect &piece : pieces) {
+
+            Rect common = piece & hole;
+
+            if (common.area() == 0) {
+                next.push_back(piece);
+                continue;
+            }
+
+            if (common.y > piece.y)
+                next.push_back(Rect(piece.x, piece.y, piece.width, common.y - piece.y));
+            if (common.br().y < piece.br().y)
+                next.push_back(Rect(piece.x, common.br().y, piece.width, piece.br().y - common.br().y));
+            if (common.x > piece.x)
+                next.push_back(Rect(piece.x, common.y, common.x - piece.x, common.height));
+            if (common.br().x < piece.br().x)
+                next.push_back(Rect(common.br().x, common.y, piece.br().x - common.br().x, common.height));
+        }
+
+        pieces.swap(next);
+    }
+
+    parts->insert(parts->end(), pieces.begin(), pieces.end());
+}
+
+// regions are examined one by one until one of them has motion, blob that decided goes to motionBlob
+bool FlowDetectorEngine::detectMotionInRegions(const std::vector<Rect> &regions, const Mat &img, const Mat &nextImg,
+                                               const DetectionInput &input, std::vector<Rect> *flowRegions,
+                                               Rect *motionBlob) {
+
+    bool dis = config.engine == DetectorDISUltrafast || config.engine == DetectorDISFast;
+
+    for (Rect region : regions) {
+
+        if (dis)
+            region = growRegion(region, DIS_MIN_REGION_SIZE, img.size());
+
+        // grown region can land inside one already examined
+        bool examined = false;
+        for (const Rect &flowRegion : *flowRegions)
+            examined = examined || (region & flowRegion) == region;
+
+        if (examined)
+            continue;
+
+        flowRegions->push_back(region);
+
+        // blob that reached the motion area is the first one reported by its region
+        size_t regionBlobs = tls_blobs.size();
+
+        if (detectMotionInRegion(img, nextImg, region, tls_flow, input, &tls_blobs)) {
+
+            *motionBlob = tls_blobs[regionBlobs];
+            print_log(ANDROID_LOG_DEBUG, FLOW_ENGINE_TAG, "Motion blob %dx%d at %d,%d", motionBlob->width,
+                      motionBlob->height, motionBlob->x, motionBlob->y);
+
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool FlowDetectorEngine::detectMotion(const DetectionInput &input, Rect *motionBlob) {
+
+    bool haveMovement = false;
+
+    AVFrame *frame = input.frame->gray;
+    AVFrame *nextFrame = input.nextFrame->gray;
+
+    std::vector<Rect> regions, flowRegions;
+    findChangedRegions(frame, nextFrame, zoneTiles, &regions);
+
+    tls_blobs.clear();
+
+    if (!regions.empty()) {
+
+        EngineStats &stats = EngineStats::getInstance();
+
+        int64 flowStartTime = getTickCount();
+
+        Mat img = wrapGrayFrame(frame);
+        Mat nextImg = wrapGrayFrame(nextFrame);
+
+        // buffer is reallocated only when thread switches to a stream of another size
+        tls_flow.create(frame->height, frame->width, CV_32FC2);
+
+        std::vector<Rect> trackedBoxes;
+
+        // during an event only changed tiles around tracked blobs are looked at first, most of the frame is static
+        if (config.trackMotion && tracker.predictRegions(input.sequenceNum, img.size(), &trackedBoxes)) {
+
+            std::vector<Rect> trackedRegions;
+
+            for (const Rect &box : trackedBoxes) {
+                for (const Rect &region : regions) {
+
+                    Rect common = box & region;
+                    if (common.area() > 0)
+                        trackedRegions.push_back(common);
+                }
+            }
+
+            haveMovement = detectMotionInRegions(trackedRegions, img, nextImg, input, &flowRegions, motionBlob);
+
+            stats.countEvent(haveMovement ? CounterTrackedDecision : CounterTrackedMiss);
+        }
+
+        // nothing tracked, periodic refresh or tracked blobs stopped: rest of the frame, without pixels whose
+        // flow was already computed around tracked blobs
+        if (!haveMovement) {
+
+            std::vector<Rect> untrackedRegions;
+
+            for (const Rect &region : regions)
+                subtractRegions(region, flowRegions, &untrackedRegions);
+
+            haveMovement = detectMotionInRegions(untrackedRegions, img, nextImg, input, &flowRegions, motionBlob);
+        }
+
+        if (haveMovement && config.trackMotion)
+            tracker.update(input.sequenceNum, *motionBlob);
+
+        stats.addLatency(StageOpticalFlow, (getTickCount() - flowStartTime) / getTickFrequency());
+    } else
+        print_log(ANDROID_LOG_DEBUG, FLOW_ENGINE_TAG, "No changed tiles, flow skipped");
+
+    if (usesInitialFlow())
+        storeFlow(input.sequenceNum, tls_flow, flowRegions);
+
+    return haveMovement;
+}
+
+void FlowDetectorEngine::reset(void) {
+
+    resetFlow();
+    tracker.reset();
+}
+
+// benchmark
+
+bool FlowDetectorEngine::benchmarkBlur(void) {
+
+    // downscaled detector input: checkerboard background, noise and a bright blob
+    const int width = 320, height = 140;
+    const double sigma = 3.5;
+
+    Mat source(height, width, CV_8UC1);
+    RNG rng(1);
+
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+
+            int value = 100 + ((x / 20 + y / 20) % 2) * 80 + rng.uniform(0, 30);
+            if ((x - 160) * (x - 160) + (y - 70) * (y - 70) < 30 * 30)
+                value = 230;
+
+            source.at<uchar>(y, x) = (uchar) value;
+        }
+    }
+
+    Mat reference, blurred;
+    std::vector<uint8_t> scratch((size_t) box_blur_scratch_size(width, height));
+
+    GaussianBlur(source, reference, Size(21, 21), 0.0);
+
+    source.copyTo(blurred);
+    box_blur_gray(blurred.data, (int) blurred.step, width, height, sigma, scratch.data());
+
+    // borders are replicated instead of reflected, so they are compared separately
+    int support = box_blur_support(sigma);
+    Rect interior(support, support, width - support * 2, height - support * 2);
+
+    Mat difference;
+    absdiff(blurred, reference, difference);
+
+    double interiorMax, overallMax;
+    minMaxLoc(difference(interior), NULL, &interiorMax);
+    minMaxLoc(difference, NULL, &overallMax);
+
+    double interiorMean = mean(difference(interior))[0];
+
+    const int ITERATIONS = 100;
+
+    int64 startTime = getTickCount();
+    for (int i = 0; i < ITERATIONS; i++)
+        GaussianBlur(source, reference, Size(21, 21), 0.0);
+    double gaussianElapsed = (getTickCount() - startTime) / getTickFrequency() / ITERATIONS;
+
+    startTime = getTickCount();
+    for (int i = 0; i < ITERATIONS; i++) {
+        source.copyTo(blurred);
+        box_blur_gray(blurred.data, (int) blurred.step, width, height, sigma, scratch.data());
+    }
+    double boxElapsed = (getTickCount() - startTime) / getTickFrequency() / ITERATIONS;
+
+    bool withinTolerance = interiorMax <= 3.0 && interiorMean <= 1.0 && overallMax <= 8.0;
+
+    print_log(ANDROID_LOG_INFO, FLOW_ENGINE_TAG,
+              "box blur vs GaussianBlur 21x21: interior max %.0f mean %.3f, overall max %.0f (%s)",
+              interiorMax, interiorMean, overallMax, withinTolerance ? "ok" : "out of tolerance");
+    print_log(ANDROID_LOG_INFO, FLOW_ENGINE_TAG, "GaussianBlur: %.3f ms, box blur: %.3f ms (x%.2f)",
+              gaussianElapsed * 1000.0, boxElapsed * 1000.0, gaussianElapsed / boxElapsed);
+
+    benchmark_box_blur_gray();
+
+    return withinTolerance;
+}
+
+// detector input with textured background, sensor noise and a blob moved by shift pixels
+static void generateFlowPair(RNG &rng, int blobRadius, int shift, int brightness, Mat *img, Mat *nextImg) {
+
+    const int width = 320, height = 140;
+
+    *img = Mat(height, width, CV_8UC1);
+    *nextImg = Mat(height, width, CV_8UC1);
+
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+
+            int background = 80 + ((x / 20 + y / 20) % 2) * 50;
+            bool inBlob = (x - 160) * (x - 160) + (y - 70) * (y - 70) < blobRadius * blobRadius;
+            bool inNextBlob = (x - 160 - shift) * (x - 160 - shift) + (y - 70) * (y - 70) < blobRadius * blobRadius;
+
+            img->at<uchar>(y, x) = saturate_cast<uchar>((inBlob ? 170 : background) + rng.uniform(-3, 4));
+            nextImg->at<uchar>(y, x) = saturate_cast<uchar>((inNextBlob ? 170 : background) + brightness +
+                                                            rng.uniform(-3, 4));
+        }
+    }
+
+    std::vector<uint8_t> scratch((size_t) box_blur_scratch_size(width, height));
+
+    box_blur_gray(img->data, (int) img->step, width, height, 3.5, scratch.data());
+    box_blur_gray(nextImg->data, (int) nextImg->step, width, height, 3.5, scratch.data());
+}
+
+bool FlowDetectorEngine::benchmarkFlow(void) {
+
+    struct FlowCase {
+        const char *name;
+        int blobRadius, shift, brightness;
+    };
+
+    const FlowCase cases[] = {
+        {"static", 30, 0, 0},
+        {"brightness +3", 30, 0, 3},
+        {"blob moves 1 px", 30, 1, 0},
+        {"blob moves 3 px", 30, 3, 0},
+        {"blob moves 8 px", 30, 8, 0},
+        {"blob moves 15 px", 30, 15, 0}
+    };
+
+    const int ITERATIONS = 20;
+
+    RNG rng(1);
+    bool allAgree = true;
+    double farnebackElapsed = 0.0, fixedElapsed = 0.0;
+
+    for (const FlowCase &flowCase : cases) {
+
+        Mat img, nextImg, flow;
+        generateFlowPair(rng, flowCase.blobRadius, flowCase.shift, flowCase.brightness, &img, &nextImg);
+
+        bool farnebackDecision = false, fixedDecision = false;
+
+        int64 startTime = getTickCount();
+        for (int i = 0; i < ITERATIONS; i++)
+            farnebackDecision = detectMotionWithFlow(DetectorFarneback, img, nextImg, flow, false);
+        farnebackElapsed += (getTickCount() - startTime) / getTickFrequency() / ITERATIONS;
+
+        startTime = getTickCount();
+        for (int i = 0; i < ITERATIONS; i++)
+            fixedDecision = detectMotionWithFlow(DetectorFixedFlow, img, nextImg, flow, false);
+        fixedElapsed += (getTickCount() - startTime) / getTickFrequency() / ITERATIONS;
+
+        allAgree &= farnebackDecision == fixedDecision;
+
+        print_log(ANDROID_LOG_INFO, FLOW_ENGINE_TAG, "%-22s farneback: %s, fixed-flow: %s%s", flowCase.name,
+                  farnebackDecision ? "motion" : "no motion", fixedDecision ? "motion" : "no motion",
+                  farnebackDecision == fixedDecision ? "" : " (disagree)");
+    }
+
+    int casesCount = sizeof(cases) / sizeof(cases[0]);
+
+    print_log(ANDROID_LOG_INFO, FLOW_ENGINE_TAG, "320x140 frame, farneback: %.3f ms, fixed-flow: %.3f ms (x%.2f)",
+              farnebackElapsed * 1000.0 / casesCount, fixedElapsed * 1000.0 / casesCount,
+              farnebackElapsed / fixedElapsed);
+
+    benchmark_dense_flow();
+    benchmark_find_motion_blobs();
+
+    return allAgree;
+}
@@ -0,0 +1,86 @@
+#ifndef PEOPLEWATCHER_FLOWDETECTORENGINE_H
+#define PEOPLEWATCHER_FLOWDETECTORENGINE_H
+
+#include <vector>
+
+#include <pthread.h>
+
+#include "DetectorEngine.h"
+#include "MotionTracker.h"
+
+// Dense optical flow (Farneback, DIS or own fixed point one) between consecutive frames,
+// calculated only around tiles that changed, during an event first only around tracked motion
+class FlowDetectorEngine : public DetectorEngine {
+public:
+    FlowDetectorEngine(const MotionDetectorConfig &config, int width, int height, const Mat &zoneMask);
+    ~FlowDetectorEngine(void);
+
+    FlowDetectorEngine(FlowDetectorEngine const&) = delete;
+    void operator=(FlowDetectorEngine const&)  = delete;
+private:
+    // first stage compares preprocessed frames tile by tile,
+    // tile is changed when mean absolute difference of its (contrast scaled) pixels exceeds the threshold
+    static const int TILE_SIZE = 16;
+    static const int TILE_CHANGE_THRESHOLD = 6;
+    // flow is calculated around changed tiles, margin covers blur kernel and flow window
+    static const int TILE_REGION_MARGIN = 16;
+
+    // warm started flow only refines the previous estimation, so it can look at smaller neighbourhood
+    static const int COLD_FLOW_WINDOW = 25;
+    static const int WARM_FLOW_WINDOW = 15;
+
+    // DIS presets compute flow at quarter resolution with 8x8 patches,
+    // smaller regions don't leave enough pyramid levels, so they are grown up to this size
+    static const int DIS_MIN_REGION_SIZE = 96;
+
+    // fixed point flow window is 13x13, it has neither pyramid nor initial flow
+    static const int FIXED_FLOW_RADIUS = 6;
+
+    MotionDetectorConfig config;
+
+    // tiles with at least one pixel detection looks at, empty if it looks everywhere
+    std::vector<uint8_t> zoneTiles;
+
+    // flow of the latest finished pair, initial flow of the following pair
+
+    pthread_mutex_t flowMutex;
+    Mat lastFlow;
+    std::vector<Rect> lastFlowRegions;
+    long long lastFlowSequenceNum;
+
+    MotionTracker tracker;
+
+    static void findChangedRegions(AVFrame *frame, AVFrame *nextFrame, const std::vector<uint8_t> &zoneTiles,
+                                   std::vector<Rect> *regions);
+
+    void blurRegion(const Mat &img, const Rect &region, Mat *blurred);
+    static Rect growRegion(const Rect &region, int minSize, const Size &frameSize);
+
+    static void calcFlow(DetectorEngineType algorithm, const Mat &img, const Mat &nextImg, Mat &flow, bool warmStart);
+    static void calcFixedFlowMask(const Mat &img, const Mat &nextImg, Mat &mask);
+    static bool detectMotionWithFlow(DetectorEngineType algorithm, const Mat &img, const Mat &nextImg, Mat &flow,
+                                     bool warmStart, std::vector<Rect> *blobs = NULL,
+                                     const Mat &regionZoneMask = Mat());
+    bool detectMotionInRegion(const Mat &img, const Mat &nextImg, const Rect &region, Mat &flow,
+                              const DetectionInput &input, std::vector<Rect> *blobs);
+    bool detectMotionInRegions(const std::vector<Rect> &regions, const Mat &img, const Mat &nextImg,
+                               const DetectionInput &input, std::vector<Rect> *flowRegions, Rect *motionBlob);
+
+    bool loadInitialFlow(long long sequenceNum, const Rect &region, Mat &regionFlow);
+    void storeFlow(long long sequenceNum, const Mat &flow, const std::vector<Rect> &regions);
+    void resetFlow(void);
+
+    bool usesInitialFlow(void) { return config.warmStartFlow && config.engine != DetectorFixedFlow; }
+public:
+    const char* getName(void) { return getTypeName(config.engine); }
+
+    bool detectMotion(const DetectionInput &input, Rect *motionBlob);
+    void reset(void);
+
+    // compares box blur with OpenCV gaussian it replaces and times both, false if out of tolerance
+    static bool benchmarkBlur(void);
+    // compares fixed point flow decisions with Farneback on generated pairs and times both, false if any differs
+    static bool benchmarkFlow(void);
+};
+
+#endif //PEOPLEWATCHER_FLOWDETECTORENGINE_H
@@ -0,0 +1,75 @@
+#include "FrameBudget.h"
+
+#include <stdexcept>
+
+#include "FramePool.h"
+
+FrameBudget::FrameBudget(void) : bytes(0), usedBytes(0), peakBytes(0) {
+}
+
+void FrameBudget::initialize(size_t bytes) {
+
+    this->bytes = bytes;
+}
+
+FrameLimits FrameBudget::getStreamLimits(size_t bytes, int width, int height, int maxScheduledDetections) {
+
+    FrameLimits limits = { };
+
+    // NV12 and I420 take the same space, detector downscales at most the whole frame
+    limits.frameBytes = (size_t) FramePool::getBufferSize(width, height, AV_PIX_FMT_NV12);
+    limits.grayBytes = (size_t) FramePool::getBufferSize(width / 2, height / 2, AV_PIX_FMT_GRAY8);
+
+    // frame waiting for its pair keeps its gray copy, a scheduled pair holds its frame and two gray ones
+    size_t inFlightBytes = IN_FLIGHT_FRAMES * limits.frameBytes + limits.grayBytes;
+    size_t scheduledBytes = limits.frameBytes + 2 * limits.grayBytes;
+    size_t shareBytes = (QUEUED_SHARE + WAITING_SHARE + ENCODER_SHARE) * limits.frameBytes +
+                        SCHEDULED_SHARE * scheduledBytes;
+
+    int shares = bytes > inFlightBytes ? (int) ((bytes - inFlightBytes) / shareBytes) : 0;
+
+    limits.queuedFrames = shares * QUEUED_SHARE;
+    limits.scheduledDetections = shares * SCHEDULED_SHARE;
+    limits.waitingFrames = shares * WAITING_SHARE;
+    limits.encoderFrames = shares * ENCODER_SHARE;
+
+    // pairs above what the detector can reorder go to the encoder queue
+    if (limits.scheduledDetections > maxScheduledDetections) {
+
+        size_t spareBytes = (limits.scheduledDetections - maxScheduledDetections) * scheduledBytes;
+
+        limits.scheduledDetections = maxScheduledDetections;
+        limits.encoderFrames += (int) (spareBytes / limits.frameBytes);
+    }
+
+    if (limits.queuedFrames < MIN_FRAMES || limits.scheduledDetections < MIN_FRAMES ||
+        limits.waitingFrames < MIN_FRAMES || limits.encoderFrames < MIN_FRAMES)
+        throw new std::runtime_error("Frame memory budget is too small for the stream resolution");
+
+    limits.poolFrames = limits.queuedFrames + limits.scheduledDetections + limits.waitingFrames +
+                        limits.encoderFrames + IN_FLIGHT_FRAMES;
+    limits.grayFrames = limits.scheduledDetections * 2 + 1;
+
+    return limits;
+}
+
+bool FrameBudget::reserve(size_t size) {
+
+    size_t used = usedBytes;
+
+    do {
+        if (used + size > bytes)
+            return false;
+    } while (!usedBytes.compare_exchange_weak(used, used + size));
+
+    size_t peak = peakBytes;
+
+    while (used + size > peak && !peakBytes.compare_exchange_weak(peak, used + size));
+
+    return true;
+}
+
+void FrameBudget::release(size_t size) {
+
+    usedBytes -= size;
+}
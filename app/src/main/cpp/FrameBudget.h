@@ -0,0 +1,63 @@
+#ifndef PEOPLEWATCHER_FRAMEBUDGET_H
+#define PEOPLEWATCHER_FRAMEBUDGET_H
+
+#include <atomic>
+#include <stddef.h>
+
+// raw frames one stream may hold at every point of its pipeline, gray frames are detector copies
+struct FrameLimits {
+    int queuedFrames;           // sent to the detector thread, not yet paired
+    int scheduledDetections;    // pairs in the detection pool or waiting for earlier results
+    int waitingFrames;          // detected frames waiting to learn whether motion follows them
+    int encoderFrames;          // queued to the encoder
+    int poolFrames;             // all of the above and frames in flight
+    int grayFrames;
+    size_t frameBytes, grayBytes;
+
+    size_t getBytes(void) const { return poolFrames * frameBytes + grayFrames * grayBytes; }
+};
+
+// Byte budget for frame memory. The engine budget is split into slices, one per stream, taken when the stream
+// is added and kept until it is deleted, so no stream can take memory of another. Every holding point of
+// a stream gets a fixed number of frames from its slice, so a higher resolution means fewer frames instead
+// of more memory, and every pooled buffer of the stream is charged to the slice when it is allocated.
+// When a holding point is full, frames waiting for motion are evicted oldest first, everywhere else
+// the newest frame is refused. Thread safe.
+class FrameBudget {
+public:
+    static const size_t DEFAULT_BYTES = 64 * 1024 * 1024;
+
+    FrameBudget(void);
+
+    FrameBudget(FrameBudget const&)     = delete;
+    void operator=(FrameBudget const&)  = delete;
+private:
+    // frame being converted, frame waiting for its pair and frames inside encoder filters
+    static const int IN_FLIGHT_FRAMES = 4;
+    // the rest is split in these shares, the encoder queue gets the most so motion survives encoder stalls
+    static const int QUEUED_SHARE = 1;
+    static const int SCHEDULED_SHARE = 1;
+    static const int WAITING_SHARE = 1;
+    static const int ENCODER_SHARE = 3;
+    // below this any holding point would stall the pipeline
+    static const int MIN_FRAMES = 2;
+
+    size_t bytes;
+    std::atomic<size_t> usedBytes, peakBytes;
+public:
+    void initialize(size_t bytes);
+
+    // limits of a stream of this size within a slice of bytes; throws if the slice can't hold it
+    static FrameLimits getStreamLimits(size_t bytes, int width, int height, int maxScheduledDetections);
+
+    // false if the allocation would go over the budget
+    bool reserve(size_t size);
+    void release(size_t size);
+
+    size_t getBytes(void) const { return bytes; }
+    size_t getUsedBytes(void) const { return usedBytes; }
+    size_t getFreeBytes(void) const { return bytes - usedBytes; }
+    size_t getPeakBytes(void) const { return peakBytes; }
+};
+
+#endif //PEOPLEWATCHER_FRAMEBUDGET_H
@@ -0,0 +1,120 @@
+#include "FramePool.h"
+
+#include <stdexcept>
+
+#include "EngineStats.h"
+
+extern "C" {
+#include "libavutil/imgutils.h"
+}
+
+#define FRAME_ALIGN 32
+
+FramePool::FramePool(int width, int height, AVPixelFormat format, int capacity, FrameBudget *budget) :
+    width(width), height(height), format(format), capacity(capacity), budget(budget),
+    requested(0), allocated(0), exhausted(0), overBudget(0) {
+
+    bufferSize = getBufferSize(width, height, format);
+    if (bufferSize < 0)
+        throw new std::runtime_error("Couldn't calculate frame buffer size");
+
+    pool = av_buffer_pool_init2(bufferSize, this, alloc_buffer, NULL);
+    if (pool == NULL)
+        throw new std::runtime_error("Couldn't allocate frame pool");
+}
+
+FramePool::~FramePool(void) {
+
+    // pool itself will be freed once all frames in flight are returned
+    av_buffer_pool_uninit(&pool);
+
+    // pools are deleted after their stream is finalized, nothing is in flight by then
+    if (budget != NULL)
+        budget->release((size_t) allocated * bufferSize);
+}
+
+int FramePool::getBufferSize(int width, int height, AVPixelFormat format) {
+
+    return av_image_get_buffer_size(format, width, height, FRAME_ALIGN);
+}
+
+AVBufferRef* FramePool::alloc_buffer(void *opaque, int size) {
+
+    FramePool *framePool = (FramePool*) opaque;
+
+    // called only when there is no free buffer in the pool, so this is the only place to enforce capacity
+    if (framePool->allocated.fetch_add(1) >= framePool->capacity) {
+
+        framePool->allocated--;
+        return NULL;
+    }
+
+    // pooled buffers are only freed with the pool, so they are charged once, here
+    if (framePool->budget != NULL && !framePool->budget->reserve((size_t) size)) {
+
+        framePool->allocated--;
+        framePool->overBudget++;
+
+        EngineStats::getInstance().countEvent(CounterFrameOverBudget);
+        return NULL;
+    }
+
+    AVBufferRef *buffer = av_buffer_alloc(size);
+    if (buffer == NULL) {
+
+        framePool->allocated--;
+
+        if (framePool->budget != NULL)
+            framePool->budget->release((size_t) size);
+    }
+
+    return buffer;
+}
+
+AVFrame* FramePool::getFrame(void) {
+
+    requested++;
+
+    AVBufferRef *buffer = av_buffer_pool_get(pool);
+    if (buffer == NULL) {
+
+        exhausted++;
+        return NULL;
+    }
+
+    AVFrame *frame = av_frame_alloc();
+    if (frame == NULL) {
+
+        av_buffer_unref(&buffer);
+        throw new std::runtime_error("Couldn't allocate frame");
+    }
+
+    frame->width = width;
+    frame->height = height;
+    frame->format = format;
+    frame->buf[0] = buffer;
+
+    int ret = av_image_fill_arrays(frame->data, frame->linesize, buffer->data, format, width, height,
+                                   FRAME_ALIGN);
+    if (ret < 0) {
+
+        av_frame_free(&frame);
+        throw new std::runtime_error("Couldn't setup pooled frame");
+    }
+
+    frame->extended_data = frame->data;
+
+    return frame;
+}
+
+FramePoolStats FramePool::getStats(void) {
+
+    FramePoolStats stats = { };
+
+    stats.misses = allocated;
+    stats.exhausted = exhausted;
+    stats.overBudget = overBudget;
+    stats.hits = requested - stats.misses - stats.exhausted;
+
+    return stats;
+}
@@ -0,0 +1,58 @@
+#ifndef PEOPLEWATCHER_FRAMEPOOL_H
+#define PEOPLEWATCHER_FRAMEPOOL_H
+
+#include <atomic>
+
+#include "FrameBudget.h"
+
+extern "C" {
+#include "libavutil/frame.h"
+#include "libavutil/buffer.h"
+#include "libavutil/pixfmt.h"
+}
+
+struct FramePoolStats {
+    long long hits;       // frame was served from recycled buffer
+    long long misses;     // new buffer had to be allocated
+    long long exhausted;  // capacity or frame budget was reached, no frame returned
+    long long overBudget; // part of exhausted refused by the frame budget
+};
+
+// Fixed capacity pool of refcounted frames of a single geometry.
+// Frames are freed with av_frame_free as usual, their buffer returns to the pool
+// when the last reference to it drops. Buffers are charged to the frame budget, if any, while the pool lives.
+// Thread safe.
+class FramePool {
+public:
+    FramePool(int width, int height, AVPixelFormat format, int capacity, FrameBudget *budget);
+    ~FramePool(void);
+
+    FramePool(FramePool const&)       = delete;
+    void operator=(FramePool const&)  = delete;
+private:
+    int width, height;
+    AVPixelFormat format;
+    int capacity;
+
+    int bufferSize;
+
+    AVBufferPool *pool;
+    FrameBudget *budget;
+
+    std::atomic<long long> requested, allocated, exhausted, overBudget;
+
+    static AVBufferRef* alloc_buffer(void *opaque, int size);
+public:
+    // returns NULL if all buffers are in use
+    AVFrame* getFrame(void);
+
+    FramePoolStats getStats(void);
+
+    static int getBufferSize(int width, int height, AVPixelFormat format);
+
+    int getWidth(void) const { return width; }
+    int getHeight(void) const { return height; }
+    AVPixelFormat getFormat(void) const { return format; }
+};
+
+#endif //PEOPLEWATCHER_FRAMEPOOL_H
@@ -0,0 +1,54 @@
+#include "FrameRing.h"
+
+#include "exceptionUtils.h"
+
+FrameRing::FrameRing(void) : frames(NULL), capacity(0), head(0), count(0) {
+}
+
+FrameRing::~FrameRing(void) {
+
+    clear();
+
+    delete[] frames;
+}
+
+void FrameRing::initialize(int capacity) {
+
+    clear();
+
+    delete[] frames;
+
+    this->frames = new AVFrame*[capacity];
+    this->capacity = capacity;
+}
+
+void FrameRing::push(AVFrame *frame) {
+
+    my_assert(count < capacity);
+
+    frames[(head + count) % capacity] = frame;
+    count++;
+}
+
+AVFrame* FrameRing::pop(void) {
+
+    my_assert(count > 0);
+
+    AVFrame *frame = frames[head];
+
+    head = (head + 1) % capacity;
+    count--;
+
+    return frame;
+}
+
+void FrameRing::clear(void) {
+
+    while (count > 0) {
+
+        AVFrame *frame = pop();
+        av_frame_free(&frame);
+    }
+
+    head = 0;
+}
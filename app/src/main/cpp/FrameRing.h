@@ -0,0 +1,38 @@
+#ifndef PEOPLEWATCHER_FRAMERING_H
+#define PEOPLEWATCHER_FRAMERING_H
+
+extern "C" {
+#include "libavutil/frame.h"
+}
+
+// Fixed capacity FIFO of frames, slots are allocated once. Frames left inside are freed with the ring.
+// Not thread safe.
+class FrameRing {
+public:
+    FrameRing(void);
+    ~FrameRing(void);
+
+    FrameRing(FrameRing const&)       = delete;
+    void operator=(FrameRing const&)  = delete;
+private:
+    AVFrame **frames;
+    int capacity;
+    int head, count;
+public:
+    void initialize(int capacity);
+
+    bool isEmpty(void) const { return count == 0; }
+    bool isFull(void) const { return count == capacity; }
+    int size(void) const { return count; }
+
+    AVFrame* front(void) const { return frames[head]; }
+    AVFrame* back(void) const { return frames[(head + count - 1) % capacity]; }
+
+    // ring must not be full, callers decide what to evict
+    void push(AVFrame *frame);
+    AVFrame* pop(void);
+
+    void clear(void);
+};
+
+#endif //PEOPLEWATCHER_FRAMERING_H
@@ -1,7 +1,13 @@
 #include "MotionDetector.h"
 
+#include <cstdlib>
+
 #include "log.h"
 #include "exceptionUtils.h"
+#include "EngineStats.h"
+#include "FFmpegUtils.h"
+
+#include "opencv2/core.hpp"
 
 extern "C" {
 #include "imageUtils.h"
@@ -9,40 +15,97 @@ extern "C" {
 
 #define MOTION_DETECTOR_TAG "PW_MOTION_DETECTOR"
 
-#define FRAME_BUFFER_SIZE (20 * 1) // 20 fps for 3 seconds (~29 MB buffer)
-#define MAX_SCHEDULED_DETECTIONS (FRAME_BUFFER_SIZE / 2)
-#define THREADS_IN_THREAD_POOL 3
-
-MotionDetector::MotionDetector(void) : pendingOperations(FRAME_BUFFER_SIZE,
-                                                         // one for Java frames send thread
-                                                         1 + THREADS_IN_THREAD_POOL,
-                                                         1 + THREADS_IN_THREAD_POOL) {
+MotionDetector::MotionDetector(void) : inputX(0), inputY(0), inputWidth(0), inputHeight(0),
+                                       downscaleWidth(0), downscaleHeight(0), initialized(0),
+                                       callback(NULL), callbackOpaque(NULL), pool(NULL), placement(NULL),
+                                       grayFramePool(NULL),
+                                       engine(NULL), classifier(NULL), droppedFrames(0), draining(false),
+                                       currentSequenceNum(0), nextSequenceNum(0),
+                                       maxScheduledDetections(0), maxQueuedFrames(0), lastDetectedMotionPts(0),
+                                       lastPersonPts(0), queuedFrames(0),
+                                       frame(NULL), framePreprocessed(),
+                                       frameFollowsPreviousRequest(false), frameDroppedAfterFrame(false),
+                                       lastDroppedFrames(0),
+                                       lastFrameTime(0), batchHead(NULL), batchTail(NULL), batchSize(0),
+                                       lastScheduledDetectionPts(0),
+                                       lastMotionTime(0), lastFrameWithMotionTime(0) {
+
+    for (int i = 0; i < REORDER_RING_SIZE; i++)
+        reorderRing[i] = NULL;
 }
 
-void MotionDetector::initialize(const char *rootDir, MotionDetectorCallback callback) {
+void MotionDetector::initialize(int width, int height, const MotionDetectorConfig &config,
+                                const FrameLimits &limits, FrameBudget *frameBudget, DetectionPool *pool,
+                                const ThreadPlacement *placement, const PersonClassifier *classifier,
+                                MotionDetectorCallback callback, void *callbackOpaque) {
 
     if (this->initialized)
         return;
 
-    this->rootDir = std::string(rootDir);
+    if (config.blurSigma < BOX_BLUR_MIN_SIGMA || config.blurSigma > BOX_BLUR_MAX_SIGMA ||
+        config.maxDetectionBatch < 1 || config.maxDetectionBatch > MAX_DETECTION_BATCH)
+        throw new std::runtime_error("Invalid motion detector configuration");
+
+    if (limits.scheduledDetections > MAX_SCHEDULED_DETECTIONS)
+        throw new std::runtime_error("Too many scheduled detections for the reorder ring");
+
+    // zones are rasterized once, rows and columns around them are never preprocessed
+    Mat zoneMask;
+    Rect box = DetectorEngine::rasterizeZones(config.zones, width, height, &zoneMask);
+
+    if (box.area() == 0)
+        throw new std::runtime_error("Detection zones exclude the whole frame");
+
+    this->config = config;
+    this->inputX = box.x;
+    this->inputY = box.y;
+    this->inputWidth = box.width;
+    this->inputHeight = box.height;
+    this->downscaleWidth = inputWidth / 2;
+    this->downscaleHeight = inputHeight / 2;
 
     this->callback = callback;
+    this->callbackOpaque = callbackOpaque;
+
+    this->maxScheduledDetections = limits.scheduledDetections;
+    this->maxQueuedFrames = limits.queuedFrames;
+
+    // frames sent by Java frames send thread, results don't go through it
+    pendingOperations = BlockingConcurrentQueue<DetectorOperation>((size_t) maxQueuedFrames, 1, 1);
+
+    waitingFrames.initialize(limits.waitingFrames);
+
+    // each scheduled request holds two preprocessed frames (neighbours share one if both are in flight)
+    // plus the one waiting for its pair
+    grayFramePool = new FramePool(downscaleWidth, downscaleHeight, AV_PIX_FMT_GRAY8, limits.grayFrames,
+                                  frameBudget);
 
-    pool = thpool_init(THREADS_IN_THREAD_POOL);
-    if (pool == NULL)
-        throw new std::runtime_error("Couldn't allocate thread pool");
+    engine = DetectorEngine::create(config, downscaleWidth, downscaleHeight, zoneMask);
+
+    this->classifier = config.classifyPeople ? classifier : NULL;
+
+    print_log(ANDROID_LOG_INFO, MOTION_DETECTOR_TAG, "Detection box %dx%d at %d,%d, %s", inputWidth, inputHeight,
+              inputX, inputY, zoneMask.empty() ? "no exclusions inside" : "exclusions inside");
+
+    this->pool = pool;
+    this->placement = placement;
 
     pthread_check_error(pthread_mutex_init(&mutex, NULL));
     pthread_check_error(pthread_cond_init(&cond, NULL));
 
-    pthread_check_error(pthread_create(&thread, NULL, thread_entrypoint, NULL));
+    pthread_check_error(pthread_create(&thread, NULL, thread_entrypoint, this));
 
     this->initialized = 1;
 }
 
 bool MotionDetector::canAcceptFrame(void) {
 
-    return scheduledCount < MAX_SCHEDULED_DETECTIONS;
+    return nextSequenceNum - currentSequenceNum < maxScheduledDetections;
+}
+
+double MotionDetector::getLoad(void) {
+
+    return (double) (nextSequenceNum - currentSequenceNum) / maxScheduledDetections;
 }
 
 // send frame directly to the thread pool
@@ -51,18 +114,46 @@ void MotionDetector::sendFrame(AVFrame* yuvFrame) {
     DetectorOperation operation = { };
     operation.operationType = FrameSent;
     operation.frame = yuvFrame;
+    operation.droppedFrames = droppedFrames;
+
+    // only this thread sends frames, so the count can't pass the limit between the check and the increment
+    bool queued = false;
+
+    if (queuedFrames < maxQueuedFrames) {
 
-    if (!pendingOperations.try_enqueue(operation)) {
+        queuedFrames++;
+
+        queued = pendingOperations.try_enqueue(operation);
+        if (!queued)
+            queuedFrames--;
+    }
+
+    if (!queued) {
 
         print_log(ANDROID_LOG_WARN, MOTION_DETECTOR_TAG, "Frame drop at sendFrame");
 
+        EngineStats::getInstance().countDrop(DropAtSendFrame);
+
+        frameDropped();
+
         av_frame_free(&yuvFrame);
     }
 }
 
+void MotionDetector::frameDropped(void) {
+
+    droppedFrames++;
+}
+
+void MotionDetector::waitForScheduledDetections(void) {
+
+    // pool is shared with other streams, so wait only for our own tasks
+    scheduledTasks.waitForQuiescence();
+}
+
 void MotionDetector::flush(void) {
 
-    thpool_wait(pool);
+    waitForScheduledDetections();
 
     print_log(ANDROID_LOG_DEBUG, MOTION_DETECTOR_TAG, "flush: wait reset enter");
 
@@ -86,7 +177,7 @@ void MotionDetector::terminate(void) {
 
     flush();
 
-    thpool_destroy(pool);
+    // pool is owned by the engine
     pool = NULL;
 
     DetectorOperation operation = { };
@@ -95,11 +186,26 @@ void MotionDetector::terminate(void) {
     pendingOperations.enqueue(operation);
 
     pthread_check_error(pthread_join(thread, NULL));
+
+    delete engine;
+    engine = NULL;
+
+    pthread_check_error(pthread_cond_destroy(&cond));
+    pthread_check_error(pthread_mutex_destroy(&mutex));
+
+    FramePoolStats stats = grayFramePool->getStats();
+
+    print_log(ANDROID_LOG_INFO, MOTION_DETECTOR_TAG,
+              "Gray frame pool: %lld hits, %lld misses, %lld exhausted (%lld over budget)",
+              stats.hits, stats.misses, stats.exhausted, stats.overBudget);
+
+    delete grayFramePool;
+    grayFramePool = NULL;
 }
 
 // processing
 
-void MotionDetector::addFrameToRequests(AVFrame *yuvFrame) {
+void MotionDetector::addFrameToRequests(AVFrame *yuvFrame, long long droppedFrames) {
 
     my_assert(yuvFrame->opaque == NULL);
 
@@ -121,95 +227,224 @@ void MotionDetector::addFrameToRequests(AVFrame *yuvFrame) {
 
         print_log(ANDROID_LOG_ERROR, MOTION_DETECTOR_TAG, "sendFrame call after finalization");
 
+        frameDroppedAfterFrame = true;
+
         av_frame_free(&yuvFrame);
         return;
     }
 
-    if (scheduledCount >= MAX_SCHEDULED_DETECTIONS) {
+    // finished requests that wait for an earlier one count too, they hold their frames and ring slots
+    if (nextSequenceNum - currentSequenceNum >= maxScheduledDetections) {
 
         print_log(ANDROID_LOG_WARN, MOTION_DETECTOR_TAG, "Frame drop at schedule");
 
+        EngineStats::getInstance().countDrop(DropAtSchedule);
+
+        frameDroppedAfterFrame = true;
+
         av_frame_free(&yuvFrame);
         return;
     }
 
-    // we need three frames in order to perform motion detection
+    // every frame is preprocessed once, here, and compared both with the previous and the next frame
+
+    PreprocessedFrame preprocessed;
+
+    if (!preprocessFrame(yuvFrame, &preprocessed)) {
+
+        print_log(ANDROID_LOG_WARN, MOTION_DETECTOR_TAG, "Frame drop at gray frame pool");
 
-    if (this->prevFrame == NULL) {
+        EngineStats::getInstance().countDrop(DropAtFramePool);
 
-        this->prevFrame = yuvFrame;
+        frameDroppedAfterFrame = true;
+
+        av_frame_free(&yuvFrame);
         return;
     }
 
+    // pair is consecutive only if nothing was dropped between its frames, either here or before sendFrame
+    bool consecutive = !frameDroppedAfterFrame && droppedFrames == lastDroppedFrames;
+
+    frameDroppedAfterFrame = false;
+    lastDroppedFrames = droppedFrames;
+
     if (this->frame == NULL) {
 
         this->frame = yuvFrame;
+        this->framePreprocessed = preprocessed;
+        this->frameFollowsPreviousRequest = false;
         return;
     }
 
+    bool detect = shouldDetect(this->frame->pts);
+
+    // batch has to end with the latest sequence number, a refused batch gives its numbers back
+    if (!detect)
+        submitBatch();
+
     DetectionRequest *request = new DetectionRequest();
-    request->prevFrame = this->prevFrame;
+    request->detector = this;
     request->frame = this->frame;
-    request->nextFrame = yuvFrame;
+    request->preprocessed = this->framePreprocessed;
+    request->nextPreprocessed = preprocessed;
+    request->nextPreprocessed.gray = av_frame_clone(preprocessed.gray);
     request->sequenceNum = nextSequenceNum;
+    request->followsPreviousRequest = this->frameFollowsPreviousRequest && consecutive;
 
-    this->prevFrame = NULL;
-    this->frame = NULL;
+    this->frame = yuvFrame;
+    this->framePreprocessed = preprocessed;
+    this->frameFollowsPreviousRequest = consecutive;
 
-    scheduledCount++;
+    if (request->nextPreprocessed.gray == NULL) {
+        free_detection_request(&request);
+        throw new std::runtime_error("Couldn't reference gray frame");
+    }
 
-    print_log(ANDROID_LOG_DEBUG, MOTION_DETECTOR_TAG, "added task to thread pool, scheduled: %d",
-              (int) scheduledCount);
+    // sequence number is taken now, submitBatch gives it back if the pool refuses the batch
+    nextSequenceNum++;
 
-    int ret = thpool_add_work(this->pool, pool_worker, (void*) request);
-    if (ret != 0) {
+    if (!detect) {
 
-        print_log(ANDROID_LOG_WARN, MOTION_DETECTOR_TAG, "Frame drop at thread pool");
+        skipDetection(request);
+        return;
+    }
 
-        // delete request and do rollback
+    EngineStats::getInstance().countEvent(CounterDetectionRun);
 
-        free_detection_request(&request);
+    lastScheduledDetectionPts = request->frame->pts;
 
-        scheduledCount--;
+    if (batchTail != NULL)
+        batchTail->nextInBatch = request;
+    else
+        batchHead = request;
 
-        return;
+    batchTail = request;
+    batchSize++;
+}
+
+bool MotionDetector::shouldDetect(long long framePts) {
+
+    if (!config.adaptiveRate)
+        return true;
+
+    long long motionPts = lastDetectedMotionPts;
+
+    if (motionPts != 0) {
+
+        // frames are recorded because of that motion anyway, the pair halfway to its end extends it if it goes on
+        if (framePts < motionPts + MOTION_PROPAGATION_TIME / 2) {
+
+            EngineStats::getInstance().countEvent(CounterDetectionSkippedCovered);
+            return false;
+        }
+
+        if (framePts < motionPts + ACTIVE_DETECTION_TIME)
+            return true;
     }
 
-    nextSequenceNum++;
+    if (lastScheduledDetectionPts == 0 || framePts - lastScheduledDetectionPts >= IDLE_DETECTION_PERIOD)
+        return true;
+
+    EngineStats::getInstance().countEvent(CounterDetectionSkippedIdle);
+    return false;
+}
+
+// skipped pair goes to the reorder ring without motion right away, so its frame keeps its place in the stream
+void MotionDetector::skipDetection(DetectionRequest *request) {
+
+    request->haveMotion = false;
+
+    av_frame_free(&request->nextPreprocessed.gray);
+    av_frame_free(&request->preprocessed.gray);
+
+    reorderRing[request->sequenceNum % REORDER_RING_SIZE] = request;
+
+    drainDetectedMotion();
+}
+
+// pairs per task: one while workers have room, more once every worker has several of our pairs to do
+int MotionDetector::getBatchLimit(void) {
+
+    int backlog = (int) (nextSequenceNum - currentSequenceNum);
+    int limit = backlog / pool->getActiveThreads();
+
+    if (limit > config.maxDetectionBatch)
+        limit = config.maxDetectionBatch;
+
+    return limit > 1 ? limit : 1;
 }
 
-void MotionDetector::processDetectedMotion(DetectionRequest *request) {
+void MotionDetector::submitBatch(void) {
 
-    // enforce sequentiality for all requests
+    DetectionRequest *batch = batchHead;
+    int size = batchSize;
 
-    std::vector<DetectionRequest*>::iterator insertion_point;
+    batchHead = NULL;
+    batchTail = NULL;
+    batchSize = 0;
 
-    insertion_point = std::lower_bound(sequentialOperations.begin(), sequentialOperations.end(), request, request_comparer);
+    if (batch == NULL)
+        return;
 
-    sequentialOperations.insert(insertion_point, request);
+    if (!pool->submit(&scheduledTasks, pool_worker, (void*) batch)) {
 
-    std::vector<DetectionRequest*>::iterator it = sequentialOperations.begin();
-    for( ; it != sequentialOperations.end();)
-    {
-        DetectionRequest* currentRequest = *it;
+        print_log(ANDROID_LOG_WARN, MOTION_DETECTOR_TAG, "Frame drop at thread pool (%d frames)", size);
 
-        if (currentRequest->sequenceNum == currentSequenceNum) {
+        // delete requests and do rollback, nothing was scheduled after them
 
-            it = sequentialOperations.erase(it);
+        my_assert(batch->sequenceNum == nextSequenceNum - size);
 
-            currentSequenceNum++;
+        while (batch != NULL) {
 
-            processFrame(currentRequest->prevFrame, false);
-            processFrame(currentRequest->frame, currentRequest->haveMotion);
-            processFrame(currentRequest->nextFrame, false);
+            DetectionRequest *next = batch->nextInBatch;
 
-            currentRequest->prevFrame = NULL;
-            currentRequest->frame = NULL;
-            currentRequest->nextFrame = NULL;
+            EngineStats::getInstance().countDrop(DropAtThreadPool);
+            free_detection_request(&batch);
 
-            free_detection_request(&currentRequest);
+            batch = next;
         }
-        else
+
+        nextSequenceNum -= size;
+
+        frameFollowsPreviousRequest = false;
+
+        return;
+    }
+
+    for (int i = 1; i < size; i++)
+        EngineStats::getInstance().countEvent(CounterBatchedPair);
+
+    print_log(ANDROID_LOG_DEBUG, MOTION_DETECTOR_TAG, "added task of %d pairs to thread pool, scheduled: %d",
+              size, scheduledTasks.getPending());
+}
+
+// passes finished requests to processFrame in sequence order, called by workers after they publish a result
+void MotionDetector::drainDetectedMotion(void) {
+
+    // only one thread drains at a time, the others leave their results to it
+    while (!draining.exchange(true)) {
+
+        long long sequenceNum = currentSequenceNum;
+        DetectionRequest *request;
+
+        while ((request = reorderRing[sequenceNum % REORDER_RING_SIZE].exchange(NULL)) != NULL) {
+
+            my_assert(request->sequenceNum == sequenceNum);
+
+            currentSequenceNum = ++sequenceNum;
+
+            processFrame(request->frame, request->haveMotion);
+
+            request->frame = NULL;
+
+            free_detection_request(&request);
+        }
+
+        draining = false;
+
+        // next result may have been published after we looked at its slot and before we left,
+        // its worker saw us draining and left it to us
+        if (reorderRing[sequenceNum % REORDER_RING_SIZE] == NULL)
             break;
     }
 }
@@ -230,19 +465,19 @@ void MotionDetector::correctTimestamp(AVFrame *frame) {
 
 void MotionDetector::processFrame(AVFrame *frame, bool haveMotion) {
 
-    if (!bufferedFrames.empty()) {
+    if (!waitingFrames.isEmpty()) {
 
-        AVFrame* prevFrame = bufferedFrames.back();
+        AVFrame* prevFrame = waitingFrames.back();
 
         long long currentTime = prevFrame->pts;
 
-        while (!bufferedFrames.empty()) {
+        while (!waitingFrames.isEmpty()) {
 
-            AVFrame* latestFrame = bufferedFrames.front();
+            AVFrame* latestFrame = waitingFrames.front();
 
             long long latestTime = latestFrame->pts;
 
-            bool tooManyFramesBuffered = bufferedFrames.size() >= FRAME_BUFFER_SIZE;
+            bool tooManyFramesBuffered = waitingFrames.isFull();
             bool frameExpired = latestTime + MOTION_PROPAGATION_TIME < currentTime;
 
             bool frameHavePropagatedMotion = lastMotionTime + MOTION_PROPAGATION_TIME >= latestTime;
@@ -250,16 +485,24 @@ void MotionDetector::processFrame(AVFrame *frame, bool haveMotion) {
 
             if (frameHaveMotion || frameExpired || tooManyFramesBuffered) {
 
-                bufferedFrames.pop();
+                waitingFrames.pop();
+
+                if (!frameHaveMotion && !frameExpired)
+                    EngineStats::getInstance().countEvent(CounterFrameEvicted);
 
                 if (frameHaveMotion && callback != NULL) {
 
                     long long realTimeTimestamp = latestFrame->pts;
-                    correctTimestamp(latestFrame);
+
+                    // encoder cuts the time without motion out of the record itself
+                    if (!config.forwardAllFrames)
+                        correctTimestamp(latestFrame);
 
                     print_log(ANDROID_LOG_DEBUG, MOTION_DETECTOR_TAG, "frame with motion send to callback");
-                    callback(latestFrame, realTimeTimestamp);
+                    callback(callbackOpaque, latestFrame, realTimeTimestamp, true);
                 }
+                else if (config.forwardAllFrames && callback != NULL)
+                    callback(callbackOpaque, latestFrame, latestFrame->pts, false);
                 else
                     av_frame_free(&latestFrame);
             } else
@@ -270,198 +513,152 @@ void MotionDetector::processFrame(AVFrame *frame, bool haveMotion) {
             lastMotionTime = currentTime;
     }
 
-    bufferedFrames.push(frame);
+    waitingFrames.push(frame);
 }
 
-static thread_local SwsContext* tls_downscaler;
-
-AVFrame* MotionDetector::generateGrayDownscaleCrop(AVFrame *yuvFrame) {
-
-    int ret;
+// crop, downscale, contrast and luminance in one pass over Y plane
+bool MotionDetector::preprocessFrame(AVFrame *yuvFrame, PreprocessedFrame *preprocessed) {
 
-    AVFrame *downscale = av_frame_alloc();
-    downscale->width = DOWNSCALE_WIDTH;
-    downscale->height = DOWNSCALE_HEIGHT;
-    downscale->format = AV_PIX_FMT_GRAY8;
-
-    ret = av_frame_get_buffer(downscale, 32);
-    if (ret < 0) {
-        av_frame_free(&downscale);
-        av_check_error(ret);
-        return NULL;
-    }
+    AVFrame *gray = grayFramePool->getFrame();
+    if (gray == NULL)
+        return false;
 
-    // crop few top rows by ourselves, because I couldn't get swscale to do the same
-    // don't actually know what srcSliceY mean, but it's not cropping rows that's for sure
-    const uint8_t *data[AV_NUM_DATA_POINTERS] = { yuvFrame->data[0] + OFFSET_Y * yuvFrame->linesize[0] };
-    int linesize[AV_NUM_DATA_POINTERS] = { yuvFrame->linesize[0] };
+    preprocessed->gray = gray;
+    preprocessed->luminanceSum = downscale_gray_with_contrast(yuvFrame->data[0] + inputY * yuvFrame->linesize[0] + inputX,
+                                                              yuvFrame->linesize[0], gray->data[0],
+                                                              gray->linesize[0], downscaleWidth, downscaleHeight);
 
-    SwsContext *downscaler = tls_downscaler;
-
-    if (downscaler == NULL) {
-        downscaler = sws_getContext(INPUT_WIDTH, INPUT_HEIGHT, AV_PIX_FMT_GRAY8,
-                                    DOWNSCALE_WIDTH, DOWNSCALE_HEIGHT, AV_PIX_FMT_GRAY8, SWS_AREA,
-                                    NULL, NULL, NULL);
-        if (downscaler == NULL)
-            throw new std::runtime_error("Couldn't allocate downscaler");
-
-        tls_downscaler = downscaler;
-    }
-
-    ret = sws_scale(downscaler, data, linesize, 0, yuvFrame->height - OFFSET_Y, downscale->data, downscale->linesize);
-    if (ret < 0) {
-        av_frame_free(&downscale);
-        av_check_error(ret);
-        return NULL;
-    }
-
-    return downscale;
+    return true;
 }
 
-void MotionDetector::convertFlowToImage(Mat* flow, Mat* image, double minLen) {
-
-    double minLenSq = minLen * minLen;
-
-    int width = flow->cols;
-    int height = flow->rows;
+bool MotionDetector::detectMotion(DetectionRequest *request) {
 
-    *image = Mat(height, width, CV_8UC1);
+    int64 startTime = getTickCount();
 
-    for (int y = 0; y < height; y++) {
+    bool haveMovement = false;
 
-        uchar *pixelRow = image->ptr<uchar>(y);
-        Point2f *flowRow = flow->ptr<Point2f>(y);
+    AVFrame *frame = request->preprocessed.gray;
 
-        for (int x = 0; x < width; x++) {
+    // mean luminance of the original frame above 100, preprocessed pixels are scaled by 0.75
+    uint64_t luminance = request->preprocessed.luminanceSum / (uint64_t) (frame->width * frame->height);
+    if (luminance > 75) {
 
-            Point2f v = flowRow[x];
+        DetectionInput input;
+        input.frame = &request->preprocessed;
+        input.nextFrame = &request->nextPreprocessed;
+        input.sequenceNum = request->sequenceNum;
+        input.followsPreviousInput = request->followsPreviousRequest;
 
-            double lenSq = v.dot(v);
+        Rect motionBlob;
+        haveMovement = engine->detectMotion(input, &motionBlob);
 
-            pixelRow[x] = (uchar) (lenSq < minLenSq ?  0 : 255);
-        }
+        // second stage only runs on pairs with motion, which are rare while nothing happens
+        if (haveMovement && classifier != NULL)
+            haveMovement = confirmPerson(request, motionBlob);
     }
-}
-
-uint8_t MotionDetector::getGrayscaleMeanLuminace(AVFrame *frame) {
-
-    unsigned long int sum = 0;
-
-    int width = frame->width;
-    int height = frame->height;
 
-    uchar *pixels = frame->data[0];
-
-    for (int y = 0; y < height; y++) {
-
-        uchar *pixelRow = pixels;
+    int64 endTime = getTickCount();
 
-        for (int x = 0; x < width; x++) {
+    double elapsed = (endTime - startTime) / getTickFrequency();
 
-            sum += *pixelRow;
-            pixelRow++;
-        }
+    EngineStats::getInstance().addLatency(StageDetection, elapsed);
 
-        pixels += frame->linesize[0];
-    }
+    print_log(ANDROID_LOG_DEBUG, MOTION_DETECTOR_TAG, "Motion detection took %d ms", (int) (elapsed * 1000.0));
 
-    return (uint8_t) (sum / (width * height));
+    return haveMovement;
 }
 
-bool MotionDetector::detectMotion(AVFrame *frame, AVFrame *nextFrame) {
-
-    int64 startTime = getTickCount();
-
-    bool haveMovement = false;
-
-    uint8_t luminance = getGrayscaleMeanLuminace(frame);
-    if (luminance > 100) {
+// crops motion from the full resolution frame, so the classifier sees more detail than flow did
+bool MotionDetector::confirmPerson(DetectionRequest *request, const Rect &motionBlob) {
 
-        Mat img(frame->height, frame->width, CV_8UC1, frame->data[0],
-                (size_t) frame->linesize[0]);
-        Mat nextImg(nextFrame->height, nextFrame->width, CV_8UC1, nextFrame->data[0],
-                    (size_t) nextFrame->linesize[0]);
+    EngineStats &stats = EngineStats::getInstance();
 
-        Mat flow;
+    AVFrame *frame = request->frame;
+    long long personPts = lastPersonPts;
 
-        img.convertTo(img, -1, 0.75, 0.0);
-        nextImg.convertTo(nextImg, -1, 0.75, 0.0);
+    // a person doesn't vanish between neighbouring pairs, which may also finish in any order
+    if (personPts != 0 && std::llabs(frame->pts - personPts) < PERSON_CONFIRMATION_TIME) {
 
-        GaussianBlur(img, img, Size(21, 21), 0.0);
-        GaussianBlur(nextImg, nextImg, Size(21, 21), 0.0);
-
-        calcOpticalFlowFarneback(img, nextImg, flow, 0.5, 1, 25, 1, 5, 1.1, 0);
+        stats.countEvent(CounterPersonRecent);
+        return true;
+    }
 
-        Mat flowImg;
-        convertFlowToImage(&flow, &flowImg, 0.1);
+    int64 startTime = getTickCount();
 
-        // dilate(flowImg, flowImg, Mat(), Point(-1, -1), 3);
+    // blob is in downscaled pixels of the detection box
+    Rect box(inputX + motionBlob.x * 2, inputY + motionBlob.y * 2, motionBlob.width * 2, motionBlob.height * 2);
 
-        std::vector<std::vector<Point>> contours;
-        findContours(flowImg, contours, RETR_EXTERNAL, CHAIN_APPROX_SIMPLE);
+    bool havePerson = classifier->classify(frame->data[0], frame->linesize[0], frame->width, frame->height, box);
 
-        // loop over the contours
-        for (std::vector<Point> contour : contours) {
+    stats.addLatency(StageClassification, (getTickCount() - startTime) / getTickFrequency());
+    stats.countEvent(havePerson ? CounterPersonConfirmed : CounterPersonRejected);
 
-            if (contourArea(contour) >= 20 * 20) {
-                haveMovement = true;
-                break;
-            }
-        }
+    if (havePerson) {
+        while (frame->pts > personPts && !lastPersonPts.compare_exchange_weak(personPts, frame->pts));
     }
 
-    int64 endTime = getTickCount();
-
-    double elapsed = (endTime - startTime) / getTickFrequency();
-
-    print_log(ANDROID_LOG_DEBUG, MOTION_DETECTOR_TAG, "Motion detection took %d ms", (int) (elapsed * 1000.0));
-
-    return haveMovement;
+    return havePerson;
 }
 
 void MotionDetector::pool_worker(void* opaque) {
 
     DetectionRequest *request = (DetectionRequest*) opaque;
 
-    MotionDetector::getInstance().PoolWorker(request);
+    request->detector->PoolWorker(request);
 }
 
-void MotionDetector::PoolWorker(DetectionRequest *request) {
+void MotionDetector::PoolWorker(DetectionRequest *batch) {
 
-    AVFrame *gray, *grayNext;
+    // pairs of a batch follow each other, so flow of the previous one is ready to warm start from
+    // and its first frame is still in cache as the second frame of the previous pair
+    for (DetectionRequest *request = batch; request != NULL; request = request->nextInBatch) {
 
-    gray = generateGrayDownscaleCrop(request->frame);
-    grayNext = generateGrayDownscaleCrop(request->nextFrame);
+        request->haveMotion = detectMotion(request);
 
-    request->haveMotion = detectMotion(gray, grayNext);
+        // raises the detection rate of the stream for the frames scheduled from now on
+        if (request->haveMotion) {
 
-    av_frame_free(&grayNext);
-    av_frame_free(&gray);
+            long long motionPts = lastDetectedMotionPts;
+            while (request->frame->pts > motionPts &&
+                   !lastDetectedMotionPts.compare_exchange_weak(motionPts, request->frame->pts));
+        }
 
-    this->scheduledCount--;
+        // gray buffers go back to the pool right away, result may wait for earlier requests
+        av_frame_free(&request->nextPreprocessed.gray);
+        av_frame_free(&request->preprocessed.gray);
+    }
 
-    DetectorOperation operation = { };
-    operation.operationType = MotionDetected;
-    operation.request = request;
+    // whole batch is published before draining, so one drain passes all of it
+    while (batch != NULL) {
 
-    if (!pendingOperations.try_enqueue(operation)) {
+        // published request may be drained and freed by another worker at once
+        DetectionRequest *next = batch->nextInBatch;
+        batch->nextInBatch = NULL;
 
-        print_log(ANDROID_LOG_WARN, MOTION_DETECTOR_TAG, "Frame drop after motion detection");
+        // slot is free, sequence numbers that aren't drained yet span less than the ring
+        reorderRing[batch->sequenceNum % REORDER_RING_SIZE] = batch;
 
-        free_detection_request(&request);
+        batch = next;
     }
+
+    // task counts as finished only after we return, when result is drained or left to the draining worker,
+    // so flush can't reset detector in between
+    drainDetectedMotion();
 }
 
 // thread
 
 void* MotionDetector::thread_entrypoint(void* opaque) {
 
-    MotionDetector::getInstance().threadLoop();
+    ((MotionDetector*) opaque)->threadLoop();
     return NULL;
 }
 
 void MotionDetector::threadLoop(void) {
 
+    if (placement != NULL)
+        placement->placeCurrentThread(RoleCoordination);
+
     while (true) {
 
         DetectorOperation operation;
@@ -470,52 +667,66 @@ void MotionDetector::threadLoop(void) {
 
         if (operation.operationType == FrameSent) {
 
-            addFrameToRequests(operation.frame);
+            queuedFrames--;
 
-        } else if (operation.operationType == MotionDetected) {
+            addFrameToRequests(operation.frame, operation.droppedFrames);
 
-            processDetectedMotion(operation.request);
+            // batch grows only while frames keep coming, a lone pair is never held back
+            if (batchHead != NULL && (batchSize >= getBatchLimit() || pendingOperations.size_approx() == 0 ||
+                                      !canAcceptFrame()))
+                submitBatch();
 
         } else if (operation.operationType == ResetDetector || operation.operationType == FinalizeDetector) {
 
+            // batch may have waited for frames that came after the reset, its results belong before it
+            submitBatch();
+
+            // frames sent after flush's own wait may still be detected, nothing can be reset under them
+            waitForScheduledDetections();
+
             pthread_check_error(pthread_mutex_lock(&mutex));
 
             if (operation.operationType == ResetDetector)
                 print_log(ANDROID_LOG_DEBUG, MOTION_DETECTOR_TAG, "reset start");
 
             // deleting frames that awaits motion that will not happen at this point
-            while (!bufferedFrames.empty()) {
-
-                AVFrame* frame = bufferedFrames.front();
-                bufferedFrames.pop();
+            waitingFrames.clear();
 
-                av_frame_free(&frame);
-            }
-
-            // deleting non sequential requests that awaits other requests in order to become sequential
+            // deleting requests that await earlier requests in the reorder ring
 
             /*
             since reset can only occur after flush, i.e. all thread pool tasks are finished at this point,
-            then all sequential requests should be sorted into completely sequential stream of requests and
-            then be processed fully, so we have no need to destroy any requests in normal circumstances
+            then all finished requests should have been drained in order by the workers,
+            so we have no need to destroy any requests in normal circumstances
              */
 
-            for (DetectionRequest *request : sequentialOperations) {
+            for (int i = 0; i < REORDER_RING_SIZE; i++) {
+
+                DetectionRequest *request = reorderRing[i].exchange(NULL);
 
-                print_log(ANDROID_LOG_WARN, MOTION_DETECTOR_TAG, "unsorted request found after flush");
+                if (request != NULL) {
 
-                free_detection_request(&request);
+                    print_log(ANDROID_LOG_WARN, MOTION_DETECTOR_TAG, "unsorted request found after flush");
+
+                    free_detection_request(&request);
+                }
             }
-            sequentialOperations.clear();
 
-            // deleting frames that awaits to become request
+            // deleting frame that awaits its pair
 
             av_frame_free(&frame);
+            av_frame_free(&framePreprocessed.gray);
+
+            frameFollowsPreviousRequest = false;
+            frameDroppedAfterFrame = false;
+            lastDroppedFrames = droppedFrames;
+
+            // nothing is scheduled after flush, next request starts a new sequence
+            engine->reset();
 
             // check everything to be empty
 
-            my_assert(sequentialOperations.empty());
-            my_assert(bufferedFrames.empty());
+            my_assert(waitingFrames.isEmpty());
 
             // resetting sequence numbers and time variables
 
@@ -523,6 +734,9 @@ void MotionDetector::threadLoop(void) {
             nextSequenceNum = 0;
 
             lastFrameTime = 0;
+            lastScheduledDetectionPts = 0;
+            lastDetectedMotionPts = 0;
+            lastPersonPts = 0;
             lastMotionTime = 0;
             lastFrameWithMotionTime = 0;
 
@@ -544,17 +758,12 @@ void MotionDetector::threadLoop(void) {
 
 // utils
 
-bool MotionDetector::request_comparer(const DetectionRequest *left, const DetectionRequest *right) {
-
-    return left->sequenceNum < right->sequenceNum;
-}
-
 void MotionDetector::free_detection_request(DetectionRequest **request) {
 
     if (*request != NULL) {
-        av_frame_free(&(*request)->prevFrame);
         av_frame_free(&(*request)->frame);
-        av_frame_free(&(*request)->nextFrame);
+        av_frame_free(&(*request)->preprocessed.gray);
+        av_frame_free(&(*request)->nextPreprocessed.gray);
         delete *request;
         *request = NULL;
     }
@@ -1,95 +1,147 @@
 #ifndef PEOPLEWATCHER_MOTIONDETECTOR_H
 #define PEOPLEWATCHER_MOTIONDETECTOR_H
 
-#include <queue>
-
-#include "opencv2/highgui.hpp"
-#include <opencv2/optflow.hpp>
-
-using namespace cv;
+#include <atomic>
 
 #include "blockingconcurrentqueue.h"
 
 extern "C" {
 #include "libavutil/frame.h"
-#include "libswscale/swscale.h"
-
-#include "thpool.h"
 }
 
-#include "Encoder.h"
+#include "DetectionPool.h"
+#include "FramePool.h"
+#include "FrameRing.h"
+#include "DetectorEngine.h"
+#include "PersonClassifier.h"
 
 using namespace moodycamel;
 
-typedef void (*MotionDetectorCallback)(AVFrame* yuvFrameWithMotion, long long realtimeTimestamp);
+// gets frames with motion, or every frame when config forwards all of them
+typedef void (*MotionDetectorCallback)(void* opaque, AVFrame* yuvFrame, long long realtimeTimestamp,
+                                       bool haveMotion);
 
+// one instance per stream, detection tasks of all streams go to the shared thread pool
 class MotionDetector {
 public:
-    static MotionDetector& getInstance() {
-        static MotionDetector instance;
-
-        return instance;
-    }
+    MotionDetector(void);
 
     MotionDetector(MotionDetector const&) = delete;
     void operator=(MotionDetector const&)  = delete;
 private:
-    MotionDetector(void);
 
     enum DetectorOperationType {
         FrameSent,
-        MotionDetected,
         ResetDetector,
         FinalizeDetector
     };
 
+    // decision for one frame, made by comparing it with the next one,
+    // preprocessed next frame is a reference shared with the following request
     struct DetectionRequest {
-        AVFrame *prevFrame, *frame, *nextFrame;
+        MotionDetector *detector;
+        AVFrame *frame;
+        PreprocessedFrame preprocessed, nextPreprocessed;
         long long sequenceNum;
+        bool followsPreviousRequest;    // previous request ended with our frame and no frames were lost
         bool haveMotion;
+        DetectionRequest *nextInBatch;  // following pair of the same pool task
     };
 
     struct DetectorOperation {
         DetectorOperationType operationType;
-        DetectionRequest *request;
         AVFrame* frame;
+        long long droppedFrames;    // drops counted before the frame was sent
     };
 
     static const int MOTION_PROPAGATION_TIME = 525 * 1000 * 1000; // 525 ms in nanonseconds
 
-    static const int OFFSET_Y         = 200;
+    // adaptive rate: while nothing moves one pair per period is detected, below propagation time
+    // so every frame still gets motion of a detected pair near it
+    static const int IDLE_DETECTION_PERIOD = 250 * 1000 * 1000; // 250 ms in nanoseconds
+    // every pair is detected for this long after motion was found
+    static const long long ACTIVE_DETECTION_TIME = 3LL * 1000 * 1000 * 1000; // 3 s in nanoseconds
 
-    static const int INPUT_WIDTH      = Encoder::WIDTH;
-    static const int INPUT_HEIGHT     = Encoder::HEIGHT - OFFSET_Y;
+    // motion this close to a frame the classifier found a person in is accepted without classifying it again
+    static const long long PERSON_CONFIRMATION_TIME = 2LL * 1000 * 1000 * 1000; // 2 s in nanoseconds
 
-    static const int DOWNSCALE_WIDTH  = INPUT_WIDTH  / 2;
-    static const int DOWNSCALE_HEIGHT = INPUT_HEIGHT / 2;
+    // power of two above the number of requests that may be scheduled or wait for earlier results
+    static const int REORDER_RING_SIZE = 32;
 
-    int initialized;
+    MotionDetectorConfig config;
+
+    // stream geometry, only the box around included zones is used for detection
 
-    std::string rootDir;
+    int inputX, inputY, inputWidth, inputHeight;
+    int downscaleWidth, downscaleHeight;
+
+    int initialized;
 
     MotionDetectorCallback callback;
+    void *callbackOpaque;
 
-    // thread pool stuff
+    // thread pool stuff, pool is shared between streams
 
-    threadpool pool;
-    std::atomic_int scheduledCount;
+    DetectionPool *pool;
+    const ThreadPlacement *placement;
+    // our tasks in the pool, flush waits only for them
+    PoolTaskGroup scheduledTasks;
+
+    FramePool *grayFramePool;
+
+    DetectorEngine *engine;
+    // shared by all streams, NULL when every motion is recorded
+    const PersonClassifier *classifier;
+
+    // frames dropped before they reached detector thread
+    std::atomic<long long> droppedFrames;
+
+    // finished requests wait here for earlier ones, slot of a request is its sequenceNum modulo ring size,
+    // workers publish without locks and whichever of them finds the next result ready drains them in order
+    std::atomic<DetectionRequest*> reorderRing[REORDER_RING_SIZE];
+    std::atomic_bool draining;
+    // next request to drain and next one to schedule, their difference is bounded by maxScheduledDetections
+    std::atomic<long long> currentSequenceNum, nextSequenceNum;
+
+    // from the frame budget
+    int maxScheduledDetections;
+    int maxQueuedFrames;
+
+    // pts of the latest frame detection found motion in, 0 if none since reset
+    std::atomic<long long> lastDetectedMotionPts;
+    // pts of the latest frame the classifier found a person in, 0 if none since reset
+    std::atomic<long long> lastPersonPts;
 
     // separate thread variables
 
     BlockingConcurrentQueue<DetectorOperation> pendingOperations;
+    // frames in pendingOperations, queue itself only rounds its capacity up to blocks
+    std::atomic_int queuedFrames;
 
     pthread_mutex_t mutex;
     pthread_cond_t cond;
     pthread_t thread;
 
-    AVFrame *prevFrame, *frame;
-    long long currentSequenceNum, nextSequenceNum;
+    // last frame waits for the next one to form a pair, its preprocessed copy is reused by that pair
+    AVFrame *frame;
+    PreprocessedFrame framePreprocessed;
+    // frame finished the previous request without drops in between, next request can be warm started
+    bool frameFollowsPreviousRequest;
+    bool frameDroppedAfterFrame;
+    long long lastDroppedFrames;
+    long long lastFrameTime;
+
+    // consecutive requests that go to the pool as one task, they have the latest sequence numbers
+    DetectionRequest *batchHead, *batchTail;
+    int batchSize;
 
-    long long lastFrameTime, lastMotionTime, lastFrameWithMotionTime;
-    std::vector<DetectionRequest*> sequentialOperations;
-    std::queue<AVFrame*> bufferedFrames;
+    // pts of the first frame of the latest pair sent to detection
+    long long lastScheduledDetectionPts;
+
+    // owned by the thread that drains results
+    long long lastMotionTime, lastFrameWithMotionTime;
+    // frames that wait whether motion follows them, oldest are evicted first
+    FrameRing waitingFrames;
 
     static void* thread_entrypoint(void* opaque);
     void threadLoop(void);
@@ -97,25 +149,41 @@ private:
     static void pool_worker(void* opaque);
     void PoolWorker(DetectionRequest *request);
 
-    void addFrameToRequests(AVFrame *yuvFrame);
+    void addFrameToRequests(AVFrame *yuvFrame, long long droppedFrames);
+    int getBatchLimit(void);
+    void submitBatch(void);
+    bool shouldDetect(long long framePts);
+    void skipDetection(DetectionRequest *request);
     void resetDetector(void);
+    void waitForScheduledDetections(void);
 
-    AVFrame* generateGrayDownscaleCrop(AVFrame *yuvFrame);
-    static void convertFlowToImage(Mat* flow, Mat* image, double minLen);
-    static uint8_t getGrayscaleMeanLuminace(AVFrame *frame);
+    bool preprocessFrame(AVFrame *yuvFrame, PreprocessedFrame *preprocessed);
 
-    bool detectMotion(AVFrame *frame, AVFrame *nextFrame);
-    void processDetectedMotion(DetectionRequest *request);
+    bool detectMotion(DetectionRequest *request);
+    bool confirmPerson(DetectionRequest *request, const Rect &motionBlob);
+    void drainDetectedMotion(void);
     void processFrame(AVFrame *frame, bool haveMotion);
     void correctTimestamp(AVFrame *frame);
 
-    static bool request_comparer(const DetectionRequest *left, const DetectionRequest *right);
     static void free_detection_request(DetectionRequest **request);
 public:
-    void initialize(const char *rootDir, MotionDetectorCallback callback);
+    static const int MAX_POOL_THREADS = DetectionPool::MAX_THREADS;
+    static const int MAX_DETECTION_BATCH = 8;
+    // most detections the reorder ring tracks, frame budget decides the actual limit
+    static const int MAX_SCHEDULED_DETECTIONS = REORDER_RING_SIZE;
+
+    // motion is only recorded when classifier finds a person in it, unless it is NULL;
+    // gray frames are charged to frameBudget
+    void initialize(int width, int height, const MotionDetectorConfig &config, const FrameLimits &limits,
+                    FrameBudget *frameBudget, DetectionPool *pool, const ThreadPlacement *placement,
+                    const PersonClassifier *classifier, MotionDetectorCallback callback, void *callbackOpaque);
 
     bool canAcceptFrame(void);
+    // scheduled detections and results waiting for earlier ones relative to the limit, 0..1
+    double getLoad(void);
     void sendFrame(AVFrame* yuvFrame);
+    // frame of this stream was dropped before sendFrame, breaks the chain of warm started flows
+    void frameDropped(void);
     void flush(void);
     void terminate(void);
 };
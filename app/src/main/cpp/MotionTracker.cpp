@@ -0,0 +1,160 @@
+#include "MotionTracker.h"
+
+#include <cmath>
+
+#include "exceptionUtils.h"
+
+MotionTracker::MotionTracker(void) : tracks(), tracksCount(0), lastRefreshSequenceNum(0) {
+
+    pthread_check_error(pthread_mutex_init(&mutex, NULL));
+}
+
+MotionTracker::~MotionTracker(void) {
+
+    pthread_check_error(pthread_mutex_destroy(&mutex));
+}
+
+Point2f MotionTracker::predictCentroid(const Track &track, long long sequenceNum) {
+
+    return track.centroid + track.velocity * (float) (sequenceNum - track.sequenceNum);
+}
+
+void MotionTracker::dropExpiredTracks(long long sequenceNum) {
+
+    for (int i = 0; i < tracksCount; ) {
+
+        if (sequenceNum - tracks[i].sequenceNum > TRACK_TIMEOUT)
+            tracks[i] = tracks[--tracksCount];
+        else
+            i++;
+    }
+}
+
+bool MotionTracker::predictRegions(long long sequenceNum, const Size &frameSize, std::vector<Rect> *regions) {
+
+    pthread_check_error(pthread_mutex_lock(&mutex));
+
+    dropExpiredTracks(sequenceNum);
+
+    // whole frame is examined anyway while nothing is tracked, refresh interval starts with the first track
+    bool tracked = tracksCount > 0 && sequenceNum - lastRefreshSequenceNum < REFRESH_INTERVAL;
+    if (!tracked)
+        lastRefreshSequenceNum = sequenceNum;
+
+    size_t first = regions->size();
+
+    for (int i = 0; tracked && i < tracksCount; i++) {
+
+        Point2f centroid = predictCentroid(tracks[i], sequenceNum);
+        const Size &size = tracks[i].size;
+
+        Rect box((int) (centroid.x - size.width / 2.0f) - TRACK_MARGIN,
+                 (int) (centroid.y - size.height / 2.0f) - TRACK_MARGIN,
+                 size.width + TRACK_MARGIN * 2, size.height + TRACK_MARGIN * 2);
+
+        box &= Rect(0, 0, frameSize.width, frameSize.height);
+
+        if (box.area() > 0)
+            regions->push_back(box);
+    }
+
+    pthread_check_error(pthread_mutex_unlock(&mutex));
+
+    // boxes of objects that came close to each other would have flow calculated twice
+    bool merged = true;
+
+    while (merged) {
+
+        merged = false;
+
+        for (size_t i = first; i < regions->size() && !merged; i++) {
+            for (size_t j = i + 1; j < regions->size() && !merged; j++) {
+
+                if (((*regions)[i] & (*regions)[j]).area() > 0) {
+
+                    (*regions)[i] |= (*regions)[j];
+                    regions->erase(regions->begin() + j);
+                    merged = true;
+                }
+            }
+        }
+    }
+
+    // every predicted box may have left the frame
+    return regions->size() > first;
+}
+
+void MotionTracker::update(long long sequenceNum, const Rect &blob) {
+
+    Point2f centroid(blob.x + blob.width / 2.0f, blob.y + blob.height / 2.0f);
+
+    pthread_check_error(pthread_mutex_lock(&mutex));
+
+    // nearest track whose predicted box contains the blob center
+    int best = -1;
+    float bestDistance = 0;
+
+    for (int i = 0; i < tracksCount; i++) {
+
+        Point2f predicted = predictCentroid(tracks[i], sequenceNum);
+        Point2f offset = centroid - predicted;
+
+        if (std::abs(offset.x) > tracks[i].size.width / 2.0f + TRACK_MARGIN ||
+            std::abs(offset.y) > tracks[i].size.height / 2.0f + TRACK_MARGIN)
+            continue;
+
+        float distance = offset.dot(offset);
+
+        if (best == -1 || distance < bestDistance) {
+            best = i;
+            bestDistance = distance;
+        }
+    }
+
+    if (best != -1) {
+
+        Track &track = tracks[best];
+
+        // older result than the track has seen tells nothing new
+        if (sequenceNum > track.sequenceNum) {
+
+            Point2f velocity = (centroid - track.centroid) * (1.0f / (float) (sequenceNum - track.sequenceNum));
+
+            track.velocity = (track.velocity + velocity) * 0.5f;
+            track.centroid = centroid;
+            track.size = blob.size();
+            track.sequenceNum = sequenceNum;
+        }
+    } else {
+
+        // without a free slot the track seen longest ago is replaced
+        int slot = tracksCount;
+
+        if (tracksCount < MAX_TRACKS)
+            tracksCount++;
+        else {
+            slot = 0;
+            for (int i = 1; i < tracksCount; i++) {
+                if (tracks[i].sequenceNum < tracks[slot].sequenceNum)
+                    slot = i;
+            }
+        }
+
+        tracks[slot].centroid = centroid;
+        tracks[slot].velocity = Point2f(0, 0);
+        tracks[slot].size = blob.size();
+        tracks[slot].sequenceNum = sequenceNum;
+    }
+
+    pthread_check_error(pthread_mutex_unlock(&mutex));
+}
+
+void MotionTracker::reset(void) {
+
+    pthread_check_error(pthread_mutex_lock(&mutex));
+
+    tracksCount = 0;
+    lastRefreshSequenceNum = 0;
+
+    pthread_check_error(pthread_mutex_unlock(&mutex));
+}
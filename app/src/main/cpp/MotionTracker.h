@@ -0,0 +1,57 @@
+#ifndef PEOPLEWATCHER_MOTIONTRACKER_H
+#define PEOPLEWATCHER_MOTIONTRACKER_H
+
+#include <pthread.h>
+
+#include "opencv2/core.hpp"
+
+using namespace cv;
+
+// Centroid tracker of motion blobs of one stream across sequence numbers. Detections report the blob
+// that made their decision, the tracker predicts where tracked blobs are in later pairs from their
+// velocity, so flow can be limited to those boxes while an event goes on. Detections run concurrently
+// and finish out of order, results older than what a track already saw don't move it.
+class MotionTracker {
+public:
+    MotionTracker(void);
+    ~MotionTracker(void);
+
+    MotionTracker(MotionTracker const&)    = delete;
+    void operator=(MotionTracker const&)  = delete;
+
+    static const int MAX_TRACKS = 4;
+private:
+    // pixels added around a predicted box on every side, covers prediction error and blob growth
+    static const int TRACK_MARGIN = 24;
+    // track is dropped when no detection saw it for this many pairs
+    static const int TRACK_TIMEOUT = 20;
+    // every this many pairs detection looks at the whole frame to find new objects
+    static const int REFRESH_INTERVAL = 8;
+
+    struct Track {
+        Point2f centroid, velocity;     // velocity in pixels per pair
+        Size size;
+        long long sequenceNum;          // pair that saw the track last
+    };
+
+    pthread_mutex_t mutex;
+
+    Track tracks[MAX_TRACKS];
+    int tracksCount;
+
+    long long lastRefreshSequenceNum;
+
+    static Point2f predictCentroid(const Track &track, long long sequenceNum);
+    void dropExpiredTracks(long long sequenceNum);
+public:
+    // boxes the pair should look at first, false if the whole frame has to be examined:
+    // nothing is tracked or it is time for a refresh
+    bool predictRegions(long long sequenceNum, const Size &frameSize, std::vector<Rect> *regions);
+
+    // blob that made the decision of the pair, starts a new track if it doesn't continue one
+    void update(long long sequenceNum, const Rect &blob);
+
+    void reset(void);
+};
+
+#endif //PEOPLEWATCHER_MOTIONTRACKER_H
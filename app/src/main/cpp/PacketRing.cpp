@@ -0,0 +1,152 @@
+#include "PacketRing.h"
+
+#include "EngineStats.h"
+
+PacketRing::PacketRing(void) : packets(NULL), capacity(0), head(0), count(0), duration(0), maxBytes(0),
+                               bytes(0), cut(false) {
+}
+
+PacketRing::~PacketRing(void) {
+
+    release();
+}
+
+void PacketRing::initialize(int64_t duration, size_t maxBytes, int capacity) {
+
+    release();
+
+    this->duration = duration;
+    this->maxBytes = maxBytes;
+    this->capacity = capacity;
+
+    if (capacity > 0) {
+
+        packets = new AVPacket*[capacity];
+
+        for (int i = 0; i < capacity; i++)
+            packets[i] = av_packet_alloc();
+    }
+}
+
+// index of the first packet of the second GOP, count if there is only one
+int PacketRing::findSecondGop(void) {
+
+    for (int i = 1; i < count; i++) {
+
+        if ((at(i)->flags & AV_PKT_FLAG_KEY) != 0)
+            return i;
+    }
+
+    return count;
+}
+
+void PacketRing::evictGop(int packetsCount) {
+
+    for (int i = 0; i < packetsCount; i++) {
+
+        AVPacket *packet = at(0);
+
+        bytes -= (size_t) packet->size;
+        av_packet_unref(packet);
+
+        head = (head + 1) % capacity;
+        count--;
+    }
+}
+
+void PacketRing::push(AVPacket *packet) {
+
+    bool keyframe = (packet->flags & AV_PKT_FLAG_KEY) != 0;
+
+    // packet slots run out only when frames come much faster than expected
+    if (count == capacity) {
+
+        EngineStats::getInstance().countEvent(CounterPreRollEvicted);
+
+        int secondGop = findSecondGop();
+
+        // packet needs the only GOP in the ring, so it goes instead
+        if (secondGop == count && !keyframe) {
+
+            cut = true;
+            av_packet_unref(packet);
+            return;
+        }
+
+        evictGop(secondGop);
+    }
+
+    // decoding starts at a keyframe and needs every packet of its GOP
+    if (!keyframe && (count == 0 || cut)) {
+
+        av_packet_unref(packet);
+        return;
+    }
+
+    if (keyframe)
+        cut = false;
+
+    AVPacket *slot = packets[(head + count) % capacity];
+    av_packet_move_ref(slot, packet);
+
+    count++;
+    bytes += (size_t) slot->size;
+
+    int64_t newestPts = slot->pts;
+
+    while (true) {
+
+        int secondGop = findSecondGop();
+        if (secondGop == count)
+            break;
+
+        bool covered = newestPts - at(secondGop)->pts >= duration;
+
+        if (!covered && bytes <= maxBytes)
+            break;
+
+        if (!covered)
+            EngineStats::getInstance().countEvent(CounterPreRollEvicted);
+
+        evictGop(secondGop);
+    }
+}
+
+bool PacketRing::pop(AVPacket *packet) {
+
+    if (count == 0)
+        return false;
+
+    AVPacket *slot = at(0);
+
+    bytes -= (size_t) slot->size;
+    av_packet_move_ref(packet, slot);
+
+    head = (head + 1) % capacity;
+    count--;
+
+    return true;
+}
+
+void PacketRing::clear(void) {
+
+    evictGop(count);
+
+    head = 0;
+    cut = false;
+}
+
+void PacketRing::release(void) {
+
+    if (packets == NULL)
+        return;
+
+    clear();
+
+    for (int i = 0; i < capacity; i++)
+        av_packet_free(&packets[i]);
+
+    delete[] packets;
+    packets = NULL;
+    capacity = 0;
+}
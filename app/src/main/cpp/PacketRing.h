@@ -0,0 +1,55 @@
+#ifndef PEOPLEWATCHER_PACKETRING_H
+#define PEOPLEWATCHER_PACKETRING_H
+
+#include <inttypes.h>
+#include <stddef.h>
+
+extern "C" {
+#include "libavcodec/avcodec.h"
+}
+
+// Encoded packets of the latest seconds of a stream that wait for motion, always starting with a keyframe.
+// Whole GOPs are evicted from the front once the GOPs after them still cover the pre-roll duration,
+// or earlier while the ring takes more than its byte budget or packet capacity. The GOP being written
+// is never evicted, so worst case memory is the budget plus one GOP; when it fills all packet slots
+// the rest of it is dropped instead.
+class PacketRing {
+public:
+    PacketRing(void);
+    ~PacketRing(void);
+
+    PacketRing(PacketRing const&)      = delete;
+    void operator=(PacketRing const&)  = delete;
+private:
+    AVPacket **packets;
+    int capacity;
+    int head, count;
+
+    int64_t duration;       // in packet time base
+    size_t maxBytes, bytes;
+    bool cut;               // newest GOP lost packets, so packets after it can't be decoded
+
+    AVPacket* at(int index) { return packets[(head + index) % capacity]; }
+    int findSecondGop(void);
+    void evictGop(int packetsCount);
+public:
+    // capacity is in packets, 0 disables the ring
+    void initialize(int64_t duration, size_t maxBytes, int capacity);
+    bool isEnabled(void) const { return capacity > 0; }
+
+    // takes over the reference of packet, packets that don't follow a keyframe can't be decoded
+    // from the ring and are dropped
+    void push(AVPacket *packet);
+    // moves the oldest packet into packet, false if the ring is empty
+    bool pop(AVPacket *packet);
+
+    bool isEmpty(void) const { return count == 0; }
+    // false when a packet that isn't a keyframe couldn't be decoded after the packets in the ring
+    bool canContinue(void) const { return count > 0 && !cut; }
+    size_t getBytes(void) const { return bytes; }
+
+    void clear(void);
+    void release(void);
+};
+
+#endif //PEOPLEWATCHER_PACKETRING_H
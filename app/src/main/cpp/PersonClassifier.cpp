@@ -0,0 +1,177 @@
+#include "PersonClassifier.h"
+
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+
+#include <opencv2/imgproc.hpp>
+
+#include "log.h"
+
+extern "C" {
+#include "imageUtils.h"
+}
+
+#define CLASSIFIER_TAG "PW_CLASSIFIER"
+
+PersonClassifier::PersonClassifier(void) : inputWidth(0), inputHeight(0), threshold(0), maxActivationSize(0),
+                                           loaded(0) {
+}
+
+template <typename T>
+static bool readValues(FILE *f, T *values, size_t count) {
+
+    return fread(values, sizeof(T), count, f) == count;
+}
+
+void PersonClassifier::load(const char *path) {
+
+    FILE *f = fopen(path, "rb");
+    if (f == NULL)
+        throw new std::runtime_error("Couldn't open person classifier model");
+
+    char magic[4];
+    uint32_t version = 0;
+    int32_t header[2], layersCount = 0;
+
+    bool valid = readValues(f, magic, 4) && memcmp(magic, "PWPC", 4) == 0 &&
+                 readValues(f, &version, 1) && version == MODEL_VERSION &&
+                 readValues(f, header, 2) && readValues(f, &threshold, 1) && readValues(f, &layersCount, 1) &&
+                 header[0] >= 3 && header[0] <= MAX_INPUT_SIZE && header[1] >= 3 && header[1] <= MAX_INPUT_SIZE &&
+                 layersCount >= 1 && layersCount <= MAX_LAYERS;
+
+    inputWidth = header[0];
+    inputHeight = header[1];
+    layers.clear();
+
+    // the first layer sees the gray crop, every convolution shrinks what the next one sees
+    int width = inputWidth, height = inputHeight, channels = 1;
+    maxActivationSize = width * height;
+
+    for (int i = 0; valid && i < layersCount; i++) {
+
+        int32_t description[2], stride = 1;
+
+        valid = readValues(f, description, 2) && description[0] >= 0 && description[0] < LayerTypesCount &&
+                description[1] >= 1 && description[1] <= 256;
+        if (!valid)
+            break;
+
+        Layer layer;
+        layer.type = (LayerType) description[0];
+        layer.width = width;
+        layer.height = height;
+        layer.channels = channels;
+        layer.outputs = description[1];
+
+        size_t weightsCount;
+
+        if (layer.type == LayerConv3x3) {
+
+            valid = readValues(f, &stride, 1) && stride >= 1 && stride <= 4 && width >= 3 && height >= 3;
+
+            weightsCount = (size_t) (layer.outputs * 9 * channels);
+        } else {
+
+            // dense layer gives the decision, so it is the last one and has one output
+            valid = i == layersCount - 1 && layer.outputs == 1;
+
+            weightsCount = (size_t) (layer.outputs * width * height * channels);
+        }
+
+        layer.stride = stride;
+
+        layer.weights.resize(weightsCount);
+        layer.bias.resize((size_t) layer.outputs);
+
+        valid = valid && readValues(f, layer.weights.data(), weightsCount) &&
+                readValues(f, layer.bias.data(), layer.bias.size());
+
+        if (valid && layer.type == LayerConv3x3) {
+
+            layer.scale.resize((size_t) layer.outputs);
+            valid = readValues(f, layer.scale.data(), layer.scale.size());
+
+            width = quantized_conv3x3_output_size(width, stride);
+            height = quantized_conv3x3_output_size(height, stride);
+            channels = layer.outputs;
+
+            if (width * height * channels > maxActivationSize)
+                maxActivationSize = width * height * channels;
+        }
+
+        layers.push_back(layer);
+    }
+
+    valid = valid && layers.back().type == LayerDense && fgetc(f) == EOF;
+
+    fclose(f);
+
+    if (!valid) {
+        layers.clear();
+        throw new std::runtime_error("Malformed person classifier model");
+    }
+
+    loaded = 1;
+
+    print_log(ANDROID_LOG_INFO, CLASSIFIER_TAG, "Person classifier %dx%d input, %d layers, threshold %.1f",
+              inputWidth, inputHeight, (int) layers.size(), threshold);
+}
+
+static thread_local Mat tls_input;
+static thread_local std::vector<uint8_t> tls_activations[2];
+
+bool PersonClassifier::classify(const uint8_t *plane, int stride, int width, int height, const Rect &box) const {
+
+    // grown around its center to the input aspect ratio, so the person isn't stretched
+    float boxWidth = box.width * (1.0f + CROP_MARGIN * 2), boxHeight = box.height * (1.0f + CROP_MARGIN * 2);
+    float aspect = (float) inputWidth / inputHeight;
+
+    if (boxWidth < boxHeight * aspect)
+        boxWidth = boxHeight * aspect;
+    else
+        boxHeight = boxWidth / aspect;
+
+    float centerX = box.x + box.width / 2.0f, centerY = box.y + box.height / 2.0f;
+
+    Rect crop = Rect((int) (centerX - boxWidth / 2), (int) (centerY - boxHeight / 2), (int) boxWidth,
+                     (int) boxHeight) & Rect(0, 0, width, height);
+
+    if (crop.area() == 0)
+        return false;
+
+    Mat frame(height, width, CV_8UC1, (void*) plane, (size_t) stride);
+
+    resize(frame(crop), tls_input, Size(inputWidth, inputHeight), 0, 0, INTER_AREA);
+
+    tls_activations[0].resize((size_t) maxActivationSize);
+    tls_activations[1].resize((size_t) maxActivationSize);
+
+    const uint8_t *input = tls_input.data;
+    int32_t score = 0;
+
+    for (size_t i = 0; i < layers.size(); i++) {
+
+        const Layer &layer = layers[i];
+        uint8_t *output = tls_activations[i % 2].data();
+
+        if (layer.type == LayerConv3x3)
+            quantized_conv3x3(input, layer.width, layer.height, layer.channels, layer.stride, layer.weights.data(),
+                              layer.bias.data(), layer.scale.data(), layer.outputs, output);
+        else
+            quantized_dense(input, layer.width * layer.height * layer.channels, layer.weights.data(),
+                            layer.bias.data(), 1, &score);
+
+        input = output;
+    }
+
+    print_log(ANDROID_LOG_DEBUG, CLASSIFIER_TAG, "Crop %dx%d at %d,%d scored %d", crop.width, crop.height, crop.x,
+              crop.y, score);
+
+    return score >= threshold;
+}
+
+void PersonClassifier::benchmark(void) {
+
+    benchmark_quantized_conv3x3();
+}
@@ -0,0 +1,69 @@
+#ifndef PEOPLEWATCHER_PERSONCLASSIFIER_H
+#define PEOPLEWATCHER_PERSONCLASSIFIER_H
+
+#include <inttypes.h>
+
+#include <vector>
+
+#include "opencv2/core.hpp"
+
+using namespace cv;
+
+// Second detection stage: a small int8 quantized convolutional network on the CPU that tells whether
+// a motion box of the full resolution frame shows a person, so moving curtains, pets and headlights
+// aren't recorded. Loaded once and shared by all streams, classify may run concurrently.
+//
+// Model file (little endian): "PWPC", version 1, input width and height, decision threshold (float),
+// layers count, then every layer as type (0 convolution, 1 dense), outputs, stride (convolutions only)
+// and its int8 weights, int32 biases and (convolutions only) float scales, see quantized_conv3x3
+// and quantized_dense. Input is the gray crop resized to the input size, the last layer is dense
+// with one output, a person is there when it reaches the threshold.
+class PersonClassifier {
+public:
+    PersonClassifier(void);
+
+    PersonClassifier(PersonClassifier const&) = delete;
+    void operator=(PersonClassifier const&)  = delete;
+private:
+    static const uint32_t MODEL_VERSION = 1;
+    static const int MAX_LAYERS = 16;
+    static const int MAX_INPUT_SIZE = 256;
+
+    enum LayerType {
+        LayerConv3x3,
+        LayerDense,
+        LayerTypesCount
+    };
+
+    struct Layer {
+        LayerType type;
+        int stride;
+        int width, height, channels;    // input of the layer
+        int outputs;                    // output channels of a convolution
+        std::vector<int8_t> weights;
+        std::vector<int32_t> bias;
+        std::vector<float> scale;
+    };
+
+    // crop is grown by this fraction of its size on every side, a blob rarely covers the whole body
+    static constexpr float CROP_MARGIN = 0.1f;
+
+    int inputWidth, inputHeight;
+    float threshold;
+    std::vector<Layer> layers;
+    int maxActivationSize;
+
+    int loaded;
+public:
+    // throws on files that can't be read or don't describe a valid network
+    void load(const char *path);
+    bool isLoaded(void) const { return loaded != 0; }
+
+    // box is in pixels of the gray plane, it is grown to the input aspect ratio before resizing
+    bool classify(const uint8_t *plane, int stride, int width, int height, const Rect &box) const;
+
+    // checks SIMD convolution against scalar one and times both
+    static void benchmark(void);
+};
+
+#endif //PEOPLEWATCHER_PERSONCLASSIFIER_H
@@ -0,0 +1,186 @@
+#include "StreamPipeline.h"
+
+#include "log.h"
+
+extern "C" {
+#include "imageUtils.h"
+#include "generalUtils.h"
+}
+
+#include "EngineStats.h"
+
+#define STREAM_TAG "PW_STREAM"
+
+StreamPipeline::StreamPipeline(int id, const StreamConfig &config) : id(id), config(config), limits(),
+                                                                     engineFrameBudget(NULL),
+                                                                     lastMotionRealtimeTimestamp(0),
+                                                                     nv12FramePool(NULL), i420FramePool(NULL) {
+}
+
+StreamPipeline::~StreamPipeline(void) {
+
+    releaseFramePool(&nv12FramePool, "NV12");
+    releaseFramePool(&i420FramePool, "I420");
+
+    if (engineFrameBudget != NULL) {
+
+        print_log(ANDROID_LOG_INFO, STREAM_TAG, "stream %d: frame memory peak %.1f MB of %.1f MB", id,
+                  frameBudget.getPeakBytes() / (1024.0 * 1024.0), frameBudget.getBytes() / (1024.0 * 1024.0));
+
+        engineFrameBudget->release(frameBudget.getBytes());
+        engineFrameBudget = NULL;
+    }
+}
+
+void StreamPipeline::initialize(AsyncIO *asyncIO, DetectionPool *detectionPool, const ThreadPlacement *placement,
+                                const ThreadBudget *budget, FrameBudget *frameBudget,
+                                const PersonClassifier *classifier) {
+
+    size_t slice = config.frameMemory > 0 ? config.frameMemory : frameBudget->getFreeBytes();
+
+    // every holding point gets frames of this size from the slice, so a higher resolution holds fewer
+    limits = FrameBudget::getStreamLimits(slice, config.width, config.height,
+                                          MotionDetector::MAX_SCHEDULED_DETECTIONS);
+
+    // slice is taken for the life of the stream, so busy streams can't starve the others
+    if (!frameBudget->reserve(limits.getBytes()))
+        throw new std::runtime_error("Frame memory budget is taken by other streams");
+
+    engineFrameBudget = frameBudget;
+    this->frameBudget.initialize(limits.getBytes());
+
+    // buffers are allocated on demand, so only the pool that matches camera layout takes memory
+    nv12FramePool = new FramePool(config.width, config.height, AV_PIX_FMT_NV12, limits.poolFrames,
+                                  &this->frameBudget);
+    i420FramePool = new FramePool(config.width, config.height, AV_PIX_FMT_YUV420P, limits.poolFrames,
+                                  &this->frameBudget);
+
+    config.detector.forwardAllFrames = config.preRollSeconds > 0;
+
+    encoder.initialize(config.outputDir.c_str(), config.width, config.height, limits.encoderFrames, asyncIO,
+                       placement, budget, config.preRollSeconds);
+    detector.initialize(config.width, config.height, config.detector, limits, &this->frameBudget, detectionPool,
+                        placement, classifier, motionDetectorCallback, this);
+
+    print_log(ANDROID_LOG_INFO, STREAM_TAG, "stream %d: %dx%d -> %s", id, config.width, config.height,
+              config.outputDir.c_str());
+    print_log(ANDROID_LOG_INFO, STREAM_TAG, "stream %d: %d queued, %d scheduled, %d waiting, %d encoder frames, "
+              "%.1f MB at most", id, limits.queuedFrames, limits.scheduledDetections, limits.waitingFrames,
+              limits.encoderFrames, limits.getBytes() / (1024.0 * 1024.0));
+}
+
+void StreamPipeline::finalize(void) {
+
+    detector.terminate();
+    encoder.terminate();
+
+    releaseFramePool(&nv12FramePool, "NV12");
+    releaseFramePool(&i420FramePool, "I420");
+}
+
+void StreamPipeline::releaseFramePool(FramePool **framePool, const char *name) {
+
+    if (*framePool == NULL)
+        return;
+
+    FramePoolStats stats = (*framePool)->getStats();
+
+    print_log(ANDROID_LOG_INFO, STREAM_TAG,
+              "stream %d: %s frame pool: %lld hits, %lld misses, %lld exhausted (%lld over budget)",
+              id, name, stats.hits, stats.misses, stats.exhausted, stats.overBudget);
+
+    delete *framePool;
+    *framePool = NULL;
+}
+
+void StreamPipeline::startRecord(void) {
+
+    encoder.startRecord();
+}
+
+void StreamPipeline::stopRecord(void) {
+
+    detector.flush();
+
+    encoder.stopRecord();
+}
+
+void StreamPipeline::restartRecordIfFramesTooFarApart(long long realtimeTimestamp) {
+
+    if (lastMotionRealtimeTimestamp != 0) {
+
+        long long RECORD_SPLIT_TIME = (long long) 6 * 60 * 60 * 1000 * 1000 * 1000;
+        long long elapsed = realtimeTimestamp - lastMotionRealtimeTimestamp;
+
+        if (elapsed >= RECORD_SPLIT_TIME) {
+
+            print_log(ANDROID_LOG_INFO, STREAM_TAG, "stream %d: restarting record", id);
+
+            lastMotionRealtimeTimestamp = 0;
+
+            stopRecord();
+            startRecord();
+        }
+    }
+}
+
+bool StreamPipeline::canAcceptFrame(void) {
+
+    return detector.canAcceptFrame();
+}
+
+void StreamPipeline::sendFrame(uint8_t* dataY, uint8_t* dataU, uint8_t* dataV,
+                               int strideY, int strideU, int strideV, int pixelStrideUV, long long timestamp) {
+
+    restartRecordIfFramesTooFarApart(timestamp);
+
+    if (canAcceptFrame()) {
+
+        bool isNV12 = is_yuv420_888_nv12(dataU, dataV, strideU, strideV, pixelStrideUV) != 0;
+
+        AVFrame *yuvFrame = (isNV12 ? nv12FramePool : i420FramePool)->getFrame();
+        if (yuvFrame == NULL) {
+
+            print_log(ANDROID_LOG_WARN, STREAM_TAG, "Frame drop at frame pool");
+
+            EngineStats::getInstance().countDrop(DropAtFramePool);
+
+            detector.frameDropped();
+            return;
+        }
+
+        yuvFrame->pts = timestamp;
+
+        double startTime = getTime();
+
+        if (isNV12)
+            convert_yuv420_888_to_nv12(dataY, dataU, strideY, strideU, yuvFrame);
+        else
+            convert_yuv420_888_to_yuv420p(dataY, dataU, dataV, strideY, strideU, strideV, pixelStrideUV,
+                                          yuvFrame);
+
+        EngineStats::getInstance().addLatency(StageConvert, getTime() - startTime);
+
+        detector.sendFrame(yuvFrame);
+    } else {
+        print_log(ANDROID_LOG_WARN, STREAM_TAG, "Frame drop");
+
+        EngineStats::getInstance().countDrop(DropAtEngine);
+
+        detector.frameDropped();
+    }
+}
+
+void StreamPipeline::motionDetected(AVFrame* yuvFrame, long long realtimeTimestamp, bool haveMotion) {
+
+    if (haveMotion)
+        lastMotionRealtimeTimestamp = realtimeTimestamp;
+
+    encoder.sendFrame(yuvFrame, haveMotion);
+}
+
+void StreamPipeline::motionDetectorCallback(void *opaque, AVFrame *yuvFrame, long long realtimeTimestamp,
+                                            bool haveMotion) {
+
+    ((StreamPipeline*) opaque)->motionDetected(yuvFrame, realtimeTimestamp, haveMotion);
+}
@@ -0,0 +1,80 @@
+#ifndef PEOPLEWATCHER_STREAMPIPELINE_H
+#define PEOPLEWATCHER_STREAMPIPELINE_H
+
+#include <string>
+#include <inttypes.h>
+
+extern "C" {
+#include "libavutil/frame.h"
+}
+
+#include "AsyncIO.h"
+#include "DetectionPool.h"
+#include "Encoder.h"
+#include "FrameBudget.h"
+#include "FramePool.h"
+#include "MotionDetector.h"
+
+struct StreamConfig {
+    std::string outputDir;
+    int width, height;
+    int preRollSeconds;     // encoded seconds kept before motion, 0 records only frames with motion
+    size_t frameMemory;     // slice of the engine frame budget in bytes, 0 takes all that other streams left
+    MotionDetectorConfig detector;
+
+    StreamConfig(void) : width(0), height(0), preRollSeconds(0), frameMemory(0) { }
+};
+
+// everything that belongs to one camera: frame pools, detector and encoder
+class StreamPipeline {
+public:
+    StreamPipeline(int id, const StreamConfig &config);
+    ~StreamPipeline(void);
+
+    StreamPipeline(StreamPipeline const&)  = delete;
+    void operator=(StreamPipeline const&)  = delete;
+private:
+    int id;
+    StreamConfig config;
+    FrameLimits limits;
+
+    // slice of engineFrameBudget, pools of the stream draw only from it
+    FrameBudget *engineFrameBudget;
+    FrameBudget frameBudget;
+
+    long long lastMotionRealtimeTimestamp;
+
+    // camera frames are kept in NV12 when source is semi-planar, planar sources use I420
+    FramePool *nv12FramePool, *i420FramePool;
+
+    MotionDetector detector;
+    Encoder encoder;
+
+    void restartRecordIfFramesTooFarApart(long long realtimeTimestamp);
+    void releaseFramePool(FramePool **framePool, const char *name);
+
+    static void motionDetectorCallback(void *opaque, AVFrame *yuvFrame, long long realtimeTimestamp,
+                                       bool haveMotion);
+    void motionDetected(AVFrame* yuvFrame, long long realtimeTimestamp, bool haveMotion);
+public:
+    // all these methods should be called from the thread that delivers frames of this stream
+
+    // classifier may be NULL, every motion is recorded then
+    void initialize(AsyncIO *asyncIO, DetectionPool *detectionPool, const ThreadPlacement *placement,
+                    const ThreadBudget *budget, FrameBudget *frameBudget, const PersonClassifier *classifier);
+    void finalize(void);
+
+    void startRecord(void);
+    void stopRecord(void);
+    bool canAcceptFrame(void);
+    double getDetectionLoad(void) { return detector.getLoad(); }
+    double getEncoderLoad(void) { return encoder.getLoad(); }
+    void sendFrame(uint8_t* dataY, uint8_t* dataU, uint8_t* dataV,
+                   int strideY, int strideU, int strideV, int pixelStrideUV, long long timestamp);
+
+    int getId(void) const { return id; }
+    const StreamConfig& getConfig(void) const { return config; }
+    const FrameLimits& getFrameLimits(void) const { return limits; }
+};
+
+#endif //PEOPLEWATCHER_STREAMPIPELINE_H
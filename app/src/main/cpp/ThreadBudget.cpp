@@ -0,0 +1,100 @@
+#include "ThreadBudget.h"
+
+#include <unistd.h>
+
+#include "log.h"
+#include "exceptionUtils.h"
+#include "EngineStats.h"
+
+extern "C" {
+#include "generalUtils.h"
+}
+
+#define BUDGET_TAG "PW_BUDGET"
+
+ThreadBudget::ThreadBudget(void) : cores(1), maxDetectionThreads(1), detectionThreads(1), streamsCount(1),
+                                   detectionLoad(0), encoderLoad(0), lastRebalanceTime(0) {
+
+    pthread_check_error(pthread_mutex_init(&mutex, NULL));
+}
+
+ThreadBudget::~ThreadBudget(void) {
+
+    pthread_check_error(pthread_mutex_destroy(&mutex));
+}
+
+void ThreadBudget::initialize(const ThreadPlacement &placement, int maxPoolThreads) {
+
+    // coordination and IO threads mostly wait, only detection and encoding are counted
+    long online = sysconf(_SC_NPROCESSORS_ONLN);
+
+    // pinned detection and encoding only get fast cores
+    if (placement.getRoleCpus(RoleDetection) != 0)
+        online = placement.getFastCpusCount();
+
+    cores = (int) (online > 1 ? online : 1);
+
+    // one core is left to the encoder, more come from rebalancing
+    maxDetectionThreads = cores > 1 ? cores - 1 : 1;
+    if (maxDetectionThreads > maxPoolThreads)
+        maxDetectionThreads = maxPoolThreads;
+
+    detectionThreads = maxDetectionThreads;
+
+    detectionLoad = 0;
+    encoderLoad = 0;
+    lastRebalanceTime = getTime();
+
+    print_log(ANDROID_LOG_INFO, BUDGET_TAG, "Thread budget: %d cores, %d detection threads, %d encoder threads, "
+              "%d OpenCV threads", cores, getDetectionThreads(), getEncoderThreads(), getOpenCVThreads());
+}
+
+int ThreadBudget::getEncoderThreads(void) const {
+
+    int encoders = streamsCount;
+    int perEncoder = (cores - detectionThreads) / (encoders > 0 ? encoders : 1);
+
+    return perEncoder > 1 ? perEncoder : 1;
+}
+
+bool ThreadBudget::sampleLoad(double detectionLoad, double encoderLoad) {
+
+    // another stream is sampling right now, one sample less doesn't change the average
+    if (pthread_mutex_trylock(&mutex) != 0)
+        return false;
+
+    this->detectionLoad += LOAD_SMOOTHING * (detectionLoad - this->detectionLoad);
+    this->encoderLoad += LOAD_SMOOTHING * (encoderLoad - this->encoderLoad);
+
+    bool changed = false;
+    double now = getTime();
+
+    if (now - lastRebalanceTime >= REBALANCE_INTERVAL) {
+
+        lastRebalanceTime = now;
+
+        int threads = detectionThreads;
+
+        if (this->encoderLoad > HIGH_LOAD && this->detectionLoad < LOW_LOAD && threads > 1) {
+
+            detectionThreads = threads - 1;
+            EngineStats::getInstance().countEvent(CounterCoreToEncoder);
+            changed = true;
+
+        } else if (this->detectionLoad > HIGH_LOAD && this->encoderLoad < LOW_LOAD && threads < maxDetectionThreads) {
+
+            detectionThreads = threads + 1;
+            EngineStats::getInstance().countEvent(CounterCoreToDetection);
+            changed = true;
+        }
+
+        if (changed)
+            print_log(ANDROID_LOG_INFO, BUDGET_TAG, "Rebalanced (detection load %.2f, encoder load %.2f): "
+                      "%d detection threads, %d encoder threads", this->detectionLoad, this->encoderLoad,
+                      getDetectionThreads(), getEncoderThreads());
+    }
+
+    pthread_check_error(pthread_mutex_unlock(&mutex));
+
+    return changed;
+}
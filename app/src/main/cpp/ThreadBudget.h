@@ -0,0 +1,57 @@
+#ifndef PEOPLEWATCHER_THREADBUDGET_H
+#define PEOPLEWATCHER_THREADBUDGET_H
+
+#include <atomic>
+
+#include <pthread.h>
+
+#include "ThreadPlacement.h"
+
+// One split of the cores detection and encoding run on between OpenCV, the detection pool and libx264.
+// Every library gets its thread count from here when it is initialized instead of sizing itself by the
+// number of cores. Cores move one at a time between detection and encoding when one side keeps its queue
+// full while the other one is idle.
+class ThreadBudget {
+public:
+    ThreadBudget(void);
+    ~ThreadBudget(void);
+
+    ThreadBudget(ThreadBudget const&)    = delete;
+    void operator=(ThreadBudget const&)  = delete;
+private:
+    // queue fill (0..1) above which a side asks for a core, and below which it can give one away
+    static constexpr double HIGH_LOAD = 0.5;
+    static constexpr double LOW_LOAD = 0.25;
+    // weight of one sample in the average load
+    static constexpr double LOAD_SMOOTHING = 0.05;
+    // seconds between two moves, encoders only pick the change up with their next record anyway
+    static constexpr double REBALANCE_INTERVAL = 2.0;
+
+    int cores;
+    int maxDetectionThreads;
+
+    // encoding gets the cores detection doesn't use, at least one
+    std::atomic_int detectionThreads;
+    std::atomic_int streamsCount;
+
+    // sampling and moves, streams sample from their own threads
+    pthread_mutex_t mutex;
+    double detectionLoad, encoderLoad;
+    double lastRebalanceTime;
+public:
+    void initialize(const ThreadPlacement &placement, int maxPoolThreads);
+    void setStreamsCount(int streamsCount) { this->streamsCount = streamsCount; }
+
+    // queue fill of one stream, returns true when the detection pool has to be resized
+    bool sampleLoad(double detectionLoad, double encoderLoad);
+
+    int getCores(void) const { return cores; }
+    // parallel_for_ inside one detection, detection workers already run pairs in parallel
+    int getOpenCVThreads(void) const { return 1; }
+    int getMaxDetectionThreads(void) const { return maxDetectionThreads; }
+    int getDetectionThreads(void) const { return detectionThreads; }
+    // libx264 threads of one encoder, applied when it opens the next record
+    int getEncoderThreads(void) const;
+};
+
+#endif //PEOPLEWATCHER_THREADBUDGET_H
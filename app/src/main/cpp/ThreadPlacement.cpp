@@ -0,0 +1,247 @@
+#include "ThreadPlacement.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <sched.h>
+#include <unistd.h>
+
+#include "log.h"
+
+#define PLACEMENT_TAG "PW_PLACEMENT"
+
+ThreadPlacement::ThreadPlacement(void) : policy(PlacementFloating), cpusCount(0), capacities(),
+                                         capacitiesKnown(false), fastCpus(0), efficientCpus(0), roleCpus() {
+}
+
+bool ThreadPlacement::readSysfsValue(const char *path, long long *value) {
+
+    FILE *f = fopen(path, "r");
+    if (f == NULL)
+        return false;
+
+    bool read = fscanf(f, "%lld", value) == 1;
+
+    fclose(f);
+
+    return read;
+}
+
+void ThreadPlacement::readCapacities(const char *sysfsRoot) {
+
+    char path[256];
+
+    // "0-7" like list of cores the kernel knows, the last one tells how many there are
+    long configured = 0;
+
+    snprintf(path, sizeof(path), "%s/possible", sysfsRoot);
+    FILE *f = fopen(path, "r");
+
+    if (f != NULL) {
+
+        char list[128];
+
+        if (fgets(list, sizeof(list), f) != NULL) {
+
+            const char *last = list + strcspn(list, "\n");
+            while (last > list && (last[-1] >= '0' && last[-1] <= '9'))
+                last--;
+
+            configured = atol(last) + 1;
+        }
+
+        fclose(f);
+    }
+
+    if (configured <= 0)
+        configured = sysconf(_SC_NPROCESSORS_CONF);
+
+    cpusCount = (int) (configured < 1 ? 1 : configured > MAX_CPUS ? MAX_CPUS : configured);
+
+    long long values[MAX_CPUS];
+    long long maxValue = 0;
+
+    for (int cpu = 0; cpu < cpusCount; cpu++) {
+
+        long long online = 1;
+
+        // cpu0 usually has no online file, it can't be taken offline
+        snprintf(path, sizeof(path), "%s/cpu%d/online", sysfsRoot, cpu);
+        readSysfsValue(path, &online);
+
+        values[cpu] = 0;
+
+        if (online == 0)
+            continue;
+
+        // arm64 kernels export capacity normalized to 1024, others only frequencies
+        snprintf(path, sizeof(path), "%s/cpu%d/cpu_capacity", sysfsRoot, cpu);
+        if (!readSysfsValue(path, values + cpu)) {
+
+            snprintf(path, sizeof(path), "%s/cpu%d/cpufreq/cpuinfo_max_freq", sysfsRoot, cpu);
+            if (!readSysfsValue(path, values + cpu))
+                values[cpu] = -1;
+        }
+
+        if (values[cpu] > maxValue)
+            maxValue = values[cpu];
+    }
+
+    capacitiesKnown = maxValue > 0;
+
+    for (int cpu = 0; cpu < cpusCount; cpu++) {
+
+        if (values[cpu] == 0)
+            capacities[cpu] = 0;
+        else if (!capacitiesKnown || values[cpu] < 0)
+            capacities[cpu] = 1024;     // nothing to compare, treat as fast
+        else
+            capacities[cpu] = (int) (values[cpu] * 1024 / maxValue);
+    }
+}
+
+void ThreadPlacement::initialize(PlacementPolicy policy, const char *sysfsRoot) {
+
+    this->policy = policy;
+
+    readCapacities(sysfsRoot);
+
+    fastCpus = 0;
+    efficientCpus = 0;
+
+    int minCapacity = 1024;
+
+    for (int cpu = 0; cpu < cpusCount; cpu++) {
+        if (capacities[cpu] > 0 && capacities[cpu] < minCapacity)
+            minCapacity = capacities[cpu];
+    }
+
+    for (int cpu = 0; cpu < cpusCount; cpu++) {
+
+        if (capacities[cpu] == 0)
+            continue;
+
+        if (capacities[cpu] > minCapacity || minCapacity == 1024)
+            fastCpus |= (uint64_t) 1 << cpu;
+        else
+            efficientCpus |= (uint64_t) 1 << cpu;
+    }
+
+    for (int role = 0; role < ThreadRolesCount; role++)
+        roleCpus[role] = 0;
+
+    if (policy == PlacementCapacity) {
+
+        roleCpus[RoleDetection] = fastCpus;
+        roleCpus[RoleEncoder] = fastCpus;
+
+        // without efficient cores coordination and IO share all cores
+        roleCpus[RoleCoordination] = efficientCpus != 0 ? efficientCpus : fastCpus;
+        roleCpus[RoleIO] = efficientCpus != 0 ? efficientCpus : fastCpus;
+    }
+
+    char fast[128], efficient[128];
+    formatCpus(fastCpus, fast, sizeof(fast));
+    formatCpus(efficientCpus, efficient, sizeof(efficient));
+
+    print_log(ANDROID_LOG_INFO, PLACEMENT_TAG, "Placement %s: %d cpus, fast %s, efficient %s%s",
+              getPolicyName(policy), cpusCount, fast, efficientCpus != 0 ? efficient : "none",
+              capacitiesKnown ? "" : " (capacities unknown)");
+}
+
+int ThreadPlacement::getFastCpusCount(void) const {
+
+    int count = 0;
+
+    for (int cpu = 0; cpu < cpusCount; cpu++) {
+        if (fastCpus & ((uint64_t) 1 << cpu))
+            count++;
+    }
+
+    return count;
+}
+
+void ThreadPlacement::placeCurrentThread(ThreadRole role) const {
+
+    uint64_t cpus = roleCpus[role];
+    if (cpus == 0)
+        return;
+
+    cpu_set_t cpuSet;
+    CPU_ZERO(&cpuSet);
+
+    for (int cpu = 0; cpu < cpusCount; cpu++) {
+        if (cpus & ((uint64_t) 1 << cpu))
+            CPU_SET(cpu, &cpuSet);
+    }
+
+    // pid 0 is the calling thread
+    if (sched_setaffinity(0, sizeof(cpuSet), &cpuSet) != 0)
+        print_log(ANDROID_LOG_WARN, PLACEMENT_TAG, "Couldn't place %s thread", getRoleName(role));
+}
+
+void ThreadPlacement::formatCpus(uint64_t cpus, char *buffer, int bufferSize) {
+
+    int length = 0;
+    buffer[0] = '\0';
+
+    for (int cpu = 0; cpu < MAX_CPUS && length < bufferSize; cpu++) {
+
+        if (!(cpus & ((uint64_t) 1 << cpu)))
+            continue;
+
+        int last = cpu;
+        while (last + 1 < MAX_CPUS && (cpus & ((uint64_t) 1 << (last + 1))))
+            last++;
+
+        if (last == cpu)
+            length += snprintf(buffer + length, bufferSize - length, "%s%d", length > 0 ? "," : "", cpu);
+        else
+            length += snprintf(buffer + length, bufferSize - length, "%s%d-%d", length > 0 ? "," : "", cpu, last);
+
+        cpu = last;
+    }
+
+    if (cpus == 0)
+        snprintf(buffer, bufferSize, "any");
+}
+
+const char* ThreadPlacement::getRoleName(ThreadRole role) {
+
+    switch (role) {
+        case RoleDetection:
+            return "detection";
+        case RoleEncoder:
+            return "encoder";
+        case RoleCoordination:
+            return "coordination";
+        case RoleIO:
+            return "io";
+        default:
+            return "unknown";
+    }
+}
+
+const char* ThreadPlacement::getPolicyName(PlacementPolicy policy) {
+
+    switch (policy) {
+        case PlacementFloating:
+            return "floating";
+        case PlacementCapacity:
+            return "capacity";
+        default:
+            return "unknown";
+    }
+}
+
+PlacementPolicy ThreadPlacement::getPolicyByName(const char *name) {
+
+    for (int policy = 0; policy < PlacementPoliciesCount; policy++) {
+
+        if (strcmp(name, getPolicyName((PlacementPolicy) policy)) == 0)
+            return (PlacementPolicy) policy;
+    }
+
+    return PlacementPoliciesCount;
+}
@@ -0,0 +1,64 @@
+#ifndef PEOPLEWATCHER_THREADPLACEMENT_H
+#define PEOPLEWATCHER_THREADPLACEMENT_H
+
+#include <inttypes.h>
+
+// threads of the engine by what they do
+enum ThreadRole {
+    RoleDetection,          // detection pool workers, optical flow
+    RoleEncoder,            // encoder threads, x264 threads inherit their placement
+    RoleCoordination,       // motion detector threads that pair frames and schedule detections
+    RoleIO,                 // async IO thread
+    ThreadRolesCount
+};
+
+enum PlacementPolicy {
+    PlacementFloating,      // no affinity, scheduler decides
+    PlacementCapacity,      // detection and encoding on fast cores, coordination and IO on efficient ones
+    PlacementPoliciesCount
+};
+
+// Core capacities learned from sysfs (cpu_capacity, or max frequency when the kernel doesn't export it)
+// and cores every role may run on according to the policy. Cores of the slowest cluster are efficient,
+// all others (big and prime alike) are fast; homogeneous systems have only fast cores.
+class ThreadPlacement {
+public:
+    ThreadPlacement(void);
+
+    static const int MAX_CPUS = 64;
+private:
+    PlacementPolicy policy;
+
+    int cpusCount;
+    // relative, fastest core is 1024, offline cores are 0
+    int capacities[MAX_CPUS];
+    bool capacitiesKnown;
+
+    uint64_t fastCpus, efficientCpus;
+    uint64_t roleCpus[ThreadRolesCount];    // 0 if role isn't pinned
+
+    static bool readSysfsValue(const char *path, long long *value);
+    void readCapacities(const char *sysfsRoot);
+public:
+    void initialize(PlacementPolicy policy, const char *sysfsRoot = "/sys/devices/system/cpu");
+
+    PlacementPolicy getPolicy(void) const { return policy; }
+    int getCpusCount(void) const { return cpusCount; }
+    int getCapacity(int cpu) const { return capacities[cpu]; }
+    bool areCapacitiesKnown(void) const { return capacitiesKnown; }
+    int getFastCpusCount(void) const;
+    uint64_t getRoleCpus(ThreadRole role) const { return roleCpus[role]; }
+
+    // sets affinity of the calling thread, threads it creates afterwards inherit it
+    void placeCurrentThread(ThreadRole role) const;
+
+    // "0-3,6" like sysfs lists, "any" for an empty mask
+    static void formatCpus(uint64_t cpus, char *buffer, int bufferSize);
+
+    static const char* getRoleName(ThreadRole role);
+    static const char* getPolicyName(PlacementPolicy policy);
+    // returns PlacementPoliciesCount for unknown names
+    static PlacementPolicy getPolicyByName(const char *name);
+};
+
+#endif //PEOPLEWATCHER_THREADPLACEMENT_H
@@ -2,8 +2,13 @@
 
 #include <stdexcept>
 #include <ios>
-#include <jni.h>
 #include <string>
+#include <csignal>
+#include <cstdio>
+
+#ifdef __ANDROID__
+
+#include <jni.h>
 
 #include "coffeecatch.h"
 #include "coffeejni.h"
@@ -59,6 +64,8 @@ void swallow_cpp_exception_and_throw_java(JNIEnv *env) {
     }
 }
 
+#endif
+
 void my_assert(bool condition) {
 
     if (!condition)
@@ -6,14 +6,37 @@ import java.nio.ByteBuffer;
 
 final class EngineManager {
 
-    static public native void initializeEngine(String rootDir);
+    // detector engines, values match DetectorEngineType
+    static final int DETECTOR_FARNEBACK = 0;
+    static final int DETECTOR_MOG2 = 1;
+    static final int DETECTOR_CNT = 2;
+    static final int DETECTOR_DIS_ULTRAFAST = 3;
+    static final int DETECTOR_DIS_FAST = 4;
+    static final int DETECTOR_FIXED_FLOW = 5;
 
-    static public native void startRecord();
+    // thread placement policies, values match PlacementPolicy
+    static final int PLACEMENT_FLOATING = 0;
+    static final int PLACEMENT_CAPACITY = 1;
 
-    static public native void sendFrame(ByteBuffer Y, ByteBuffer U, ByteBuffer V,
-                                        int strideY, int strideU, int strideV, long timestamp);
+    // detection zone kinds, each zone is kind, points count and x, y of every point in frame pixels
+    static final int ZONE_INCLUDE = 0;
+    static final int ZONE_EXCLUDE = 1;
 
-    static public native void stopRecord();
+    // personModel is a person classifier model file, motion without a person isn't recorded; null records any motion
+    static public native void initializeEngine(int threadPlacement, String personModel);
+
+    // returns stream id that is passed to all per stream calls,
+    // preRollSeconds of encoded video before motion go into the record too, 0 records only motion
+    static public native int addStream(String outputDir, int width, int height, int[] detectionZones,
+                                       int detectorEngine, int preRollSeconds);
+
+    static public native void startRecord(int streamId);
+
+    static public native void sendFrame(int streamId, ByteBuffer Y, ByteBuffer U, ByteBuffer V,
+                                        int strideY, int strideU, int strideV, int pixelStrideUV,
+                                        long timestamp);
+
+    static public native void stopRecord(int streamId);
 
     static public native void finalizeEngine();
 }
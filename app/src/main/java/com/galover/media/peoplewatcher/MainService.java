@@ -93,6 +93,13 @@ public class MainService extends IntentService {
         }.start();
     }
 
+    // model is uploaded over FTP, without it every motion is recorded
+    String getPersonModel() {
+        File personModel = new File(FtpRootDir + "/PersonClassifier.pwpc");
+
+        return personModel.exists() ? personModel.getAbsolutePath() : null;
+    }
+
     String createRecordsDir() {
         File recordsDir = new File(FtpRootDir + "/Records");
         if (!recordsDir.exists())
@@ -112,11 +119,16 @@ public class MainService extends IntentService {
         // preventCPUTurnOff();
         preventWiFiTurnOff();
 
-        EngineManager.initializeEngine(createRecordsDir());
+        // encoder and detection on big cores, so a burst of motion doesn't land them on little ones
+        EngineManager.initializeEngine(EngineManager.PLACEMENT_CAPACITY, getPersonModel());
+
+        int streamId = EngineManager.addStream(createRecordsDir(),
+                MyCameraManager.WIDTH, MyCameraManager.HEIGHT, MyCameraManager.DETECTION_ZONES,
+                EngineManager.DETECTOR_FARNEBACK, MyCameraManager.PRE_ROLL_SECONDS);
 
         setupFTPServer();
 
-        cameraManager = new MyCameraManager(this);
+        cameraManager = new MyCameraManager(this, streamId);
 
         if (!cameraManager.openBackRearCamera())
             throw new Error("Cannot open back rear camera");
@@ -28,6 +28,12 @@ final class MyCameraManager  {
 
     static final int WIDTH  = 640;
     static final int HEIGHT = 480;
+    // top rows are ignored by motion detector
+    static final int[] DETECTION_ZONES = {
+            EngineManager.ZONE_EXCLUDE, 4, 0, 0, WIDTH - 1, 0, WIDTH - 1, 199, 0, 199
+    };
+    // seconds before motion kept encoded, so a record shows how it started
+    static final int PRE_ROLL_SECONDS = 15;
 
     private Context context;
     private CameraManager manager;
@@ -36,10 +42,12 @@ final class MyCameraManager  {
     private Surface frameSurface;
     private CameraCaptureSession session;
     private long startTime;
+    private int streamId;
 
-    MyCameraManager(Context ctx) {
+    MyCameraManager(Context ctx, int streamId) {
 
         context = ctx;
+        this.streamId = streamId;
         frame = ImageReader.newInstance(WIDTH, HEIGHT, ImageFormat.YUV_420_888, 10);
         frameSurface = frame.getSurface();
         manager = (CameraManager) context.getSystemService(Context.CAMERA_SERVICE);
@@ -95,9 +103,10 @@ final class MyCameraManager  {
                 Image.Plane planeU = planes[1];
                 Image.Plane planeV = planes[2];
 
-                EngineManager.sendFrame(
+                EngineManager.sendFrame(streamId,
                         planeY.getBuffer(), planeU.getBuffer(), planeV.getBuffer(),
                         planeY.getRowStride(), planeU.getRowStride(), planeV.getRowStride(),
+                        planeU.getPixelStride(),
                         image.getTimestamp());
 
                 if (startTime == 0)
@@ -150,7 +159,7 @@ final class MyCameraManager  {
 
                         Log.i(CAMERA_TAG, "camera configured");
 
-                        EngineManager.startRecord();
+                        EngineManager.startRecord(streamId);
 
                         startTime = 0;
 